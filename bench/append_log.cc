@@ -0,0 +1,93 @@
+#include "bench.hpp"
+#include <unistd.h>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/append_log.cc
+ * @brief Durable commits per second with several producer threads, syncing after every record
+ * against group commit through AppendLog, with the default zero filled preallocation and without
+ * preallocation (every commit grows the file).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t record_size = 128;
+
+template <class F>
+static void run_producers(
+  std::string_view variant, size_t threads, size_t per_thread, F &&commit
+) {
+  std::vector<bench::LatencySamples> samples(threads);
+  std::vector<std::thread> producers;
+  auto beg = bench::now_ns();
+  for (size_t t = 0; t < threads; t += 1) {
+    producers.emplace_back([&, t]() {
+      auto record = std::string(record_size, static_cast<char>('a' + t % 26));
+      for (size_t i = 0; i < per_thread; i += 1) {
+        auto t0 = bench::now_ns();
+        if (!commit(record)) return;
+        samples[t].add(bench::now_ns() - t0);
+      }
+    });
+  }
+  for (auto &p : producers) {
+    p.join();
+  }
+  auto elapsed = static_cast<double>(bench::now_ns() - beg);
+  bench::LatencySamples all;
+  for (auto &s : samples) {
+    all.samples.insert(all.samples.end(), s.samples.begin(), s.samples.end());
+  }
+  auto commits = static_cast<double>(all.samples.size());
+  bench::emit(
+    "append_log",
+    variant,
+    {{"threads", static_cast<double>(threads)},
+     {"commits", commits},
+     {"commits_per_sec", commits * 1e9 / elapsed},
+     {"p50_ns", static_cast<double>(all.percentile(50))},
+     {"p99_ns", static_cast<double>(all.percentile(99))}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t threads = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8;
+  size_t per_thread = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 250;
+  std::string path = argc > 3 ? argv[3] : "jowi_io_bench_append_log";
+
+  {
+    auto file = io::OpenOptions{}.write().create().truncate().append().open(path).value();
+    std::mutex mtx;
+    run_producers("per_record_sync", threads, per_thread, [&](std::string_view record) {
+      std::lock_guard lck{mtx};
+      return file.write(record).and_then([&](size_t) { return file.sync(); }).has_value();
+    });
+  }
+  ::unlink(path.c_str());
+
+  {
+    auto log = io::AppendLog::open(path).value();
+    // the first commit zero fills the preallocation, keep it out of the measurement.
+    if (!log->submit(std::string(record_size, 'w')).get()) return 1;
+    run_producers("group_commit", threads, per_thread, [&](std::string_view record) {
+      return log->submit(std::string{record}).get().has_value();
+    });
+  }
+  ::unlink(path.c_str());
+
+  {
+    auto log = io::AppendLog::open(path, io::AppendLogOptions{}.preallocate(0)).value();
+    if (!log->submit(std::string(record_size, 'w')).get()) return 1;
+    run_producers("group_commit_no_prealloc", threads, per_thread, [&](std::string_view record) {
+      return log->submit(std::string{record}).get().has_value();
+    });
+  }
+  ::unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include "bench.hpp"
+#include <sys/poll.h>
+#include <sys/resource.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/async_lines.cc
+ * @brief Lines per second parsed from many concurrent pipes (1000 by default) by a single thread
+ * polling AsyncLineNextable streams, against a blocking BufNextable | LineNextable chain on one
+ * thread per pipe. The single thread calls poll_next(), which is what awaiting anext() runs.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t lines_per_chunk = 64;
+
+static std::string make_chunk() {
+  std::string chunk;
+  for (size_t i = 0; i < lines_per_chunk; i += 1) {
+    chunk.append(63, 'l');
+    chunk.push_back('\n');
+  }
+  return chunk;
+}
+
+/*
+ * writes chunks_per_pipe chunks into every pipe, round robin, skipping pipes that are full.
+ */
+static void feed(std::vector<io::WriterPipe> writers, size_t chunks_per_pipe) {
+  auto chunk = make_chunk();
+  std::vector<std::pair<size_t, size_t>> progress(writers.size(), {0, 0});
+  size_t done = 0;
+  while (done < writers.size()) {
+    bool wrote = false;
+    for (size_t i = 0; i < writers.size(); i += 1) {
+      auto &[chunks, off] = progress[i];
+      if (chunks == chunks_per_pipe) continue;
+      auto res = writers[i].write(std::string_view{chunk}.substr(off));
+      if (!res) continue;
+      wrote = true;
+      off += *res;
+      if (off == chunk.size()) {
+        off = 0;
+        chunks += 1;
+        done += chunks == chunks_per_pipe ? 1 : 0;
+      }
+    }
+    if (!wrote) std::this_thread::yield();
+  }
+}
+
+static void report(const char *variant, size_t pipes, size_t lines, size_t bytes, uint64_t ns) {
+  bench::emit(
+    "async_lines",
+    variant,
+    {{"pipes", static_cast<double>(pipes)},
+     {"lines", static_cast<double>(lines)},
+     {"lines_per_sec", static_cast<double>(lines) * 1e9 / static_cast<double>(ns)},
+     {"mb_per_sec", static_cast<double>(bytes) * 1e3 / static_cast<double>(ns)}}
+  );
+}
+
+static void run_async(size_t pipe_count, size_t chunks_per_pipe) {
+  std::vector<io::ReaderPipe> readers;
+  std::vector<io::WriterPipe> writers;
+  readers.reserve(pipe_count);
+  for (size_t i = 0; i < pipe_count; i += 1) {
+    auto [r, w] = io::open_pipe().value();
+    readers.emplace_back(std::move(r));
+    writers.emplace_back(std::move(w));
+  }
+  using Stream = io::AsyncLineNextable<io::DynBuffer, io::ReaderPipe>;
+  std::vector<Stream> streams;
+  std::vector<pollfd> fds;
+  streams.reserve(pipe_count);
+  for (auto &r : readers) {
+    streams.emplace_back(io::DynBuffer{64 * 1024}, r);
+    fds.emplace_back(pollfd{r.native_handle(), POLLIN, 0});
+  }
+  size_t lines = 0;
+  size_t bytes = 0;
+  size_t open = pipe_count;
+  auto beg = bench::now_ns();
+  auto writer = std::thread{feed, std::move(writers), chunks_per_pipe};
+  while (open != 0) {
+    ::poll(fds.data(), fds.size(), -1);
+    for (size_t i = 0; i < fds.size(); i += 1) {
+      if (fds[i].revents == 0) continue;
+      while (auto res = streams[i].poll_next()) {
+        if (!*res || !**res) {
+          fds[i].fd = -1;
+          open -= 1;
+          break;
+        }
+        lines += 1;
+        bytes += (**res)->size() + 1;
+      }
+    }
+  }
+  writer.join();
+  report("async_single_thread", pipe_count, lines, bytes, bench::now_ns() - beg);
+}
+
+static void run_thread_per_pipe(size_t pipe_count, size_t chunks_per_pipe) {
+  std::vector<io::ReaderPipe> readers;
+  std::vector<io::WriterPipe> writers;
+  readers.reserve(pipe_count);
+  for (size_t i = 0; i < pipe_count; i += 1) {
+    auto [r, w] = io::open_pipe(false).value();
+    readers.emplace_back(std::move(r));
+    writers.emplace_back(std::move(w));
+  }
+  std::vector<std::pair<size_t, size_t>> counts(pipe_count, {0, 0});
+  std::vector<std::thread> threads;
+  auto beg = bench::now_ns();
+  for (size_t i = 0; i < pipe_count; i += 1) {
+    threads.emplace_back([&, i]() {
+      auto lines = io::BufNextable{io::DynBuffer{64 * 1024}, readers[i]} | io::LineNextable{};
+      while (auto line = lines.next()) {
+        if (!*line) break;
+        counts[i].first += 1;
+        counts[i].second += (*line)->size() + 1;
+      }
+    });
+  }
+  feed(std::move(writers), chunks_per_pipe);
+  size_t lines = 0;
+  size_t bytes = 0;
+  for (size_t i = 0; i < pipe_count; i += 1) {
+    threads[i].join();
+    lines += counts[i].first;
+    bytes += counts[i].second;
+  }
+  report("thread_per_pipe", pipe_count, lines, bytes, bench::now_ns() - beg);
+}
+
+int main(int argc, char **argv) {
+  size_t pipe_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+  size_t lines_per_pipe = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64 * 100;
+  size_t chunks_per_pipe = std::max<size_t>(lines_per_pipe / lines_per_chunk, 1);
+  // two descriptors per pipe.
+  rlimit lim{};
+  if (::getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  run_async(pipe_count, chunks_per_pipe);
+  run_thread_per_pipe(pipe_count, chunks_per_pipe);
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "bench.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/conn_pool.cc
+ * @brief Loopback request latency when every request opens its own connection against leasing one
+ * from a TcpConnectionPool.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t msg_size = 64;
+
+struct EchoServer {
+  io::TcpListener<io::Ipv4Address> listener;
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> workers;
+
+  void run() {
+    while (!stop.load()) {
+      if (!bench::wait_readable(listener.native_handle(), 50)) continue;
+      auto batch = listener.accept_batch(64);
+      if (!batch || !batch->has_value()) continue;
+      for (auto &sock : batch->value()) {
+        workers.emplace_back(
+          [](io::TcpSocket<io::Ipv4Address> sock) {
+            auto buf = io::DynBuffer{msg_size};
+            while (bench::recv_full(sock, buf)) {
+              if (!bench::send_all(sock, buf.read())) return;
+              buf.mark_read(buf.readable_size());
+            }
+          },
+          std::move(sock)
+        );
+      }
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+};
+
+static void request(
+  io::TcpSocket<io::Ipv4Address> &sock, std::string_view msg, io::DynBuffer &buf
+) {
+  bench::send_all(sock, msg);
+  bench::recv_full(sock, buf);
+  buf.mark_read(buf.readable_size());
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+  unsigned short port = argc > 2 ? static_cast<unsigned short>(std::atoi(argv[2])) : 41200;
+  auto opts = io::SocketOptions{}.no_delay();
+  auto listen_opts = io::SocketOptions{opts}.reuse_addr();
+  auto server = EchoServer{
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 128, listen_opts).value()
+  };
+  auto server_thread = std::thread{[&]() { server.run(); }};
+  auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+  auto msg = std::string(msg_size, 'p');
+  auto buf = io::DynBuffer{msg_size};
+
+  bench::LatencySamples no_pool;
+  for (size_t i = 0; i < n; i += 1) {
+    auto t0 = bench::now_ns();
+    auto sock = io::tcp_connect(addr, opts).value();
+    request(sock, msg, buf);
+    no_pool.add(bench::now_ns() - t0);
+  }
+
+  bench::LatencySamples pooled;
+  {
+    // the pool closes its idle connections before the server is stopped.
+    io::TcpConnectionPool<io::Ipv4Address> pool{addr, io::PoolOptions{}.socket_options(opts)};
+    for (size_t i = 0; i < n; i += 1) {
+      auto t0 = bench::now_ns();
+      auto sock = pool.acquire().value();
+      request(*sock, msg, buf);
+      sock.release();
+      pooled.add(bench::now_ns() - t0);
+    }
+  }
+
+  auto variants = {std::pair{"connect_per_request", &no_pool}, std::pair{"pooled", &pooled}};
+  for (auto [name, samples] : variants) {
+    bench::emit(
+      "tcp_connection_pool",
+      name,
+      {{"requests", static_cast<double>(n)},
+       {"p50_ns", static_cast<double>(samples->percentile(50))},
+       {"p99_ns", static_cast<double>(samples->percentile(99))},
+       {"max_ns", static_cast<double>(samples->percentile(100))}}
+    );
+  }
+  server.stop.store(true);
+  server_thread.join();
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "bench.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/dir_walk.cc
+ * @brief Entries per second walking a synthetic tree (1M files by default, 32 x 32 directories)
+ * with std::filesystem against the getdents64 walker on one and on every hardware thread. The
+ * tree is walked once before measuring so every variant runs against a warm dentry cache.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+namespace fs = std::filesystem;
+
+static constexpr size_t fanout = 32;
+
+static bool build_tree(const std::string &root, size_t file_count) {
+  if (::mkdir(root.c_str(), 0755) != 0) return false;
+  size_t leaves = fanout * fanout;
+  for (size_t i = 0; i < fanout; i += 1) {
+    auto top = root + "/d" + std::to_string(i);
+    if (::mkdir(top.c_str(), 0755) != 0) return false;
+    for (size_t j = 0; j < fanout; j += 1) {
+      auto leaf = top + "/d" + std::to_string(j);
+      if (::mkdir(leaf.c_str(), 0755) != 0) return false;
+      size_t leaf_idx = i * fanout + j;
+      size_t count = file_count / leaves + (leaf_idx < file_count % leaves ? 1 : 0);
+      for (size_t k = 0; k < count; k += 1) {
+        auto file = leaf + "/f" + std::to_string(k);
+        int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        ::close(fd);
+      }
+    }
+  }
+  return true;
+}
+
+static void report(const char *variant, size_t entries, uint64_t ns) {
+  bench::emit(
+    "dir_walk",
+    variant,
+    {{"entries", static_cast<double>(entries)},
+     {"ms", static_cast<double>(ns) / 1e6},
+     {"entries_per_sec", static_cast<double>(entries) * 1e9 / static_cast<double>(ns)}}
+  );
+}
+
+static void run_std(const std::string &root, bool with_stat) {
+  size_t entries = 0;
+  size_t files = 0;
+  auto beg = bench::now_ns();
+  for (auto it = fs::recursive_directory_iterator{root}; it != fs::recursive_directory_iterator{};
+       ++it) {
+    entries += 1;
+    // status() is a stat per entry, is_regular_file() uses the type cached from readdir.
+    bool regular = with_stat ? fs::is_regular_file(it->status()) : it->is_regular_file();
+    files += regular ? 1 : 0;
+  }
+  report(with_stat ? "std_recursive_stat" : "std_recursive", entries, bench::now_ns() - beg);
+}
+
+static void run_walker(const std::string &root, size_t thread_count) {
+  std::atomic<size_t> files{0};
+  auto beg = bench::now_ns();
+  auto stats =
+    io::walk_parallel(root, thread_count, [&](const io::Directory &, const io::DirEntry &e) {
+      if (e.type == io::EntryType::FILE) files.fetch_add(1, std::memory_order_relaxed);
+    });
+  auto ns = bench::now_ns() - beg;
+  if (!stats) {
+    std::fprintf(stderr, "walk %s: %s\n", root.c_str(), stats.error().what());
+    return;
+  }
+  auto variant = "walk_parallel_" + std::to_string(thread_count);
+  report(variant.c_str(), stats->entries, ns);
+}
+
+int main(int argc, char **argv) {
+  size_t file_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  std::string root = argc > 2 ? argv[2] : "jowi_io_bench_dir_walk";
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  if (!build_tree(root, file_count)) {
+    std::fprintf(stderr, "cannot build tree at %s\n", root.c_str());
+    fs::remove_all(root, ec);
+    return 1;
+  }
+  size_t hw = std::max(1u, std::thread::hardware_concurrency());
+  (void)io::walk_parallel(root, hw, [](const io::Directory &, const io::DirEntry &) {});
+  run_std(root, false);
+  run_std(root, true);
+  run_walker(root, 1);
+  run_walker(root, hw);
+  fs::remove_all(root, ec);
+  return 0;
+}
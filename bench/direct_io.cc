@@ -0,0 +1,101 @@
+#include "bench.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/direct_io.cc
+ * @brief Sequential write and read throughput of buffered against O_DIRECT files, and the share
+ * of the file left in the page cache afterwards (measured with mincore).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t chunk_size = 1 << 20;
+
+static double resident_pct(const std::string &path, size_t file_size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return -1;
+  void *map = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) return -1;
+  size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> pages((file_size + page - 1) / page);
+  double pct = -1;
+  if (::mincore(map, file_size, pages.data()) == 0) {
+    size_t resident = 0;
+    for (auto p : pages) {
+      resident += p & 1;
+    }
+    pct = 100.0 * static_cast<double>(resident) / static_cast<double>(pages.size());
+  }
+  ::munmap(map, file_size);
+  return pct;
+}
+
+static void drop_cache(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return;
+  ::fdatasync(fd);
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+static void emit(std::string_view variant, uint64_t ns, size_t file_size, double resident) {
+  double mb = static_cast<double>(file_size) / static_cast<double>(1 << 20);
+  bench::emit(
+    "direct_io",
+    variant,
+    {{"mb", mb},
+     {"mb_per_sec", mb * 1e9 / static_cast<double>(ns)},
+     {"page_cache_resident_pct", resident}}
+  );
+}
+
+static void run(const std::string &path, size_t file_size, bool direct) {
+  auto opts = io::OpenOptions{}.read_write().create().truncate();
+  if (direct) opts.direct();
+  auto file = opts.open(path);
+  if (!file) {
+    std::fprintf(stderr, "open %s: %s\n", path.c_str(), file.error().what());
+    return;
+  }
+  size_t align = direct ? file->direct_alignment() : 4096;
+  auto buf = io::AlignedBuffer::create(chunk_size, align).value();
+  buf.mark_write(buf.writable_size());
+
+  auto beg = bench::now_ns();
+  for (size_t off = 0; off < file_size; off += chunk_size) {
+    if (!file->write_at(buf.read(), static_cast<off_t>(off))) return;
+  }
+  (void)file->sync();
+  auto write_ns = bench::now_ns() - beg;
+  emit(
+    direct ? "direct_write" : "buffered_write", write_ns, file_size, resident_pct(path, file_size)
+  );
+
+  drop_cache(path);
+  beg = bench::now_ns();
+  for (size_t off = 0; off < file_size; off += chunk_size) {
+    buf.reset();
+    if (!file->read_at(buf, static_cast<off_t>(off))) return;
+  }
+  auto read_ns = bench::now_ns() - beg;
+  emit(direct ? "direct_read" : "buffered_read", read_ns, file_size, resident_pct(path, file_size));
+}
+
+int main(int argc, char **argv) {
+  size_t mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256;
+  // O_DIRECT is not supported on tmpfs, the default path is in the working directory.
+  std::string path = argc > 2 ? argv[2] : "jowi_io_bench_direct";
+  size_t file_size = mb << 20;
+  run(path, file_size, false);
+  run(path, file_size, true);
+  ::unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "bench.hpp"
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/frames.cc
+ * @brief Frames per second over loopback TCP through FrameEncoder and a BufNextable |
+ * FrameNextable chain, for several frame sizes, sending one frame or a batch of 64 per vectored
+ * send.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static void run(unsigned short port, size_t frame_size, size_t batch, size_t frame_count) {
+  auto listen_addr = io::Ipv4Address::listen_all(port);
+  auto server = io::create_tcp_listener(listen_addr, 16, io::SocketOptions{}.reuse_addr()).value();
+  size_t received = 0;
+  size_t bytes = 0;
+  auto server_thread = std::thread{[&]() {
+    bench::wait_readable(server.native_handle());
+    auto sock = server.accept().value().value();
+    auto frames = io::BufNextable{io::DynBuffer{256 * 1024}, sock} | io::FrameNextable{};
+    while (auto frame = frames.next()) {
+      if (!*frame) {
+        std::fprintf(stderr, "frame: %s\n", frame->error().what());
+        return;
+      }
+      received += 1;
+      bytes += (*frame)->size();
+    }
+  }};
+
+  auto body = std::string(frame_size, 'f');
+  auto bodies = std::vector<std::string_view>(batch, body);
+  auto encoder = io::FrameEncoder{};
+  auto beg = bench::now_ns();
+  {
+    auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+    auto client = io::tcp_connect(addr, io::SocketOptions{}.no_delay()).value();
+    for (size_t sent = 0; sent < frame_count; sent += batch) {
+      if (!encoder.send(client, bodies)) break;
+    }
+    // closing the client ends the stream and with it the server loop.
+  }
+  server_thread.join();
+  auto ns = bench::now_ns() - beg;
+  auto variant = std::to_string(frame_size) + "b_batch_" + std::to_string(batch);
+  bench::emit(
+    "frames",
+    variant,
+    {{"frames", static_cast<double>(received)},
+     {"frames_per_sec", static_cast<double>(received) * 1e9 / static_cast<double>(ns)},
+     {"mb_per_sec", static_cast<double>(bytes) * 1e3 / static_cast<double>(ns)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t frame_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  unsigned short port = argc > 2 ? static_cast<unsigned short>(std::atoi(argv[2])) : 41400;
+  for (size_t frame_size : {64, 1024, 16384}) {
+    for (size_t batch : {1, 64}) {
+      size_t count = frame_size > 1024 ? frame_count / 16 : frame_count;
+      run(port++, frame_size, batch, count);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,286 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/io_suite.cc
+ * @brief The `jowi_io_bench` suite: DynBuffer marks, LineIterator over a generated file, pipe
+ * throughput, loopback TCP throughput and round trip latency, and UDP datagram rate. Usage is
+ * `jowi_io_bench [section] [scale]`, section is one of buffer, lines, pipe, tcp, udp or all, scale
+ * multiplies every workload (default 1).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static double per_sec(size_t count, uint64_t ns) {
+  return static_cast<double>(count) * 1e9 / static_cast<double>(ns);
+}
+static double mb_per_sec(size_t bytes, uint64_t ns) {
+  return static_cast<double>(bytes) * 1e3 / static_cast<double>(ns);
+}
+
+/*
+ * one mark_write and one mark_read per operation. A chunk dividing the capacity never wraps, one
+ * that does not makes the pointers wrap every few operations.
+ */
+static void run_buffer(size_t scale) {
+  size_t ops = 50'000'000 * scale;
+  for (size_t chunk : {64, 48}) {
+    auto buf = io::DynBuffer{4096};
+    size_t moved = 0;
+    auto beg = bench::now_ns();
+    for (size_t i = 0; i < ops; i += 1) {
+      moved += buf.mark_write(chunk);
+      moved += buf.mark_read(buf.readable_size());
+    }
+    auto ns = bench::now_ns() - beg;
+    bench::emit(
+      "dyn_buffer",
+      chunk == 64 ? "aligned_64" : "wrapping_48",
+      {{"ns_per_op", static_cast<double>(ns) / static_cast<double>(ops)},
+       {"bytes_moved", static_cast<double>(moved)}}
+    );
+  }
+}
+
+static void run_lines(size_t scale) {
+  auto path = std::filesystem::temp_directory_path() / "jowi_io_bench_lines.txt";
+  size_t line_count = 2'000'000 * scale;
+  size_t bytes = 0;
+  {
+    auto file = io::OpenOptions{}.write().create().truncate().open(path);
+    if (!file) {
+      std::fprintf(stderr, "open %s: %s\n", path.c_str(), file.error().what());
+      return;
+    }
+    std::string chunk;
+    for (size_t i = 0; i < line_count; i += 1) {
+      // lengths from 16 to 127 bytes, separator included.
+      chunk.append(15 + i % 112, 'l');
+      chunk.push_back('\n');
+      if (chunk.size() >= (1 << 20) || i + 1 == line_count) {
+        bytes += chunk.size();
+        for (std::string_view v = chunk; !v.empty();) {
+          auto res = file->write(v);
+          if (!res) return;
+          v.remove_prefix(*res);
+        }
+        chunk.clear();
+      }
+    }
+  }
+  for (size_t buf_size : {4096, 64 * 1024}) {
+    auto file = io::OpenOptions{}.read().open(path);
+    if (!file) return;
+    size_t lines = 0;
+    auto beg = bench::now_ns();
+    for (auto line : io::LineIterator{io::DynBuffer{buf_size}, *file}) {
+      if (!line) break;
+      lines += 1;
+    }
+    auto ns = bench::now_ns() - beg;
+    bench::emit(
+      "line_iterator",
+      buf_size == 4096 ? "buf_4k" : "buf_64k",
+      {{"lines", static_cast<double>(lines)},
+       {"lines_per_sec", per_sec(lines, ns)},
+       {"mb_per_sec", mb_per_sec(bytes, ns)}}
+    );
+  }
+  std::filesystem::remove(path);
+}
+
+static void run_pipe(size_t scale) {
+  size_t total = (size_t{1} << 30) * scale;
+  auto pipe = io::open_pipe(false);
+  if (!pipe) {
+    std::fprintf(stderr, "open_pipe: %s\n", pipe.error().what());
+    return;
+  }
+  auto &[reader, writer] = *pipe;
+  size_t received = 0;
+  auto beg = bench::now_ns();
+  auto writer_thread = std::thread{[&writer, total]() {
+    auto chunk = std::string(64 * 1024, 'p');
+    for (size_t sent = 0; sent < total;) {
+      auto res = writer.write(chunk);
+      if (!res) return;
+      sent += *res;
+    }
+    // drop the write end so that the reader sees the end of the stream.
+    auto closing = std::move(writer);
+  }};
+  auto buf = io::DynBuffer{64 * 1024};
+  while (true) {
+    if (!reader.read(buf) || !buf.is_readable()) break;
+    received += buf.readable_size();
+    buf.mark_read(buf.readable_size());
+  }
+  writer_thread.join();
+  auto ns = bench::now_ns() - beg;
+  bench::emit(
+    "pipe",
+    "chunk_64k",
+    {{"mb", static_cast<double>(received) / (1 << 20)}, {"mb_per_sec", mb_per_sec(received, ns)}}
+  );
+}
+
+static std::optional<io::TcpSocket<io::Ipv4Address>> accept_one(
+  const io::TcpListener<io::Ipv4Address> &listener
+) {
+  bench::wait_readable(listener.native_handle());
+  auto sock = listener.accept();
+  if (!sock || !*sock) return std::nullopt;
+  return std::move(**sock);
+}
+
+static void run_tcp_throughput(unsigned short port, size_t scale) {
+  size_t total = (size_t{1} << 30) * scale;
+  auto listener = io::create_tcp_listener(
+    io::Ipv4Address::listen_all(port), 16, io::SocketOptions{}.reuse_addr()
+  );
+  if (!listener) {
+    std::fprintf(stderr, "listen: %s\n", listener.error().what());
+    return;
+  }
+  size_t received = 0;
+  auto server = std::thread{[&]() {
+    auto sock = accept_one(*listener);
+    if (!sock) return;
+    auto buf = io::DynBuffer{256 * 1024};
+    while (sock->read(buf) && buf.is_readable()) {
+      received += buf.readable_size();
+      buf.mark_read(buf.readable_size());
+    }
+  }};
+  auto beg = bench::now_ns();
+  {
+    auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+    auto client = io::tcp_connect(addr);
+    if (client) {
+      auto chunk = std::string(256 * 1024, 't');
+      for (size_t sent = 0; sent < total; sent += chunk.size()) {
+        if (!bench::send_all(*client, chunk)) break;
+      }
+    }
+  }
+  server.join();
+  auto ns = bench::now_ns() - beg;
+  bench::emit(
+    "tcp",
+    "throughput_256k",
+    {{"mb", static_cast<double>(received) / (1 << 20)}, {"mb_per_sec", mb_per_sec(received, ns)}}
+  );
+}
+
+static void run_tcp_latency(unsigned short port, size_t scale) {
+  size_t round_trips = 100'000 * scale;
+  auto listener = io::create_tcp_listener(
+    io::Ipv4Address::listen_all(port), 16, io::SocketOptions{}.reuse_addr()
+  );
+  if (!listener) {
+    std::fprintf(stderr, "listen: %s\n", listener.error().what());
+    return;
+  }
+  auto server = std::thread{[&]() {
+    auto sock = accept_one(*listener);
+    if (!sock) return;
+    if (!sock->set_options(io::SocketOptions{}.no_delay())) return;
+    auto buf = io::DynBuffer{64};
+    while (bench::recv_full(*sock, buf)) {
+      if (!bench::send_all(*sock, buf.read())) return;
+      buf.mark_read(buf.readable_size());
+    }
+  }};
+  bench::LatencySamples samples;
+  {
+    auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+    auto client = io::tcp_connect(addr, io::SocketOptions{}.no_delay());
+    if (client) {
+      auto msg = std::string(64, 'r');
+      auto buf = io::DynBuffer{64};
+      for (size_t i = 0; i < round_trips; i += 1) {
+        auto t0 = bench::now_ns();
+        if (!bench::send_all(*client, msg) || !bench::recv_full(*client, buf)) break;
+        samples.add(bench::now_ns() - t0);
+        buf.mark_read(buf.readable_size());
+      }
+    }
+  }
+  server.join();
+  bench::emit(
+    "tcp",
+    "round_trip_64b",
+    {{"round_trips", static_cast<double>(samples.samples.size())},
+     {"p50_us", static_cast<double>(samples.percentile(50)) / 1e3},
+     {"p99_us", static_cast<double>(samples.percentile(99)) / 1e3}}
+  );
+}
+
+/*
+ * datagrams are sent as fast as the socket accepts them, the receiver stops after 200 ms without
+ * traffic. Loopback drops when the receive queue overflows, so both rates are reported.
+ */
+static void run_udp(unsigned short port, size_t scale) {
+  size_t datagrams = 1'000'000 * scale;
+  auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+  auto receiver = io::create_udp_bind(addr, io::SocketOptions{}.reuse_addr());
+  auto sender = io::create_udp_socket<io::Ipv4Address>();
+  if (!receiver || !sender) {
+    std::fprintf(stderr, "udp sockets could not be created\n");
+    return;
+  }
+  size_t received = 0;
+  uint64_t last_ns = 0;
+  auto recv_thread = std::thread{[&]() {
+    auto buf = io::DynBuffer{2048};
+    while (bench::wait_readable(receiver->native_handle(), 200)) {
+      while (receiver->recv(buf)) {
+        received += 1;
+        buf.mark_read(buf.readable_size());
+      }
+      last_ns = bench::now_ns();
+    }
+  }};
+  auto msg = std::string(64, 'u');
+  size_t sent = 0;
+  auto beg = bench::now_ns();
+  for (size_t i = 0; i < datagrams; i += 1) {
+    sent += sender->send(msg, addr, false).has_value();
+  }
+  auto send_ns = bench::now_ns() - beg;
+  recv_thread.join();
+  bench::emit(
+    "udp",
+    "datagram_64b",
+    {{"sent_per_sec", per_sec(sent, send_ns)},
+     {"received_per_sec", per_sec(received, last_ns > beg ? last_ns - beg : 1)},
+     {"loss_pct",
+      sent == 0 ? 0 : 100.0 * static_cast<double>(sent - received) / static_cast<double>(sent)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  std::string_view section = argc > 1 ? argv[1] : "all";
+  size_t scale = argc > 2 ? std::max<size_t>(std::strtoull(argv[2], nullptr, 10), 1) : 1;
+  unsigned short port = argc > 3 ? static_cast<unsigned short>(std::atoi(argv[3])) : 41500;
+  auto selected = [&](std::string_view name) {
+    return section == "all" || section == name;
+  };
+  if (selected("buffer")) run_buffer(scale);
+  if (selected("lines")) run_lines(scale);
+  if (selected("pipe")) run_pipe(scale);
+  if (selected("tcp")) {
+    run_tcp_throughput(port, scale);
+    run_tcp_latency(port + 1, scale);
+  }
+  if (selected("udp")) run_udp(port + 2, scale);
+  return 0;
+}
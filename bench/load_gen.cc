@@ -0,0 +1,568 @@
+#include "bench.hpp"
+#include <poll.h>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/load_gen.cc
+ * @brief Open loop load generator. Requests leave on a fixed schedule (`rate` per second spread
+ * round robin over `conns` connections) whether or not earlier ones were answered, and latency is
+ * measured from the scheduled send time, so a stalled server shows up in the tail instead of
+ * lowering the offered load (coordinated omission). `service_*` metrics are measured from the
+ * actual send instead, the gap between both is the queueing the schedule exposed.
+ *
+ * Protocols: echo (payload echoed back), frame (u32 length prefixed frames, echoed), http
+ * (GET answered with a `size` byte body) and udp (datagram echo, unanswered datagrams are lost).
+ * Unless `--no-serve` is given a matching server runs on a thread of the same process.
+ *
+ * The sockets are driven with non-blocking send and recv calls and one ppoll standing in for the
+ * reactor, there is no task runtime here to resume the `asend` / `arecv` awaiters.
+ *
+ * Usage: load_gen [--proto echo|frame|http|udp] [--rate N] [--conns N] [--size N] [--seconds N]
+ *                 [--host A] [--port N] [--no-serve]
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+enum struct Proto { ECHO, FRAME, HTTP, UDP };
+
+struct Config {
+  Proto proto = Proto::ECHO;
+  double rate = 10'000;
+  size_t conns = 16;
+  size_t size = 64;
+  double seconds = 5;
+  std::string host = "127.0.0.1";
+  unsigned short port = 41600;
+  bool serve = true;
+};
+
+static constexpr std::string_view http_request = "GET / HTTP/1.1\r\nHost: jowi\r\n\r\n";
+static constexpr std::string_view header_end = "\r\n\r\n";
+static constexpr std::string_view content_length = "Content-Length: ";
+
+static const char *proto_name(Proto p) {
+  switch (p) {
+    case Proto::ECHO:
+      return "echo";
+    case Proto::FRAME:
+      return "frame";
+    case Proto::HTTP:
+      return "http";
+    case Proto::UDP:
+      return "udp";
+  }
+  return "";
+}
+
+static std::optional<Config> parse_args(int argc, char **argv) {
+  Config c;
+  for (int i = 1; i < argc; i += 1) {
+    std::string_view arg = argv[i];
+    if (arg == "--no-serve") {
+      c.serve = false;
+      continue;
+    }
+    if (i + 1 == argc) return std::nullopt;
+    std::string_view v = argv[++i];
+    if (arg == "--proto") {
+      if (v == "echo") c.proto = Proto::ECHO;
+      else if (v == "frame")
+        c.proto = Proto::FRAME;
+      else if (v == "http")
+        c.proto = Proto::HTTP;
+      else if (v == "udp")
+        c.proto = Proto::UDP;
+      else
+        return std::nullopt;
+    } else if (arg == "--rate") {
+      c.rate = std::strtod(v.data(), nullptr);
+    } else if (arg == "--conns") {
+      c.conns = std::max<size_t>(std::strtoull(v.data(), nullptr, 10), 1);
+    } else if (arg == "--size") {
+      c.size = std::strtoull(v.data(), nullptr, 10);
+    } else if (arg == "--seconds") {
+      c.seconds = std::strtod(v.data(), nullptr);
+    } else if (arg == "--host") {
+      c.host = v;
+    } else if (arg == "--port") {
+      c.port = static_cast<unsigned short>(std::atoi(v.data()));
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (c.rate <= 0 || c.seconds <= 0) return std::nullopt;
+  // udp datagrams carry their sequence number.
+  if (c.proto == Proto::UDP) c.size = std::max<size_t>(c.size, sizeof(uint64_t));
+  return c;
+}
+
+static std::string http_response(size_t size) {
+  return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n" +
+    std::string(size, 'h');
+}
+
+/*
+ * counts complete responses in a byte stream.
+ */
+struct ResponseParser {
+  Proto proto;
+  size_t size;
+  size_t echoed = 0;
+  io::FrameNextable frames{};
+  std::string http{};
+  bool failed = false;
+
+  size_t feed(std::string_view v) {
+    switch (proto) {
+      case Proto::ECHO: {
+        size_t unit = std::max<size_t>(size, 1);
+        echoed += v.size();
+        size_t done = echoed / unit;
+        echoed %= unit;
+        return done;
+      }
+      case Proto::FRAME:
+        return feed_frames(v);
+      case Proto::HTTP:
+        return feed_http(v);
+      case Proto::UDP:
+        return 0;
+    }
+    return 0;
+  }
+
+  size_t feed_frames(std::string_view v) {
+    std::optional<std::expected<std::string_view, io::IoError>> chunk{v};
+    size_t done = 0;
+    bool more = true;
+    while (more) {
+      frames.next(chunk).visit(
+        [&](io::FrameNextable::value_type frame) {
+          if (frame) {
+            done += 1;
+          } else {
+            failed = true;
+            more = false;
+          }
+        },
+        [&](auto) { more = false; }
+      );
+    }
+    return done;
+  }
+
+  size_t feed_http(std::string_view v) {
+    http.append(v);
+    size_t done = 0;
+    size_t off = 0;
+    while (true) {
+      auto end = http.find(header_end, off);
+      if (end == std::string::npos) break;
+      auto len_at = http.find(content_length, off);
+      size_t len = 0;
+      if (len_at != std::string::npos && len_at < end) {
+        len = std::strtoull(http.c_str() + len_at + content_length.size(), nullptr, 10);
+      }
+      size_t total = end + header_end.size() + len;
+      if (http.size() < total) break;
+      off = total;
+      done += 1;
+    }
+    http.erase(0, off);
+    return done;
+  }
+};
+
+/*
+ * server side, echo and frame both echo bytes back (an echoed frame is a frame), http answers every
+ * header block. Runs until stop is set.
+ */
+static void serve_tcp(
+  io::TcpListener<io::Ipv4Address> listener, const Config &c, const std::atomic<bool> &stop
+) {
+  struct Peer {
+    io::TcpSocket<io::Ipv4Address> sock;
+    std::string pending;
+    bool open;
+  };
+  auto response = http_response(c.size);
+  std::vector<Peer> peers;
+  std::vector<pollfd> fds;
+  auto buf = io::DynBuffer{64 * 1024};
+  while (!stop.load(std::memory_order_relaxed)) {
+    fds.clear();
+    fds.push_back(pollfd{listener.native_handle(), POLLIN, 0});
+    for (auto &p : peers) {
+      fds.push_back(pollfd{p.sock.native_handle(), POLLIN, 0});
+    }
+    if (::poll(fds.data(), fds.size(), 50) <= 0) continue;
+    if (fds[0].revents != 0) {
+      while (auto sock = listener.accept()) {
+        if (!*sock) break;
+        if (!(*sock)->set_options(io::SocketOptions{}.no_delay())) continue;
+        peers.emplace_back(Peer{std::move(**sock), {}, true});
+      }
+    }
+    for (size_t i = 1; i < fds.size(); i += 1) {
+      if (fds[i].revents == 0) continue;
+      auto &p = peers[i - 1];
+      bool open = true;
+      while (true) {
+        auto res = p.sock.recv(buf);
+        if (!res) {
+          open = res.error().is_would_block();
+          break;
+        }
+        if (!buf.is_readable()) {
+          open = false;
+          break;
+        }
+        if (c.proto == Proto::HTTP) {
+          p.pending.append(buf.read());
+          size_t off = 0;
+          for (auto end = p.pending.find(header_end); end != std::string::npos;
+               end = p.pending.find(header_end, off)) {
+            off = end + header_end.size();
+            open = open && bench::send_all(p.sock, response);
+          }
+          p.pending.erase(0, off);
+        } else {
+          open = bench::send_all(p.sock, buf.read());
+        }
+        buf.mark_read(buf.readable_size());
+        if (!open) break;
+      }
+      p.open = open;
+    }
+    std::erase_if(peers, [](const Peer &p) { return !p.open; });
+  }
+}
+
+static void serve_udp(io::UdpSocket<io::Ipv4Address> sock, const std::atomic<bool> &stop) {
+  auto buf = io::DynBuffer{64 * 1024};
+  while (!stop.load(std::memory_order_relaxed)) {
+    if (!bench::wait_readable(sock.native_handle(), 50)) continue;
+    while (auto from = sock.recv(buf)) {
+      (void)sock.send(buf.read(), *from);
+      buf.mark_read(buf.readable_size());
+    }
+  }
+}
+
+struct Stats {
+  bench::Histogram latency;
+  bench::Histogram service;
+  size_t sent = 0;
+  size_t completed = 0;
+  size_t errors = 0;
+  uint64_t start = 0;
+  uint64_t last = 0;
+};
+
+static void emit(const Config &c, const Stats &s) {
+  auto variant = std::format(
+    "{}_c{}_r{}_b{}", proto_name(c.proto), c.conns, static_cast<size_t>(c.rate), c.size
+  );
+  auto us = [](uint64_t ns) {
+    return static_cast<double>(ns) / 1e3;
+  };
+  double elapsed = static_cast<double>(s.last > s.start ? s.last - s.start : 1);
+  bench::emit(
+    "load_gen",
+    variant,
+    {{"target_rps", c.rate},
+     {"achieved_rps", static_cast<double>(s.completed) * 1e9 / elapsed},
+     {"sent", static_cast<double>(s.sent)},
+     {"completed", static_cast<double>(s.completed)},
+     {"errors", static_cast<double>(s.errors)},
+     {"p50_us", us(s.latency.percentile(50))},
+     {"p99_us", us(s.latency.percentile(99))},
+     {"p999_us", us(s.latency.percentile(99.9))},
+     {"max_us", us(s.latency.max)},
+     {"service_p50_us", us(s.service.percentile(50))},
+     {"service_p99_us", us(s.service.percentile(99))}}
+  );
+}
+
+/*
+ * scheduled send time of request k.
+ */
+struct Schedule {
+  uint64_t start;
+  double interval_ns;
+  size_t total;
+
+  uint64_t at(size_t k) const noexcept {
+    return start + static_cast<uint64_t>(static_cast<double>(k) * interval_ns);
+  }
+};
+
+static int wait_until(std::vector<pollfd> &fds, uint64_t deadline_ns) {
+  uint64_t now = bench::now_ns();
+  uint64_t wait = deadline_ns > now ? deadline_ns - now : 0;
+  timespec ts{static_cast<time_t>(wait / 1'000'000'000), static_cast<long>(wait % 1'000'000'000)};
+  return ::ppoll(fds.data(), fds.size(), &ts, nullptr);
+}
+
+static constexpr uint64_t drain_ns = 2'000'000'000;
+
+/*
+ * a request queued on a connection: its scheduled send time, the connection byte count at which
+ * it has fully left, and the time that happened (0 until then).
+ */
+struct Request {
+  uint64_t scheduled;
+  uint64_t end;
+  uint64_t sent;
+};
+
+struct Conn {
+  io::TcpSocket<io::Ipv4Address> sock;
+  ResponseParser parser;
+  // unanswered requests, oldest first. The first `stamped` ones have fully left the socket.
+  std::deque<Request> inflight;
+  size_t stamped;
+  // bytes queued and sent on the connection since it was opened.
+  uint64_t queued;
+  uint64_t sent;
+  std::string out;
+  size_t out_off;
+  bool open;
+};
+
+/*
+ * one non blocking send of the queued bytes of a connection. Requests whose last byte left are
+ * stamped with the current time, so that service latency does not include the time spent queued
+ * behind a full socket buffer. Returns false when the send would block or failed.
+ */
+static bool send_step(Conn &conn) {
+  auto res = conn.sock.send(std::string_view{conn.out}.substr(conn.out_off));
+  if (!res) {
+    conn.open = res.error().is_would_block();
+    return false;
+  }
+  conn.out_off += *res;
+  conn.sent += *res;
+  uint64_t now = bench::now_ns();
+  for (; conn.stamped < conn.inflight.size(); conn.stamped += 1) {
+    auto &req = conn.inflight[conn.stamped];
+    if (req.end > conn.sent) break;
+    req.sent = now;
+  }
+  return true;
+}
+
+static std::optional<Stats> run_tcp(const Config &c, const io::Ipv4Address &addr) {
+  std::string request;
+  if (c.proto == Proto::HTTP) {
+    request = http_request;
+  } else {
+    auto payload = std::string(c.size, 'q');
+    if (c.proto == Proto::FRAME) {
+      std::array<char, io::max_frame_prefix> header;
+      auto h = io::FrameEncoder{}.header(c.size, header);
+      if (!h) return std::nullopt;
+      request.append(*h);
+    }
+    request.append(payload);
+  }
+  std::vector<Conn> conns;
+  for (size_t i = 0; i < c.conns; i += 1) {
+    auto sock = io::tcp_connect(addr, io::SocketOptions{}.no_delay());
+    if (!sock) {
+      std::fprintf(stderr, "connect: %s\n", sock.error().what());
+      return std::nullopt;
+    }
+    conns.emplace_back(
+      Conn{std::move(*sock), ResponseParser{c.proto, c.size}, {}, 0, 0, 0, std::string{}, 0, true}
+    );
+  }
+
+  Stats s;
+  auto sched = Schedule{
+    bench::now_ns() + 10'000'000, 1e9 / c.rate, static_cast<size_t>(c.rate * c.seconds)
+  };
+  s.start = sched.start;
+  auto buf = io::DynBuffer{64 * 1024};
+  std::vector<pollfd> fds(conns.size());
+  size_t k = 0;
+  size_t inflight = 0;
+  while (true) {
+    uint64_t now = bench::now_ns();
+    for (; k < sched.total && sched.at(k) <= now; k += 1) {
+      auto &conn = conns[k % conns.size()];
+      if (!conn.open) {
+        s.errors += 1;
+        continue;
+      }
+      conn.out.append(request);
+      conn.queued += request.size();
+      conn.inflight.emplace_back(Request{sched.at(k), conn.queued, 0});
+      s.sent += 1;
+      inflight += 1;
+    }
+    if (k == sched.total && (inflight == 0 || now > sched.at(k) + drain_ns)) break;
+    for (size_t i = 0; i < conns.size(); i += 1) {
+      auto &conn = conns[i];
+      while (conn.open && conn.out_off < conn.out.size()) {
+        if (!send_step(conn)) break;
+      }
+      if (conn.out_off == conn.out.size()) {
+        conn.out.clear();
+        conn.out_off = 0;
+      }
+      short events = conn.out.empty() ? POLLIN : POLLIN | POLLOUT;
+      fds[i] = pollfd{conn.open ? conn.sock.native_handle() : -1, events, 0};
+    }
+    uint64_t deadline = k < sched.total ? sched.at(k) : now + 10'000'000;
+    if (wait_until(fds, deadline) <= 0) continue;
+    for (size_t i = 0; i < conns.size(); i += 1) {
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+      auto &conn = conns[i];
+      while (true) {
+        auto res = conn.sock.recv(buf);
+        if (!res || !buf.is_readable()) {
+          if (res || !res.error().is_would_block()) conn.open = false;
+          break;
+        }
+        size_t done = conn.parser.feed(buf.read());
+        buf.mark_read(buf.readable_size());
+        uint64_t at = bench::now_ns();
+        for (; done != 0 && !conn.inflight.empty(); done -= 1) {
+          auto req = conn.inflight.front();
+          conn.inflight.pop_front();
+          if (conn.stamped != 0) conn.stamped -= 1;
+          s.latency.add(at - req.scheduled);
+          s.service.add(at - (req.sent != 0 ? req.sent : req.scheduled));
+          s.completed += 1;
+          inflight -= 1;
+          s.last = at;
+        }
+        if (conn.parser.failed) conn.open = false;
+      }
+      if (!conn.open) {
+        s.errors += conn.inflight.size();
+        inflight -= conn.inflight.size();
+        conn.inflight.clear();
+        conn.stamped = 0;
+      }
+    }
+  }
+  s.errors += inflight;
+  return s;
+}
+
+static std::optional<Stats> run_udp(const Config &c, const io::Ipv4Address &addr) {
+  std::vector<io::UdpSocket<io::Ipv4Address>> socks;
+  for (size_t i = 0; i < c.conns; i += 1) {
+    auto sock = io::create_udp_socket<io::Ipv4Address>();
+    if (!sock) {
+      std::fprintf(stderr, "udp socket: %s\n", sock.error().what());
+      return std::nullopt;
+    }
+    socks.emplace_back(std::move(*sock));
+  }
+  Stats s;
+  auto sched = Schedule{
+    bench::now_ns() + 10'000'000, 1e9 / c.rate, static_cast<size_t>(c.rate * c.seconds)
+  };
+  s.start = sched.start;
+  // actual send time per sequence number, 0 once answered or never sent.
+  std::vector<uint64_t> sent_at(sched.total, 0);
+  auto payload = std::string(c.size, 'u');
+  auto buf = io::DynBuffer{64 * 1024};
+  std::vector<pollfd> fds(socks.size());
+  for (size_t i = 0; i < socks.size(); i += 1) {
+    fds[i] = pollfd{socks[i].native_handle(), POLLIN, 0};
+  }
+  size_t k = 0;
+  while (true) {
+    uint64_t now = bench::now_ns();
+    for (; k < sched.total && sched.at(k) <= now; k += 1) {
+      uint64_t seq = k;
+      std::memcpy(payload.data(), &seq, sizeof(seq));
+      if (socks[k % socks.size()].send(payload, addr)) {
+        sent_at[k] = now;
+        s.sent += 1;
+      } else {
+        s.errors += 1;
+      }
+    }
+    if (k == sched.total && (s.completed == s.sent || now > sched.at(k) + drain_ns)) break;
+    uint64_t deadline = k < sched.total ? sched.at(k) : now + 10'000'000;
+    if (wait_until(fds, deadline) <= 0) continue;
+    for (size_t i = 0; i < socks.size(); i += 1) {
+      if (fds[i].revents == 0) continue;
+      while (socks[i].recv(buf)) {
+        uint64_t seq = sched.total;
+        if (buf.readable_size() >= sizeof(seq)) std::memcpy(&seq, buf.read_beg(), sizeof(seq));
+        buf.mark_read(buf.readable_size());
+        if (seq >= sched.total || sent_at[seq] == 0) continue;
+        uint64_t at = bench::now_ns();
+        s.latency.add(at - sched.at(seq));
+        s.service.add(at - sent_at[seq]);
+        sent_at[seq] = 0;
+        s.completed += 1;
+        s.last = at;
+      }
+    }
+  }
+  s.errors += s.sent - s.completed;
+  return s;
+}
+
+int main(int argc, char **argv) {
+  auto c = parse_args(argc, argv);
+  if (!c) {
+    std::fprintf(
+      stderr,
+      "usage: load_gen [--proto echo|frame|http|udp] [--rate N] [--conns N] [--size N] "
+      "[--seconds N] [--host A] [--port N] [--no-serve]\n"
+    );
+    return 2;
+  }
+  auto addr = io::Ipv4Address::create(c->host, c->port);
+  if (!addr) {
+    std::fprintf(stderr, "address: %s\n", addr.error().what());
+    return 1;
+  }
+  std::atomic<bool> stop{false};
+  std::thread server;
+  if (c->serve) {
+    auto listen_addr = io::Ipv4Address::listen_all(c->port);
+    auto opts = io::SocketOptions{}.reuse_addr();
+    if (c->proto == Proto::UDP) {
+      auto sock = io::create_udp_bind(listen_addr, opts);
+      if (!sock) {
+        std::fprintf(stderr, "udp bind: %s\n", sock.error().what());
+        return 1;
+      }
+      server = std::thread{serve_udp, std::move(*sock), std::cref(stop)};
+    } else {
+      auto listener = io::create_tcp_listener(listen_addr, 1024, opts);
+      if (!listener) {
+        std::fprintf(stderr, "listen: %s\n", listener.error().what());
+        return 1;
+      }
+      server = std::thread{serve_tcp, std::move(*listener), std::cref(*c), std::cref(stop)};
+    }
+  }
+  auto stats = c->proto == Proto::UDP ? run_udp(*c, *addr) : run_tcp(*c, *addr);
+  stop.store(true, std::memory_order_relaxed);
+  if (server.joinable()) server.join();
+  if (!stats) return 1;
+  emit(*c, *stats);
+  return 0;
+}
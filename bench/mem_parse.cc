@@ -0,0 +1,110 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/mem_parse.cc
+ * @brief Parser throughput without syscalls: LineNextable and FrameNextable over a MemSource
+ * arena, with every read filling the buffer, with 1500 byte reads (one MTU) and with an irregular
+ * pattern that splits lines and frame prefixes. Usage is `mem_parse [mb]`, the arena size
+ * (default 64).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+struct Pattern {
+  const char *name;
+  std::vector<size_t> fills;
+};
+
+static std::vector<Pattern> patterns() {
+  return {{"fill_buffer", {}}, {"mtu_1500", {1500}}, {"irregular", {1, 7, 300, 4096, 13, 1500}}};
+}
+
+static std::string make_lines(size_t bytes, size_t &count) {
+  std::string data;
+  data.reserve(bytes + 128);
+  count = 0;
+  while (data.size() < bytes) {
+    // lengths from 16 to 127 bytes, separator included.
+    data.append(15 + count % 112, 'l');
+    data.push_back('\n');
+    count += 1;
+  }
+  return data;
+}
+
+static std::string make_frames(size_t bytes, size_t &count) {
+  std::string data;
+  data.reserve(bytes + 1024);
+  count = 0;
+  while (data.size() < bytes) {
+    auto len = static_cast<uint32_t>(16 + (count * 37) % 1000);
+    // FrameOptions defaults to big endian u32 prefixes.
+    auto be = std::endian::native == std::endian::big ? len : std::byteswap(len);
+    data.append(reinterpret_cast<const char *>(&be), sizeof(be));
+    data.append(len, 'f');
+    count += 1;
+  }
+  return data;
+}
+
+static void report(
+  const char *bench_name, const char *variant, size_t items, size_t bytes, uint64_t ns
+) {
+  bench::emit(
+    bench_name,
+    variant,
+    {{"items", static_cast<double>(items)},
+     {"items_per_sec", static_cast<double>(items) * 1e9 / static_cast<double>(ns)},
+     {"mb_per_sec", static_cast<double>(bytes) * 1e3 / static_cast<double>(ns)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t mb = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 1) : 64;
+  size_t line_count = 0;
+  size_t frame_count = 0;
+  auto lines = make_lines(mb << 20, line_count);
+  auto frames = make_frames(mb << 20, frame_count);
+  size_t line_bytes = lines.size();
+  size_t frame_bytes = frames.size();
+  auto line_src = io::MemSource{std::move(lines)};
+  auto frame_src = io::MemSource{std::move(frames)};
+
+  for (const auto &p : patterns()) {
+    line_src.rewind();
+    line_src.fills(p.fills);
+    size_t parsed = 0;
+    auto beg = bench::now_ns();
+    auto it = io::BufNextable{io::DynBuffer{64 * 1024}, line_src} | io::LineNextable{};
+    while (auto line = it.next()) {
+      if (!*line) break;
+      parsed += 1;
+    }
+    report("mem_lines", p.name, parsed, line_bytes, bench::now_ns() - beg);
+    if (parsed != line_count) std::fprintf(stderr, "lines: %zu of %zu\n", parsed, line_count);
+  }
+  for (const auto &p : patterns()) {
+    frame_src.rewind();
+    frame_src.fills(p.fills);
+    size_t parsed = 0;
+    auto beg = bench::now_ns();
+    auto it = io::BufNextable{io::DynBuffer{64 * 1024}, frame_src} | io::FrameNextable{};
+    while (auto frame = it.next()) {
+      if (!*frame) break;
+      parsed += 1;
+    }
+    report("mem_frames", p.name, parsed, frame_bytes, bench::now_ns() - beg);
+    if (parsed != frame_count) std::fprintf(stderr, "frames: %zu of %zu\n", parsed, frame_count);
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "bench.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/notifier.cc
+ * @brief Handoff from worker threads to the thread owning the reactor: EventNotifier against a
+ * mutex protected deque that writes its eventfd on every push. Reports throughput with 1 and 4
+ * producers, the eventfd writes each needed, and the latency from push to pop when the consumer
+ * sleeps in between. Usage is `notifier [items]` (default 1000000, a hundredth of it for latency).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+/*
+ * the baseline: one lock and one eventfd write per push.
+ */
+struct MutexQueue {
+  std::mutex mtx;
+  std::deque<uint64_t> items;
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  std::atomic<uint64_t> writes{0};
+
+  ~MutexQueue() {
+    ::close(fd);
+  }
+  void push(uint64_t v) {
+    {
+      std::lock_guard lck{mtx};
+      items.push_back(v);
+    }
+    uint64_t one = 1;
+    writes.fetch_add(1, std::memory_order_relaxed);
+    (void)::write(fd, &one, sizeof(one));
+  }
+  std::optional<uint64_t> wait() {
+    while (true) {
+      {
+        std::lock_guard lck{mtx};
+        if (!items.empty()) {
+          uint64_t v = items.front();
+          items.pop_front();
+          return v;
+        }
+      }
+      uint64_t count;
+      if (::read(fd, &count, sizeof(count)) < 0) bench::wait_readable(fd);
+    }
+  }
+  uint64_t notifications() const {
+    return writes.load(std::memory_order_relaxed);
+  }
+};
+
+struct NotifierQueue {
+  std::unique_ptr<io::EventNotifier<uint64_t>> n = io::EventNotifier<uint64_t>::create().value();
+
+  void push(uint64_t v) {
+    n->push(v);
+  }
+  std::optional<uint64_t> wait() {
+    return n->wait().value_or(std::nullopt);
+  }
+  uint64_t notifications() const {
+    return n->notifications();
+  }
+};
+
+template <class Queue> void throughput(const char *variant, size_t producers, size_t items) {
+  Queue q;
+  size_t per = items / producers;
+  auto beg = bench::now_ns();
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p += 1) {
+    threads.emplace_back([&q, per]() {
+      for (size_t i = 0; i < per; i += 1) {
+        q.push(i);
+      }
+    });
+  }
+  size_t total = per * producers;
+  for (size_t i = 0; i < total; i += 1) {
+    if (!q.wait()) std::abort();
+  }
+  auto ns = bench::now_ns() - beg;
+  for (auto &t : threads) {
+    t.join();
+  }
+  bench::emit(
+    "notifier_throughput",
+    variant,
+    {{"producers", static_cast<double>(producers)},
+     {"items_per_sec", static_cast<double>(total) * 1e9 / static_cast<double>(ns)},
+     {"eventfd_writes_per_item",
+      static_cast<double>(q.notifications()) / static_cast<double>(total)}}
+  );
+}
+
+/*
+ * one value at a time, the producer waits for the consumer to take it and sleeps a little, so
+ * that every pop starts from a sleeping consumer.
+ */
+template <class Queue> void latency(const char *variant, size_t rounds) {
+  Queue q;
+  std::atomic<size_t> taken{0};
+  std::thread producer{[&]() {
+    for (size_t i = 0; i < rounds; i += 1) {
+      q.push(bench::now_ns());
+      while (taken.load(std::memory_order_acquire) == i) {
+        std::this_thread::yield();
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds{20});
+    }
+  }};
+  bench::Histogram hist;
+  for (size_t i = 0; i < rounds; i += 1) {
+    auto sent = q.wait();
+    if (!sent) std::abort();
+    hist.add(bench::now_ns() - *sent);
+    taken.store(i + 1, std::memory_order_release);
+  }
+  producer.join();
+  bench::emit(
+    "notifier_latency",
+    variant,
+    {{"p50_ns", static_cast<double>(hist.percentile(50))},
+     {"p99_ns", static_cast<double>(hist.percentile(99))},
+     {"max_ns", static_cast<double>(hist.max)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t items = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 100) : 1000000;
+  for (size_t producers : {size_t{1}, size_t{4}}) {
+    throughput<NotifierQueue>("event_notifier", producers, items);
+    throughput<MutexQueue>("mutex_queue", producers, items);
+  }
+  latency<NotifierQueue>("event_notifier", items / 100);
+  latency<MutexQueue>("mutex_queue", items / 100);
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include "bench.hpp"
+#include <poll.h>
+#include <array>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/offload.cc
+ * @brief Ping latency of a socket thread that also writes and syncs a file, with the file IO done
+ * inline against offloaded to an OffloadPool whose completions are waited on next to the socket.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t msg_size = 64;
+static constexpr size_t chunk_size = 1 << 20;
+
+enum struct Mode { idle, inline_io, offload_io };
+
+struct Variant {
+  std::string_view name;
+  Mode mode;
+};
+
+static std::expected<void, io::IoError> file_work(io::LocalFile &file, std::string_view chunk) {
+  return file.seek_beg(0)
+    .and_then([&](off_t) { return file.write(chunk); })
+    .and_then([&](size_t) { return file.sync(); });
+}
+
+static void serve(
+  io::TcpSocket<io::Ipv4Address> &sock,
+  Mode mode,
+  io::LocalFile &file,
+  io::OffloadPool &pool,
+  size_t iterations
+) {
+  auto chunk = std::string(chunk_size, 'f');
+  auto buf = io::DynBuffer{msg_size};
+  auto echo = [&]() {
+    if (!bench::recv_full(sock, buf)) return false;
+    if (!bench::send_all(sock, buf.read())) return false;
+    buf.mark_read(buf.readable_size());
+    return true;
+  };
+  bool busy = false;
+  for (size_t served = 0; served < iterations;) {
+    if (mode == Mode::idle) {
+      if (!echo()) return;
+      served += 1;
+    } else if (mode == Mode::inline_io) {
+      (void)file_work(file, chunk);
+      if (bench::wait_readable(sock.native_handle(), 0)) {
+        if (!echo()) return;
+        served += 1;
+      }
+    } else {
+      if (!busy) {
+        // the job only references the file and chunk, both outlive the pool.
+        (void)pool.submit([&]() { return file_work(file, chunk); });
+        busy = true;
+      }
+      auto fds = std::array{
+        pollfd{sock.native_handle(), POLLIN, 0}, pollfd{pool.native_handle(), POLLIN, 0}
+      };
+      ::poll(fds.data(), fds.size(), -1);
+      if ((fds[1].revents & POLLIN) && pool.on_notify().value_or(0) != 0) busy = false;
+      if (fds[0].revents & POLLIN) {
+        if (!echo()) return;
+        served += 1;
+      }
+    }
+  }
+}
+
+static void run_variant(
+  const Variant &v, unsigned short port, size_t iterations, const std::string &path
+) {
+  auto file = io::OpenOptions{}.read_write().create().truncate().open(path).value();
+  auto pool = io::OffloadPool::create(2).value();
+  auto listen_addr = io::Ipv4Address::listen_all(port);
+  auto server = io::create_tcp_listener(listen_addr, 16, io::SocketOptions{}.reuse_addr()).value();
+  auto server_thread = std::thread{[&]() {
+    bench::wait_readable(server.native_handle());
+    auto sock = server.accept().value().value();
+    sock.set_options(io::SocketOptions{}.no_delay()).value();
+    serve(sock, v.mode, file, *pool, iterations);
+  }};
+
+  auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+  auto client = io::tcp_connect(addr, io::SocketOptions{}.no_delay()).value();
+  auto msg = std::string(msg_size, 'p');
+  auto resp = io::DynBuffer{msg_size};
+  bench::LatencySamples samples;
+  for (size_t i = 0; i < iterations; i += 1) {
+    auto t0 = bench::now_ns();
+    bench::send_all(client, msg);
+    if (!bench::recv_full(client, resp)) break;
+    resp.mark_read(resp.readable_size());
+    samples.add(bench::now_ns() - t0);
+    std::this_thread::sleep_for(std::chrono::microseconds{500});
+  }
+  server_thread.join();
+  bench::emit(
+    "offload_socket_latency",
+    v.name,
+    {{"iterations", static_cast<double>(iterations)},
+     {"p50_ns", static_cast<double>(samples.percentile(50))},
+     {"p99_ns", static_cast<double>(samples.percentile(99))},
+     {"max_ns", static_cast<double>(samples.percentile(100))}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+  unsigned short port = argc > 2 ? static_cast<unsigned short>(std::atoi(argv[2])) : 41300;
+  std::string path = argc > 3 ? argv[3] : "/tmp/jowi_io_bench_offload";
+  auto variants = std::array{
+    Variant{"idle", Mode::idle},
+    Variant{"inline_file_io", Mode::inline_io},
+    Variant{"offload_file_io", Mode::offload_io},
+  };
+  for (const auto &v : variants) {
+    run_variant(v, port, iterations, path);
+    port += 1;
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "bench.hpp"
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+import jowi.io;
+
+/**
+ * @file bench/range_sync.cc
+ * @brief Sustained sequential write throughput and per write latency of a large file, leaving
+ * writeback to the kernel against pacing it with sync_range and dropping written windows from the
+ * page cache.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t chunk_size = 1 << 20;
+static constexpr size_t window_size = 8 << 20;
+
+static void run(const std::string &path, size_t file_size, bool paced) {
+  auto file = io::OpenOptions{}
+                .write()
+                .create()
+                .truncate()
+                .preallocate(static_cast<off_t>(file_size))
+                .advise(io::FileAdvice::SEQUENTIAL)
+                .open(path);
+  if (!file) {
+    std::fprintf(stderr, "open %s: %s\n", path.c_str(), file.error().what());
+    return;
+  }
+  auto chunk = std::string(chunk_size, 'w');
+  bench::LatencySamples samples;
+  auto beg = bench::now_ns();
+  for (size_t off = 0; off < file_size; off += chunk_size) {
+    auto t0 = bench::now_ns();
+    if (!file->write_at(chunk, static_cast<off_t>(off))) return;
+    size_t end = off + chunk_size;
+    if (paced && end % window_size == 0) {
+      // start writeback of the window just written, then wait for the previous one and drop it.
+      auto cur = static_cast<off_t>(end - window_size);
+      (void)file->sync_range(cur, window_size);
+      if (cur != 0) {
+        auto prev = cur - static_cast<off_t>(window_size);
+        (void)file->sync_range(prev, window_size, true);
+        (void)file->advise(io::FileAdvice::DONT_NEED, prev, window_size);
+      }
+    }
+    samples.add(bench::now_ns() - t0);
+  }
+  auto sync_beg = bench::now_ns();
+  (void)file->sync();
+  auto end = bench::now_ns();
+  double mb = static_cast<double>(file_size) / static_cast<double>(1 << 20);
+  bench::emit(
+    "range_sync_write",
+    paced ? "range_sync" : "unpaced",
+    {{"mb", mb},
+     {"mb_per_sec", mb * 1e9 / static_cast<double>(end - beg)},
+     {"write_p50_ns", static_cast<double>(samples.percentile(50))},
+     {"write_p99_ns", static_cast<double>(samples.percentile(99))},
+     {"write_max_ns", static_cast<double>(samples.percentile(100))},
+     {"final_sync_ns", static_cast<double>(end - sync_beg)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2048;
+  std::string path = argc > 2 ? argv[2] : "jowi_io_bench_range_sync";
+  size_t file_size = mb << 20;
+  run(path, file_size, false);
+  ::unlink(path.c_str());
+  run(path, file_size, true);
+  ::unlink(path.c_str());
+  return 0;
+}
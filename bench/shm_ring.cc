@@ -0,0 +1,163 @@
+#include "bench.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+import jowi.io;
+
+/**
+ * @file bench/shm_ring.cc
+ * @brief Messages between two processes through a ShmRing against a TCP socket on a local
+ * address: one way throughput of 64 and 1024 byte messages, then round trip latency of 64 byte
+ * messages. The peer process is forked and maps the rings through the inherited descriptors.
+ * Usage is `shm_ring [messages]` (default 1000000, a tenth of it for round trips).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr const char *socket_path = "/tmp/jowi_io_bench_shm_ring.sock";
+static constexpr size_t rtt_size = 64;
+
+static io::ShmRing attach(const io::ShmRing &ring) {
+  auto res = io::ShmRing::attach(
+    io::FileDescriptor::manage_default(::dup(ring.mem_handle())),
+    io::FileDescriptor::manage_default(::dup(ring.native_handle()))
+  );
+  if (!res) std::_Exit(1);
+  return std::move(res).value();
+}
+
+/*
+ * child: drains `messages` one way messages of each size then echoes round trips, through the
+ * rings and through the socket.
+ */
+static void peer(io::ShmRing &req, io::ShmRing &resp, size_t messages, size_t round_trips) {
+  auto in = attach(req);
+  auto out = attach(resp);
+  for (size_t size : {size_t{64}, size_t{1024}}) {
+    for (size_t i = 0; i < messages; i += 1) {
+      auto v = in.peek();
+      if (!v || v->size() != size) std::_Exit(1);
+      in.release();
+    }
+    (void)out.send("done");
+  }
+  for (size_t i = 0; i < round_trips; i += 1) {
+    auto v = in.peek();
+    if (!v || !out.send(*v)) std::_Exit(1);
+    in.release();
+  }
+
+  auto sock = io::tcp_connect(io::LocalAddress::with_address(socket_path));
+  if (!sock) std::_Exit(1);
+  for (size_t size : {size_t{64}, size_t{1024}}) {
+    auto buf = io::DynBuffer{64 * 1024};
+    for (size_t left = messages * size; left != 0;) {
+      buf.mark_read(buf.readable_size());
+      if (!bench::wait_readable(sock->native_handle())) std::_Exit(1);
+      auto res = sock->recv(buf);
+      if (!res || buf.readable_size() == 0) std::_Exit(1);
+      left -= std::min(left, buf.readable_size());
+    }
+    if (!bench::send_all(*sock, "done")) std::_Exit(1);
+  }
+  auto buf = io::DynBuffer{rtt_size};
+  for (size_t i = 0; i < round_trips; i += 1) {
+    if (!bench::recv_full(*sock, buf) || !bench::send_all(*sock, buf.read())) std::_Exit(1);
+    buf.mark_read(buf.readable_size());
+  }
+  std::_Exit(0);
+}
+
+static void report_throughput(const char *variant, size_t size, size_t messages, uint64_t ns) {
+  bench::emit(
+    "shm_ring_throughput",
+    variant,
+    {{"msg_size", static_cast<double>(size)},
+     {"msgs_per_sec", static_cast<double>(messages) * 1e9 / static_cast<double>(ns)},
+     {"mb_per_sec", static_cast<double>(messages * size) * 1e3 / static_cast<double>(ns)}}
+  );
+}
+
+static void report_rtt(const char *variant, bench::Histogram &rtt) {
+  bench::emit(
+    "shm_ring_rtt",
+    variant,
+    {{"msg_size", static_cast<double>(rtt_size)},
+     {"p50_ns", static_cast<double>(rtt.percentile(50))},
+     {"p99_ns", static_cast<double>(rtt.percentile(99))},
+     {"max_ns", static_cast<double>(rtt.max)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t messages = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 10) : 1000000;
+  size_t round_trips = messages / 10;
+  auto req = io::ShmRing::create(1 << 20);
+  auto resp = io::ShmRing::create(1 << 20);
+  ::unlink(socket_path);
+  auto listener = io::create_tcp_listener(io::LocalAddress::with_address(socket_path), 1);
+  if (!req || !resp || !listener) {
+    std::fprintf(stderr, "setup failed\n");
+    return 1;
+  }
+  pid_t pid = ::fork();
+  if (pid == 0) peer(*req, *resp, messages, round_trips);
+
+  auto msg = std::string(1024, 'm');
+  for (size_t size : {size_t{64}, size_t{1024}}) {
+    auto beg = bench::now_ns();
+    for (size_t i = 0; i < messages; i += 1) {
+      // written in place, the consumer reads the same bytes.
+      auto slot = req->reserve(size);
+      if (!slot) return 1;
+      std::memcpy(slot->data.data(), msg.data(), size);
+      req->commit(*slot);
+    }
+    if (!resp->peek()) return 1;
+    resp->release();
+    report_throughput("shm_ring", size, messages, bench::now_ns() - beg);
+  }
+  bench::Histogram shm_rtt;
+  for (size_t i = 0; i < round_trips; i += 1) {
+    auto beg = bench::now_ns();
+    if (!req->send(std::string_view{msg}.substr(0, rtt_size)) || !resp->peek()) return 1;
+    resp->release();
+    shm_rtt.add(bench::now_ns() - beg);
+  }
+  report_rtt("shm_ring", shm_rtt);
+
+  bench::wait_readable(listener->native_handle());
+  auto accepted = listener->accept();
+  if (!accepted || !*accepted) return 1;
+  auto sock = std::move(accepted).value().value();
+  for (size_t size : {size_t{64}, size_t{1024}}) {
+    auto beg = bench::now_ns();
+    for (size_t i = 0; i < messages; i += 1) {
+      if (!bench::send_all(sock, std::string_view{msg}.substr(0, size))) return 1;
+    }
+    auto done = io::DynBuffer{4};
+    if (!bench::recv_full(sock, done)) return 1;
+    report_throughput("local_socket", size, messages, bench::now_ns() - beg);
+  }
+  bench::Histogram sock_rtt;
+  auto buf = io::DynBuffer{rtt_size};
+  for (size_t i = 0; i < round_trips; i += 1) {
+    auto beg = bench::now_ns();
+    if (!bench::send_all(sock, std::string_view{msg}.substr(0, rtt_size))) return 1;
+    if (!bench::recv_full(sock, buf)) return 1;
+    buf.mark_read(buf.readable_size());
+    sock_rtt.add(bench::now_ns() - beg);
+  }
+  report_rtt("local_socket", sock_rtt);
+
+  int status = 0;
+  ::waitpid(pid, &status, 0);
+  ::unlink(socket_path);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
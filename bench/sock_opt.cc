@@ -0,0 +1,91 @@
+#include "bench.hpp"
+#include <array>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/sock_opt.cc
+ * @brief Loopback request / response latency with and without TCP_NODELAY and corking. Requests
+ * are written as a separate header and body, the write-write-read pattern that Nagle's algorithm
+ * and delayed ACKs punish.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr size_t header_size = 16;
+static constexpr size_t body_size = 48;
+static constexpr size_t response_size = 64;
+
+struct Variant {
+  std::string_view name;
+  io::SocketOptions opts;
+  bool cork;
+};
+
+void run_variant(const Variant &v, unsigned short port, size_t iterations) {
+  auto listen_opts = io::SocketOptions{v.opts}.reuse_addr();
+  auto server =
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 16, listen_opts).value();
+  auto server_thread = std::thread{[&]() {
+    auto accept_res = server.accept();
+    while (!accept_res) {
+      bench::wait_readable(server.native_handle());
+      accept_res = server.accept();
+    }
+    auto sock = std::move(accept_res).value().value();
+    sock.set_options(v.opts).value();
+    auto req = io::DynBuffer{header_size + body_size};
+    auto resp = std::string(response_size, 'r');
+    for (size_t i = 0; i < iterations; i += 1) {
+      if (!bench::recv_full(sock, req)) return;
+      req.mark_read(req.readable_size());
+      if (!bench::send_all(sock, resp)) return;
+    }
+  }};
+
+  auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+  auto client = io::tcp_connect(addr, v.opts).value();
+  auto header = std::string(header_size, 'h');
+  auto body = std::string(body_size, 'b');
+  auto resp = io::DynBuffer{response_size};
+  bench::LatencySamples samples;
+  auto beg = bench::now_ns();
+  for (size_t i = 0; i < iterations; i += 1) {
+    auto t0 = bench::now_ns();
+    bench::send_all(client, header, v.cork);
+    bench::send_all(client, body);
+    if (!bench::recv_full(client, resp)) break;
+    resp.mark_read(resp.readable_size());
+    samples.add(bench::now_ns() - t0);
+  }
+  auto elapsed = bench::now_ns() - beg;
+  server_thread.join();
+  bench::emit(
+    "tcp_request_response",
+    v.name,
+    {{"iterations", static_cast<double>(iterations)},
+     {"p50_ns", static_cast<double>(samples.percentile(50))},
+     {"p99_ns", static_cast<double>(samples.percentile(99))},
+     {"max_ns", static_cast<double>(samples.percentile(100))},
+     {"req_per_sec", static_cast<double>(iterations) * 1e9 / static_cast<double>(elapsed)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 500;
+  unsigned short port = argc > 2 ? static_cast<unsigned short>(std::atoi(argv[2])) : 41000;
+  auto variants = std::array{
+    Variant{"default", io::SocketOptions{}, false},
+    Variant{"no_delay", io::SocketOptions{}.no_delay(), false},
+    Variant{"no_delay_cork", io::SocketOptions{}.no_delay(), true},
+  };
+  for (const auto &v : variants) {
+    run_variant(v, port, iterations);
+    port += 1;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include "bench.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+import jowi.io;
+
+/**
+ * @file bench/spawn.cc
+ * @brief Spawn + exit latency of /bin/true from a process holding a large touched heap (4 GiB by
+ * default), fork + execv against Command (posix_spawn).
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static constexpr const char *program = "/bin/true";
+
+static void run_fork(size_t iterations, double heap_gb) {
+  bench::LatencySamples samples;
+  for (size_t i = 0; i < iterations; i += 1) {
+    auto t0 = bench::now_ns();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      char *argv[] = {const_cast<char *>(program), nullptr};
+      ::execv(program, argv);
+      ::_exit(127);
+    }
+    if (pid < 0) return;
+    int status;
+    ::waitpid(pid, &status, 0);
+    samples.add(bench::now_ns() - t0);
+  }
+  bench::emit(
+    "spawn",
+    "fork_exec",
+    {{"heap_gb", heap_gb},
+     {"p50_us", static_cast<double>(samples.percentile(50)) / 1e3},
+     {"p99_us", static_cast<double>(samples.percentile(99)) / 1e3}}
+  );
+}
+
+static void run_command(size_t iterations, double heap_gb) {
+  bench::LatencySamples samples;
+  auto cmd = io::Command{program};
+  for (size_t i = 0; i < iterations; i += 1) {
+    auto t0 = bench::now_ns();
+    auto child = cmd.spawn();
+    if (!child || !child->wait()) return;
+    samples.add(bench::now_ns() - t0);
+  }
+  bench::emit(
+    "spawn",
+    "posix_spawn",
+    {{"heap_gb", heap_gb},
+     {"p50_us", static_cast<double>(samples.percentile(50)) / 1e3},
+     {"p99_us", static_cast<double>(samples.percentile(99)) / 1e3}}
+  );
+}
+
+int main(int argc, char **argv) {
+  double heap_gb = argc > 1 ? std::strtod(argv[1], nullptr) : 4;
+  size_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200;
+  // touched, so every page is mapped and fork has to copy the page tables.
+  auto heap_size = static_cast<size_t>(heap_gb * static_cast<double>(1ull << 30));
+  auto heap = std::make_unique_for_overwrite<char[]>(heap_size);
+  std::memset(heap.get(), 1, heap_size);
+  run_fork(iterations, heap_gb);
+  run_command(iterations, heap_gb);
+  return heap_size == 0 || heap[heap_size - 1] == 1 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include "bench.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+import jowi.io;
+
+/**
+ * @file bench/timer_wheel.cc
+ * @brief Cost of arming, cancelling and firing 100k timers on the timing wheel, against the
+ * per-awaiter deadline scan that TimedAwaiter performs on every loop iteration. The loop iteration
+ * is measured with the wheel advanced by the pollers (the default, once per round), advanced on
+ * every poll, and driven by its timerfd.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100'000;
+  std::mt19937 rng{42};
+  std::vector<std::chrono::milliseconds> timeouts;
+  timeouts.reserve(n);
+  for (size_t i = 0; i < n; i += 1) {
+    timeouts.emplace_back(1 + rng() % 30'000);
+  }
+
+  io::TimerWheel wheel{};
+  std::vector<io::TimerId> ids;
+  ids.reserve(n);
+  auto beg = bench::now_ns();
+  for (auto t : timeouts) {
+    ids.emplace_back(wheel.arm(t));
+  }
+  auto arm_ns = bench::now_ns() - beg;
+
+  // one loop iteration with every timer armed. Without a timerfd each pending DeadlinePoller
+  // calls poll_advance, only the first poller of an iteration reads the clock.
+  constexpr size_t iterations = 1000;
+  std::vector<uint64_t> seen(n, wheel.poll_epoch());
+  beg = bench::now_ns();
+  size_t fired = 0;
+  for (size_t i = 0; i < iterations; i += 1) {
+    for (size_t j = 0; j < n; j += 1) {
+      wheel.poll_advance(seen[j]);
+      fired += wheel.is_fired(ids[j]);
+    }
+  }
+  auto polled_iter_ns = (bench::now_ns() - beg) / iterations;
+
+  // the same iteration reading the clock on every poll.
+  beg = bench::now_ns();
+  for (size_t i = 0; i < iterations; i += 1) {
+    for (auto id : ids) {
+      wheel.advance();
+      fired += wheel.is_fired(id);
+    }
+  }
+  auto every_poll_iter_ns = (bench::now_ns() - beg) / iterations;
+
+  // driven by the timerfd, the reactor advances once per iteration and pollers check their flag.
+  beg = bench::now_ns();
+  for (size_t i = 0; i < iterations; i += 1) {
+    wheel.advance();
+    for (auto id : ids) {
+      fired += wheel.is_fired(id);
+    }
+  }
+  auto timer_fd_iter_ns = (bench::now_ns() - beg) / iterations;
+
+  beg = bench::now_ns();
+  for (auto id : ids) {
+    wheel.release(id);
+  }
+  auto cancel_ns = bench::now_ns() - beg;
+
+  // the same loop iteration when every awaiter compares its own deadline against the clock.
+  std::vector<std::chrono::steady_clock::time_point> deadlines;
+  deadlines.reserve(n);
+  auto start = std::chrono::steady_clock::now();
+  for (auto t : timeouts) {
+    deadlines.emplace_back(start + t);
+  }
+  beg = bench::now_ns();
+  for (size_t i = 0; i < iterations; i += 1) {
+    for (auto d : deadlines) {
+      fired += std::chrono::steady_clock::now() >= d;
+    }
+  }
+  auto scan_iter_ns = (bench::now_ns() - beg) / iterations;
+
+  // firing : short timeouts, the wheel is advanced until all of them expired.
+  for (size_t i = 0; i < n; i += 1) {
+    ids[i] = wheel.arm(std::chrono::milliseconds{1 + rng() % 50});
+  }
+  uint64_t advance_ns = 0;
+  uint64_t ticks = 0;
+  while (wheel.armed() != 0) {
+    auto t0 = bench::now_ns();
+    ticks += wheel.advance();
+    advance_ns += bench::now_ns() - t0;
+  }
+  for (auto id : ids) {
+    wheel.release(id);
+  }
+
+  bench::emit(
+    "timer_wheel",
+    "wheel",
+    {{"timers", static_cast<double>(n)},
+     {"arm_ns_per_timer", static_cast<double>(arm_ns) / static_cast<double>(n)},
+     {"cancel_ns_per_timer", static_cast<double>(cancel_ns) / static_cast<double>(n)},
+     {"fire_ns_per_timer", static_cast<double>(advance_ns) / static_cast<double>(n)},
+     {"ticks", static_cast<double>(ticks)},
+     {"loop_iteration_ns", static_cast<double>(polled_iter_ns)}}
+  );
+  bench::emit(
+    "timer_wheel",
+    "wheel_advance_every_poll",
+    {{"timers", static_cast<double>(n)},
+     {"loop_iteration_ns", static_cast<double>(every_poll_iter_ns)}}
+  );
+  bench::emit(
+    "timer_wheel",
+    "wheel_timer_fd",
+    {{"timers", static_cast<double>(n)},
+     {"loop_iteration_ns", static_cast<double>(timer_fd_iter_ns)}}
+  );
+  bench::emit(
+    "timer_wheel",
+    "clock_scan",
+    {{"timers", static_cast<double>(n)},
+     {"loop_iteration_ns", static_cast<double>(scan_iter_ns)},
+     {"fired", static_cast<double>(fired)}}
+  );
+  return 0;
+}
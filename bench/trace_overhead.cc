@@ -0,0 +1,108 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/trace_overhead.cc
+ * @brief Cost of the IO trace ring on loopback TCP 64 byte round trips, the workload with the most
+ * syscalls per byte. Rounds alternate tracing off and on over one connection and the best round of
+ * each mode is compared. Usage is `trace_overhead [round_trips] [port] [trace.json]`, the last
+ * argument writes the events of the final traced round as Chrome trace JSON.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static std::optional<io::TcpSocket<io::Ipv4Address>> accept_one(
+  const io::TcpListener<io::Ipv4Address> &listener
+) {
+  bench::wait_readable(listener.native_handle());
+  auto sock = listener.accept();
+  if (!sock || !*sock) return std::nullopt;
+  return std::move(**sock);
+}
+
+int main(int argc, char **argv) {
+  size_t round_trips = argc > 1 ? std::max<size_t>(std::strtoull(argv[1], nullptr, 10), 1) : 50'000;
+  unsigned short port = argc > 2 ? static_cast<unsigned short>(std::atoi(argv[2])) : 41700;
+  const char *dump_path = argc > 3 ? argv[3] : nullptr;
+  constexpr size_t rounds = 5;
+
+  auto listener = io::create_tcp_listener(
+    io::Ipv4Address::listen_all(port), 16, io::SocketOptions{}.reuse_addr()
+  );
+  if (!listener) {
+    std::fprintf(stderr, "listen: %s\n", listener.error().what());
+    return 1;
+  }
+  auto server = std::thread{[&]() {
+    auto sock = accept_one(*listener);
+    if (!sock) return;
+    if (!sock->set_options(io::SocketOptions{}.no_delay())) return;
+    auto buf = io::DynBuffer{64};
+    while (bench::recv_full(*sock, buf)) {
+      if (!bench::send_all(*sock, buf.read())) return;
+      buf.mark_read(buf.readable_size());
+    }
+  }};
+
+  // best round trips per second of each mode, index 1 is traced.
+  double best[2] = {0, 0};
+  {
+    auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+    auto client = io::tcp_connect(addr, io::SocketOptions{}.no_delay());
+    if (!client) {
+      std::fprintf(stderr, "connect: %s\n", client.error().what());
+      return 1;
+    }
+    auto msg = std::string(64, 'r');
+    auto buf = io::DynBuffer{64};
+    for (size_t round = 0; round < 2 * rounds; round += 1) {
+      bool traced = round % 2 == 1;
+      io::trace_clear();
+      io::trace_enable(traced);
+      auto beg = bench::now_ns();
+      size_t done = 0;
+      for (; done < round_trips; done += 1) {
+        if (!bench::send_all(*client, msg) || !bench::recv_full(*client, buf)) break;
+        buf.mark_read(buf.readable_size());
+      }
+      auto ns = bench::now_ns() - beg;
+      io::trace_enable(false);
+      double rate = static_cast<double>(done) * 1e9 / static_cast<double>(ns);
+      best[traced] = std::max(best[traced], rate);
+    }
+  }
+  server.join();
+
+  size_t events = 0;
+  auto threads = io::trace_collect();
+  for (const auto &t : threads) {
+    events += t.events.size();
+  }
+  bench::emit(
+    "trace",
+    "tcp_round_trip_64b",
+    {{"off_per_sec", best[0]},
+     {"on_per_sec", best[1]},
+     {"overhead_pct", best[0] == 0 ? 0 : 100.0 * (best[0] - best[1]) / best[0]},
+     {"events_last_round", static_cast<double>(events)}}
+  );
+  if (dump_path) {
+    auto json = io::trace_chrome_json(threads);
+    std::FILE *f = std::fopen(dump_path, "w");
+    if (!f) {
+      std::fprintf(stderr, "cannot open %s\n", dump_path);
+      return 1;
+    }
+    std::fwrite(json.data(), 1, json.size(), f);
+    std::fclose(f);
+  }
+  return 0;
+}
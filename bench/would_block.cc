@@ -0,0 +1,67 @@
+#include "bench.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <expected>
+import jowi.io;
+
+/**
+ * @file bench/would_block.cc
+ * @brief Cost of a read on an empty non-blocking pipe, the path every poller takes while it waits.
+ * `eager_format` reproduces the previous error path that formatted the `strerror` message into
+ * every `IoError`, `lazy` goes through `ReaderPipe::read`.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  char raw[64];
+  size_t would_block = 0;
+
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+    std::perror("pipe2");
+    return 1;
+  }
+  auto beg = bench::now_ns();
+  for (size_t i = 0; i < n; i += 1) {
+    std::expected<ssize_t, io::IoError> res = ::read(fds[0], raw, sizeof(raw));
+    if (*res == -1) {
+      int err_no = errno;
+      res = std::unexpected{io::IoError{err_no, "{}", ::strerror(err_no)}};
+      would_block += res.error().is_would_block();
+    }
+  }
+  auto eager_ns = bench::now_ns() - beg;
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  auto pipe = io::open_pipe();
+  if (!pipe) {
+    std::fprintf(stderr, "open_pipe: %s\n", pipe.error().what());
+    return 1;
+  }
+  auto &[reader, writer] = *pipe;
+  io::DynBuffer buf{64};
+  beg = bench::now_ns();
+  for (size_t i = 0; i < n; i += 1) {
+    auto res = reader.read(buf);
+    would_block += !res && res.error().is_would_block();
+  }
+  auto lazy_ns = bench::now_ns() - beg;
+
+  if (would_block != 2 * n) {
+    std::fprintf(stderr, "unexpected read results\n");
+    return 1;
+  }
+  auto per_call = [&](uint64_t ns) {
+    return static_cast<double>(ns) / static_cast<double>(n);
+  };
+  bench::emit("would_block", "eager_format", {{"ns_per_call", per_call(eager_ns)}});
+  bench::emit("would_block", "lazy", {{"ns_per_call", per_call(lazy_ns)}});
+  return 0;
+}
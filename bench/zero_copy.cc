@@ -0,0 +1,100 @@
+#include "bench.hpp"
+#include <time.h>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+import jowi.io;
+
+/**
+ * @file bench/zero_copy.cc
+ * @brief CPU time spent by the sender for multi-megabyte payloads with regular sends and with
+ * MSG_ZEROCOPY. On loopback the kernel still copies when the data reaches the receiving socket
+ * (reported as "copied"), pass the address of a remote sink, e.g. `nc -l 41100 > /dev/null`, to
+ * see the real savings.
+ */
+
+namespace io = jowi::io;
+namespace bench = jowi::io::bench;
+
+static uint64_t thread_cpu_ns() noexcept {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void sink(io::TcpListener<io::Ipv4Address> &server) {
+  auto accept_res = server.accept();
+  while (!accept_res) {
+    bench::wait_readable(server.native_handle());
+    accept_res = server.accept();
+  }
+  auto sock = std::move(accept_res).value().value();
+  auto buf = io::DynBuffer{1 << 20};
+  while (true) {
+    bench::wait_readable(sock.native_handle());
+    auto res = sock.recv(buf);
+    if (!res && res.error().err_code() == EAGAIN) continue;
+    if (!res || !buf.is_readable()) return;
+    buf.mark_read(buf.readable_size());
+  }
+}
+
+static void run_variant(
+  std::string_view name, const io::Ipv4Address &addr, bool zero_copy, size_t payload_size, size_t n
+) {
+  auto client = io::tcp_connect(addr).value();
+  if (zero_copy) {
+    if (auto res = client.enable_zero_copy(); !res) {
+      std::fprintf(stderr, "SO_ZEROCOPY: %s\n", res.error().what());
+      return;
+    }
+  }
+  auto payload = std::string(payload_size, 'z');
+  auto cpu_beg = thread_cpu_ns();
+  auto beg = bench::now_ns();
+  for (size_t i = 0; i < n; i += 1) {
+    if (zero_copy) {
+      client.send_zero_copy(payload).value();
+    } else {
+      bench::send_all(client, payload);
+    }
+  }
+  auto elapsed = bench::now_ns() - beg;
+  auto cpu = thread_cpu_ns() - cpu_beg;
+  auto bytes = static_cast<double>(payload_size * n);
+  bench::emit(
+    "tcp_send_large",
+    name,
+    {{"payload_bytes", static_cast<double>(payload_size)},
+     {"sender_cpu_ns_per_mb", static_cast<double>(cpu) / (bytes / (1 << 20))},
+     {"mb_per_sec", bytes / (1 << 20) * 1e9 / static_cast<double>(elapsed)},
+     {"copied", static_cast<double>(client.zero_copy_state().copied)}}
+  );
+}
+
+int main(int argc, char **argv) {
+  size_t payload_size = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8 << 20;
+  size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 256;
+  if (argc > 4) {
+    auto port = static_cast<unsigned short>(std::atoi(argv[4]));
+    auto addr = io::Ipv4Address::create(argv[3], port).value();
+    run_variant("copy", addr, false, payload_size, n);
+    run_variant("zero_copy", addr, true, payload_size, n);
+    return 0;
+  }
+  unsigned short port = 41100;
+  for (bool zero_copy : {false, true}) {
+    auto server = io::create_tcp_listener(
+                    io::Ipv4Address::listen_all(port), 16, io::SocketOptions{}.reuse_addr()
+    )
+                    .value();
+    auto sink_thread = std::thread{sink, std::ref(server)};
+    auto addr = io::Ipv4Address::create("127.0.0.1", port).value();
+    run_variant(zero_copy ? "zero_copy" : "copy", addr, zero_copy, payload_size, n);
+    sink_thread.join();
+    port += 1;
+  }
+  return 0;
+}
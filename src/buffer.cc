@@ -1,11 +1,17 @@
 module;
 #include <algorithm>
+#include <bit>
+#include <cerrno>
 #include <cstdint>
+#include <expected>
 #include <iterator>
+#include <memory>
+#include <new>
 #include <string>
 #include <string_view>
 export module jowi.io:buffer;
 import jowi.generic;
+import :error;
 
 namespace jowi::io {
   export template <class buffer_type>
@@ -148,4 +154,96 @@ namespace jowi::io {
         return capacity();
     }
   };
+
+  /*
+   * linear buffer whose storage and capacity are aligned, for O_DIRECT transfers. Writes land at
+   * write_beg() and reads consume from read_beg(), once everything has been read both offsets go
+   * back to the start so write_beg() is aligned again. A short write (e.g. at the end of a file)
+   * leaves write_beg() unaligned until the buffer is drained or reset.
+   */
+  export struct AlignedBuffer {
+  private:
+    struct AlignedDeleter {
+      size_t alignment;
+      void operator()(char *p) const noexcept {
+        ::operator delete[](p, std::align_val_t{alignment});
+      }
+    };
+    std::unique_ptr<char[], AlignedDeleter> __buf;
+    size_t __capacity;
+    size_t __read_ptr;
+    size_t __write_ptr;
+
+    AlignedBuffer(size_t capacity, size_t alignment) :
+      __buf{nullptr, AlignedDeleter{alignment}},
+      __capacity{(capacity + alignment - 1) / alignment * alignment}, __read_ptr{0},
+      __write_ptr{0} {
+      __buf.reset(static_cast<char *>(::operator new[](__capacity, std::align_val_t{alignment})));
+    }
+
+  public:
+    /*
+     * capacity is rounded up to a multiple of the alignment. Fails with EINVAL unless the alignment
+     * is a power of two.
+     */
+    static std::expected<AlignedBuffer, IoError> create(
+      size_t capacity, size_t alignment = 4096
+    ) noexcept {
+      if (!std::has_single_bit(alignment)) {
+        return std::unexpected{IoError{EINVAL, "alignment {} is not a power of two", alignment}};
+      }
+      return AlignedBuffer{capacity, alignment};
+    }
+
+    size_t capacity() const noexcept {
+      return __capacity;
+    }
+    size_t alignment() const noexcept {
+      return __buf.get_deleter().alignment;
+    }
+    void reset() noexcept {
+      __read_ptr = 0;
+      __write_ptr = 0;
+    }
+
+    // Write Section
+    void *write_beg() noexcept {
+      return static_cast<void *>(__buf.get() + __write_ptr);
+    }
+    size_t mark_write(size_t w_size) noexcept {
+      size_t prev_write = __write_ptr;
+      __write_ptr = std::min(__capacity, __write_ptr + w_size);
+      return __write_ptr - prev_write;
+    }
+    size_t writable_size() const noexcept {
+      return __capacity - __write_ptr;
+    }
+    bool is_writable() const noexcept {
+      return writable_size() != 0;
+    }
+
+    // Read Section
+    const void *read_beg() const noexcept {
+      return static_cast<const void *>(__buf.get() + __read_ptr);
+    }
+    const void *read_end() const noexcept {
+      return static_cast<const void *>(__buf.get() + __write_ptr);
+    }
+    std::string_view read() const noexcept {
+      return std::string_view{__buf.get() + __read_ptr, __write_ptr - __read_ptr};
+    }
+    size_t mark_read(size_t read_size) noexcept {
+      size_t prev_read = __read_ptr;
+      __read_ptr = std::min(__write_ptr, __read_ptr + read_size);
+      size_t marked = __read_ptr - prev_read;
+      if (__read_ptr == __write_ptr) reset();
+      return marked;
+    }
+    size_t readable_size() const noexcept {
+      return __write_ptr - __read_ptr;
+    }
+    bool is_readable() const noexcept {
+      return readable_size() != 0;
+    }
+  };
 }
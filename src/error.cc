@@ -1,7 +1,9 @@
 module;
+#include <cerrno>
 #include <cstring>
 #include <exception>
 #include <format>
+#include <optional>
 export module jowi.io:error;
 import jowi.generic;
 
@@ -11,12 +13,15 @@ import jowi.generic;
  */
 namespace jowi::io {
   /**
-   * @brief Exception wrapper carrying an errno value and formatted message.
+   * @brief Exception wrapper carrying an errno value and an optional formatted message. Errors
+   * created from an errno alone do not format anything, `what()` then looks the message up lazily.
    */
   export struct IoError : public std::exception {
   private:
     int __err_code;
-    generic::FixedString<64> __msg;
+    std::optional<generic::FixedString<64>> __msg;
+
+    explicit IoError(int err_code) noexcept : __err_code{err_code}, __msg{std::nullopt} {}
 
   public:
     /**
@@ -27,8 +32,8 @@ namespace jowi::io {
      */
     template <class... Args> requires(std::formattable<Args, char> && ...)
     IoError(int err_code, std::format_string<Args...> fmt, Args &&...args) noexcept :
-      __err_code{err_code}, __msg{} {
-      __msg.emplace_format(fmt, std::forward<Args>(args)...);
+      __err_code{err_code}, __msg{std::in_place} {
+      __msg->emplace_format(fmt, std::forward<Args>(args)...);
     }
 
     /**
@@ -39,20 +44,30 @@ namespace jowi::io {
       return __err_code;
     }
     /**
-     * @brief Returns the formatted error message.
+     * @brief Checks whether the operation failed only because it would have blocked.
+     * @return True for `EAGAIN` and `EWOULDBLOCK`.
+     */
+    bool is_would_block() const noexcept {
+      return __err_code == EAGAIN || __err_code == EWOULDBLOCK;
+    }
+    /**
+     * @brief Returns the formatted error message, or the `strerror` description when the error was
+     * created from an errno alone.
      * @return Null-terminated error description.
      */
     const char *what() const noexcept {
-      return __msg.begin();
+      if (__msg) return __msg->begin();
+      return ::strerror(__err_code);
     }
 
     /**
-     * @brief Creates an IO error using `strerror` for the supplied errno.
+     * @brief Creates an IO error for the supplied errno. Nothing is formatted, the `strerror`
+     * message is only looked up when `what()` is called.
      * @param err_no Error number used to produce the message.
-     * @return IO error containing errno and associated string message.
+     * @return IO error containing errno.
      */
     static IoError str_error(int err_no) noexcept {
-      return IoError{err_no, "{}", ::strerror(err_no)};
+      return IoError{err_no};
     }
   };
 }
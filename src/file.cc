@@ -18,6 +18,10 @@ namespace jowi::io {
    * @brief File seek modes mirroring POSIX origin semantics.
    */
   export enum struct SeekMode { START, CURRENT, END };
+  /**
+   * @brief Expected access pattern of a file range, a hint for caching and readahead.
+   */
+  export enum struct FileAdvice { NORMAL, SEQUENTIAL, RANDOM, WILL_NEED, DONT_NEED, NO_REUSE };
   /**
    * @brief Concept describing write capability for a file abstraction.
    */
@@ -11,5 +11,18 @@ export import :pipe;
 export import :error;
 export import :file;
 export import :buffer;
+export import :mem_io;
 export import :net_address;
-export import :net_socket;
\ No newline at end of file
+export import :net_option;
+export import :net_info;
+export import :net_socket;
+export import :net_pool;
+export import :timer_wheel;
+export import :offload;
+export import :shm_ring;
+export import :notifier;
+export import :append_log;
+export import :directory;
+export import :process;
+export import :metrics;
+export import :trace;
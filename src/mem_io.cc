@@ -0,0 +1,215 @@
+module;
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+export module jowi.io:mem_io;
+import jowi.asio;
+import :error;
+import :buffer;
+
+/**
+ * @file mem_io.cc
+ * @brief In memory `IsReadable` / `IsWritable` endpoints, so that parsers can be measured and
+ * tested without syscalls. Read and write sizes follow configurable patterns, which places chunk
+ * boundaries deterministically, and a would-block cadence drives the awaitable paths.
+ */
+
+namespace jowi::io {
+  export struct MemSource;
+  export struct MemSink;
+
+  export template <WritableBuffer Buffer> struct MemReadPoller;
+
+  export struct MemWritePoller {
+    MemSink &sink;
+    std::string_view v;
+
+    using ValueType = std::expected<size_t, IoError>;
+    std::optional<ValueType> poll() noexcept;
+  };
+
+  /*
+   * next size of a cycled pattern, unbounded when the pattern is empty.
+   */
+  size_t mem_next_size(const std::vector<size_t> &pattern, size_t &idx) noexcept {
+    if (pattern.empty()) return static_cast<size_t>(-1);
+    size_t n = pattern[idx];
+    idx = (idx + 1) % pattern.size();
+    // a zero sized transfer would read as the end of the stream.
+    return std::max<size_t>(n, 1);
+  }
+
+  /**
+   * @brief Readable source over a prebuilt arena. A read copies the next bytes into the buffer and
+   * an exhausted source reads nothing, which readers take as the end of the stream.
+   */
+  export struct MemSource {
+  private:
+    std::string __data;
+    size_t __pos;
+    std::vector<size_t> __fills;
+    size_t __fill_idx;
+    size_t __block_every;
+    size_t __calls;
+
+  public:
+    explicit MemSource(std::string data) noexcept :
+      __data{std::move(data)}, __pos{0}, __fills{}, __fill_idx{0}, __block_every{0}, __calls{0} {}
+
+    /**
+     * @brief Sizes of successive reads, cycled. A read delivers at most the next size and never
+     * more than the buffer takes. Empty, the default, fills the buffer.
+     * @return Reference to this source for chaining.
+     */
+    MemSource &fills(std::vector<size_t> sizes) noexcept {
+      __fills = std::move(sizes);
+      __fill_idx = 0;
+      return *this;
+    }
+    /**
+     * @brief Every n-th read would block: `read` fails with `EAGAIN` like a non-blocking
+     * descriptor and `aread` stays pending for that poll. 0, the default, never blocks.
+     * @return Reference to this source for chaining.
+     */
+    MemSource &would_block_every(size_t n) noexcept {
+      __block_every = n;
+      return *this;
+    }
+    /**
+     * @brief Starts over from the first byte and the first fill size.
+     */
+    void rewind() noexcept {
+      __pos = 0;
+      __fill_idx = 0;
+      __calls = 0;
+    }
+    size_t remaining() const noexcept {
+      return __data.size() - __pos;
+    }
+
+    /**
+     * @brief One read attempt, nullopt when it would block.
+     */
+    std::optional<std::expected<void, IoError>> poll_read(WritableBuffer auto &buf) noexcept {
+      __calls += 1;
+      if (__block_every != 0 && __calls % __block_every == 0) return std::nullopt;
+      size_t n = std::min({buf.writable_size(), remaining(), mem_next_size(__fills, __fill_idx)});
+      std::memcpy(buf.write_beg(), __data.data() + __pos, n);
+      buf.mark_write(n);
+      __pos += n;
+      return std::expected<void, IoError>{};
+    }
+    std::expected<void, IoError> read(WritableBuffer auto &buf) noexcept {
+      auto res = poll_read(buf);
+      if (!res) return std::unexpected{IoError::str_error(EAGAIN)};
+      return std::move(res).value();
+    }
+    template <WritableBuffer Buffer>
+    asio::InfiniteAwaiter<MemReadPoller<Buffer>> aread(Buffer &buf) noexcept {
+      return {*this, buf};
+    }
+  };
+
+  /**
+   * @brief Writable sink that counts what it is given, and keeps a copy on request.
+   */
+  export struct MemSink {
+  private:
+    std::string __data;
+    bool __keep;
+    std::vector<size_t> __accepts;
+    size_t __accept_idx;
+    size_t __block_every;
+    size_t __calls;
+    size_t __bytes;
+    size_t __writes;
+
+  public:
+    MemSink() noexcept :
+      __data{}, __keep{false}, __accepts{}, __accept_idx{0}, __block_every{0}, __calls{0},
+      __bytes{0}, __writes{0} {}
+
+    /**
+     * @brief Keeps a copy of every accepted byte, available through `data()`.
+     * @return Reference to this sink for chaining.
+     */
+    MemSink &keep(bool enable = true) noexcept {
+      __keep = enable;
+      return *this;
+    }
+    /**
+     * @brief Sizes accepted by successive writes, cycled, to exercise partial write handling.
+     * Empty, the default, accepts every write whole.
+     * @return Reference to this sink for chaining.
+     */
+    MemSink &accepts(std::vector<size_t> sizes) noexcept {
+      __accepts = std::move(sizes);
+      __accept_idx = 0;
+      return *this;
+    }
+    /**
+     * @brief Every n-th write would block, see `MemSource::would_block_every`.
+     * @return Reference to this sink for chaining.
+     */
+    MemSink &would_block_every(size_t n) noexcept {
+      __block_every = n;
+      return *this;
+    }
+
+    /**
+     * @brief One write attempt, nullopt when it would block.
+     */
+    std::optional<std::expected<size_t, IoError>> poll_write(std::string_view v) noexcept {
+      __calls += 1;
+      if (__block_every != 0 && __calls % __block_every == 0) return std::nullopt;
+      size_t n = v.empty() ? 0 : std::min(v.size(), mem_next_size(__accepts, __accept_idx));
+      if (__keep) __data.append(v.substr(0, n));
+      __bytes += n;
+      __writes += 1;
+      return n;
+    }
+    std::expected<size_t, IoError> write(std::string_view v) noexcept {
+      auto res = poll_write(v);
+      if (!res) return std::unexpected{IoError::str_error(EAGAIN)};
+      return std::move(res).value();
+    }
+    asio::InfiniteAwaiter<MemWritePoller> awrite(std::string_view v) noexcept {
+      return {*this, v};
+    }
+
+    size_t bytes() const noexcept {
+      return __bytes;
+    }
+    size_t writes() const noexcept {
+      return __writes;
+    }
+    std::string_view data() const noexcept {
+      return __data;
+    }
+    void clear() noexcept {
+      __data.clear();
+      __bytes = 0;
+      __writes = 0;
+    }
+  };
+
+  export template <WritableBuffer Buffer> struct MemReadPoller {
+    MemSource &src;
+    Buffer &buf;
+
+    using ValueType = std::expected<void, IoError>;
+    std::optional<ValueType> poll() noexcept {
+      return src.poll_read(buf);
+    }
+  };
+
+  std::optional<MemWritePoller::ValueType> MemWritePoller::poll() noexcept {
+    return sink.poll_write(v);
+  }
+}
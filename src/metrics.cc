@@ -0,0 +1,276 @@
+module;
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+export module jowi.io:metrics;
+
+/**
+ * @file metrics.cc
+ * @brief Per descriptor IO metrics. Compiled out unless `JOWI_IO_ENABLE_METRICS` is defined (CMake
+ * option `JOWI_IO_METRICS`); without it nothing is recorded and snapshots are empty.
+ *
+ * Every thread counts into its own table, so the IO path never writes to a cache line another
+ * thread writes. Counters are atomics only so that a snapshot may read them while their thread
+ * keeps counting; their single writer updates them with relaxed loads and stores, no read modify
+ * write instructions. Tables outlive their thread, counts of exited threads stay in snapshots.
+ * Descriptors are keyed by number, a number reused after close keeps accumulating.
+ */
+namespace jowi::io {
+#ifdef JOWI_IO_ENABLE_METRICS
+  export inline constexpr bool metrics_enabled = true;
+#else
+  export inline constexpr bool metrics_enabled = false;
+#endif
+
+  export enum struct IoOp : uint8_t { READ, WRITE, SEND, RECV, ACCEPT, CONNECT, SYNC };
+  export inline constexpr size_t io_op_count = 7;
+  /*
+   * bucket i counts calls that took [2^i, 2^(i + 1)) ns, the last one everything longer.
+   */
+  export inline constexpr size_t latency_bucket_count = 40;
+  /*
+   * errno values past the last bucket are counted in it.
+   */
+  inline constexpr size_t errno_bucket_count = 134;
+
+  /**
+   * @brief Log2 bucketed latencies of one operation kind.
+   */
+  export struct LatencyHistogram {
+    std::array<uint64_t, latency_bucket_count> buckets{};
+
+    uint64_t count() const noexcept {
+      uint64_t n = 0;
+      for (auto b : buckets) {
+        n += b;
+      }
+      return n;
+    }
+    /**
+     * @brief Upper bound in ns of the bucket holding the p-th percentile, within a factor of 2.
+     */
+    uint64_t percentile(double p) const noexcept {
+      uint64_t total = count();
+      if (total == 0) return 0;
+      auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total) + 0.5);
+      auto target = std::max<uint64_t>(rank, 1);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < buckets.size(); i += 1) {
+        seen += buckets[i];
+        if (seen >= target) return (uint64_t{1} << (i + 1)) - 1;
+      }
+      return (uint64_t{1} << latency_bucket_count) - 1;
+    }
+  };
+
+  /**
+   * @brief Counters of one operation kind on one descriptor. `bytes` counts transferred bytes
+   * (read, write, send, recv), `partial` writes and sends that transferred less than asked and
+   * `would_block` the `EAGAIN` returns, which are not counted as errors.
+   */
+  export struct OpMetrics {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t would_block;
+    uint64_t partial;
+    uint64_t errors;
+    LatencyHistogram latency;
+  };
+
+  export struct FdMetrics {
+    int fd;
+    std::array<OpMetrics, io_op_count> ops;
+    // (errno, count) of every errno seen, ascending.
+    std::vector<std::pair<int, uint64_t>> errors_by_errno;
+
+    const OpMetrics &op(IoOp o) const noexcept {
+      return ops[static_cast<size_t>(o)];
+    }
+  };
+
+  export struct MetricsSnapshot {
+    // ascending by descriptor.
+    std::vector<FdMetrics> fds;
+
+    const FdMetrics *find(int fd) const noexcept {
+      auto it = std::ranges::lower_bound(fds, fd, {}, &FdMetrics::fd);
+      return it != fds.end() && it->fd == fd ? &*it : nullptr;
+    }
+    /**
+     * @brief Sum of one operation kind over every descriptor.
+     */
+    OpMetrics total(IoOp o) const noexcept {
+      OpMetrics t{};
+      for (const auto &f : fds) {
+        const auto &m = f.op(o);
+        t.calls += m.calls;
+        t.bytes += m.bytes;
+        t.would_block += m.would_block;
+        t.partial += m.partial;
+        t.errors += m.errors;
+        for (size_t i = 0; i < latency_bucket_count; i += 1) {
+          t.latency.buckets[i] += m.latency.buckets[i];
+        }
+      }
+      return t;
+    }
+  };
+
+  struct Counter {
+    std::atomic<uint64_t> v{0};
+
+    // single writer, a plain load and store instead of a locked add.
+    void add(uint64_t n) noexcept {
+      v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t get() const noexcept {
+      return v.load(std::memory_order_relaxed);
+    }
+  };
+
+  struct OpCounters {
+    Counter calls;
+    Counter bytes;
+    Counter would_block;
+    Counter partial;
+    Counter errors;
+    std::array<Counter, latency_bucket_count> latency;
+  };
+
+  struct FdCounters {
+    std::array<OpCounters, io_op_count> ops;
+    std::array<Counter, errno_bucket_count> errnos;
+  };
+
+  struct ThreadCounters {
+    // taken by the owner when it adds a descriptor and by snapshots, never to count.
+    std::mutex m;
+    std::vector<std::unique_ptr<FdCounters>> fds;
+
+    FdCounters &at(size_t fd) {
+      // only the owner resizes, so it may look up without the lock.
+      if (fd >= fds.size() || !fds[fd]) {
+        std::lock_guard l{m};
+        if (fd >= fds.size()) fds.resize(fd + 1);
+        fds[fd] = std::make_unique<FdCounters>();
+      }
+      return *fds[fd];
+    }
+  };
+
+  struct MetricsRegistry {
+    std::mutex m;
+    std::vector<std::shared_ptr<ThreadCounters>> threads;
+
+    static MetricsRegistry &get() {
+      static MetricsRegistry registry;
+      return registry;
+    }
+    std::shared_ptr<ThreadCounters> attach() {
+      auto t = std::make_shared<ThreadCounters>();
+      std::lock_guard l{m};
+      threads.push_back(t);
+      return t;
+    }
+  };
+
+  ThreadCounters &thread_counters() {
+    thread_local std::shared_ptr<ThreadCounters> counters = MetricsRegistry::get().attach();
+    return *counters;
+  }
+
+  uint64_t metrics_now_ns() noexcept {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+  }
+
+  /*
+   * records one call on fd. res is the syscall return value, err_no the errno of a -1 return and
+   * requested the size of the transfer.
+   */
+  void metrics_record(
+    IoOp op, int fd, int64_t res, int err_no, size_t requested, uint64_t ns
+  ) noexcept {
+    if (fd < 0) return;
+    auto &c = thread_counters().at(static_cast<size_t>(fd));
+    auto &o = c.ops[static_cast<size_t>(op)];
+    o.calls.add(1);
+    size_t bucket = ns == 0 ? 0 : static_cast<size_t>(std::bit_width(ns)) - 1;
+    o.latency[std::min(bucket, latency_bucket_count - 1)].add(1);
+    bool transfer = op == IoOp::READ || op == IoOp::WRITE || op == IoOp::SEND || op == IoOp::RECV;
+    if (res >= 0) {
+      if (transfer) o.bytes.add(static_cast<uint64_t>(res));
+      bool is_write = op == IoOp::WRITE || op == IoOp::SEND;
+      if (is_write && static_cast<uint64_t>(res) < requested) o.partial.add(1);
+    } else if (err_no == EAGAIN || err_no == EWOULDBLOCK) {
+      o.would_block.add(1);
+    } else {
+      o.errors.add(1);
+      c.errnos[std::min(static_cast<size_t>(std::max(err_no, 0)), errno_bucket_count - 1)].add(1);
+    }
+  }
+
+  /**
+   * @brief Collects the counters of every thread, merged per descriptor. Takes the registry lock
+   * and each thread table lock in turn, counting threads only wait when they see a new descriptor.
+   * @return Descriptors with at least one recorded call.
+   */
+  export MetricsSnapshot metrics_snapshot() {
+    std::vector<FdMetrics> merged;
+    auto &registry = MetricsRegistry::get();
+    std::lock_guard rl{registry.m};
+    for (const auto &t : registry.threads) {
+      std::lock_guard tl{t->m};
+      if (merged.size() < t->fds.size()) {
+        size_t prev = merged.size();
+        merged.resize(t->fds.size());
+        for (size_t fd = prev; fd < merged.size(); fd += 1) {
+          merged[fd].fd = static_cast<int>(fd);
+        }
+      }
+      for (size_t fd = 0; fd < t->fds.size(); fd += 1) {
+        if (!t->fds[fd]) continue;
+        const auto &c = *t->fds[fd];
+        auto &m = merged[fd];
+        for (size_t op = 0; op < io_op_count; op += 1) {
+          const auto &src = c.ops[op];
+          auto &dst = m.ops[op];
+          dst.calls += src.calls.get();
+          dst.bytes += src.bytes.get();
+          dst.would_block += src.would_block.get();
+          dst.partial += src.partial.get();
+          dst.errors += src.errors.get();
+          for (size_t i = 0; i < latency_bucket_count; i += 1) {
+            dst.latency.buckets[i] += src.latency[i].get();
+          }
+        }
+        for (size_t e = 0; e < errno_bucket_count; e += 1) {
+          if (uint64_t n = c.errnos[e].get(); n != 0) {
+            auto it = std::ranges::find(m.errors_by_errno, static_cast<int>(e), [](const auto &p) {
+              return p.first;
+            });
+            if (it != m.errors_by_errno.end()) it->second += n;
+            else
+              m.errors_by_errno.emplace_back(static_cast<int>(e), n);
+          }
+        }
+      }
+    }
+    MetricsSnapshot snapshot;
+    for (auto &m : merged) {
+      bool used = std::ranges::any_of(m.ops, [](const OpMetrics &o) { return o.calls != 0; });
+      if (!used) continue;
+      std::ranges::sort(m.errors_by_errno);
+      snapshot.fds.emplace_back(std::move(m));
+    }
+    return snapshot;
+  }
+}
@@ -1,16 +1,28 @@
 module;
+#include <poll.h>
+#include <unistd.h>
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
 #include <concepts>
+#include <cstdint>
 #include <expected>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 export module jowi.io:readers;
+import jowi.asio;
 import jowi.generic;
 import :local_file;
 import :file;
 import :error;
 import :buffer;
+import :sys_call;
+import :metrics;
 
 namespace jowi::io {
   enum struct NextAction { next_end, next_continue };
@@ -51,23 +63,34 @@ namespace jowi::io {
     }
   };
 
+  /**
+   * @brief Splits chunks into separator terminated lines, the last line may be unterminated.
+   * Returned lines are the only allocation per line: consumed lines only advance an offset and the
+   * leftover is compacted once per chunk into a string that keeps its capacity.
+   */
   export struct LineNextable {
   private:
-    std::optional<std::string> __left;
+    std::string __left;
+    // start of the first line not returned yet.
+    size_t __pos;
+    // bytes of __left known to hold no separator.
+    size_t __scanned;
     char __sep;
 
     std::optional<std::string> __parse_sep() {
-      if (!__left) return std::nullopt;
-      auto sep_it = std::ranges::find(__left->begin(), __left->end(), __sep);
-      if (sep_it == __left->end()) return std::nullopt;
-      std::string pre_sep = {__left->begin(), sep_it};
-      __left.emplace(sep_it + 1, __left->end());
+      auto beg = __left.begin() + static_cast<ptrdiff_t>(std::max(__pos, __scanned));
+      auto sep_it = std::ranges::find(beg, __left.end(), __sep);
+      __scanned = __left.size();
+      if (sep_it == __left.end()) return std::nullopt;
+      std::string pre_sep = {__left.begin() + static_cast<ptrdiff_t>(__pos), sep_it};
+      __pos = static_cast<size_t>(sep_it - __left.begin()) + 1;
+      __scanned = __pos;
       return pre_sep;
     }
 
   public:
     using value_type = std::expected<std::string, IoError>;
-    LineNextable(char sep = '\n') : __left{std::nullopt}, __sep{sep} {}
+    LineNextable(char sep = '\n') : __left{}, __pos{0}, __scanned{0}, __sep{sep} {}
 
     generic::Variant<value_type, NextAction> next(
       std::optional<std::expected<std::string_view, IoError>> &prev
@@ -77,9 +100,13 @@ namespace jowi::io {
       if (pre_sep) return std::move(pre_sep).value();
       // !pre_sep !prev, nothing left to read
       if (!pre_sep && !prev) {
-        // send all leftovers
-        if (__left) {
-          return std::move(__left).value();
+        // send all leftovers, once. A trailing separator leaves nothing to send.
+        if (__pos < __left.size()) {
+          std::string rest = __left.substr(__pos);
+          __left.clear();
+          __pos = 0;
+          __scanned = 0;
+          return rest;
         } else
           // nothing else not read
           return NextAction::next_end;
@@ -87,11 +114,308 @@ namespace jowi::io {
       // !pre_sep prev , prev err
       if (prev && !(prev->has_value())) return std::unexpected{prev->error()};
       // !pre_sep prev, prev val
-      __left.emplace(__left.value_or("").append(prev->value()));
+      __left.erase(0, __pos);
+      __scanned -= __pos;
+      __pos = 0;
+      __left.append(prev->value());
       return NextAction::next_continue;
     }
   };
 
+  /**
+   * @brief Encoding of the length prefix of a frame, varint is unsigned LEB128.
+   */
+  export enum struct FramePrefix { U8, U16, U32, U64, VARINT };
+
+  /**
+   * @brief Fluent interface for configuring length prefixed frames.
+   */
+  export struct FrameOptions {
+  private:
+    FramePrefix __prefix;
+    std::endian __endian;
+    size_t __max_size;
+
+  public:
+    /**
+     * @brief Initializes with big endian 32 bit prefixes and a 16 MiB frame limit.
+     */
+    FrameOptions() noexcept :
+      __prefix{FramePrefix::U32}, __endian{std::endian::big}, __max_size{16 << 20} {}
+
+    FrameOptions &prefix(FramePrefix p) noexcept {
+      __prefix = p;
+      return *this;
+    }
+    /**
+     * @brief Byte order of fixed width prefixes, ignored for varints.
+     */
+    FrameOptions &endian(std::endian e) noexcept {
+      __endian = e;
+      return *this;
+    }
+    /**
+     * @brief Largest accepted body, longer frames fail with `EMSGSIZE`.
+     */
+    FrameOptions &max_size(size_t bytes) noexcept {
+      __max_size = bytes;
+      return *this;
+    }
+
+    FramePrefix prefix() const noexcept {
+      return __prefix;
+    }
+    std::endian endian() const noexcept {
+      return __endian;
+    }
+    size_t max_size() const noexcept {
+      return __max_size;
+    }
+    /**
+     * @brief Width of fixed prefixes, 0 for varints.
+     */
+    size_t prefix_width() const noexcept {
+      switch (__prefix) {
+        case FramePrefix::U8:
+          return 1;
+        case FramePrefix::U16:
+          return 2;
+        case FramePrefix::U32:
+          return 4;
+        case FramePrefix::U64:
+          return 8;
+        case FramePrefix::VARINT:
+          return 0;
+      }
+      return 0;
+    }
+  };
+
+  /**
+   * @brief Longest encoded frame prefix, a 64 bit varint.
+   */
+  export inline constexpr size_t max_frame_prefix = 10;
+
+  struct FrameHeader {
+    size_t len;
+    size_t size;
+  };
+
+  /*
+   * decodes the prefix at the start of v, nullopt when v only holds part of it.
+   */
+  std::expected<std::optional<FrameHeader>, IoError> decode_frame_header(
+    std::string_view v, const FrameOptions &opts
+  ) noexcept {
+    uint64_t len = 0;
+    size_t size = 0;
+    if (size_t width = opts.prefix_width(); width != 0) {
+      if (v.size() < width) return std::nullopt;
+      for (size_t i = 0; i < width; i += 1) {
+        size_t idx = opts.endian() == std::endian::big ? i : width - 1 - i;
+        len = (len << 8) | static_cast<uint8_t>(v[idx]);
+      }
+      size = width;
+    } else {
+      for (; size < v.size(); size += 1) {
+        if (size == max_frame_prefix) break;
+        auto b = static_cast<uint8_t>(v[size]);
+        len |= static_cast<uint64_t>(b & 0x7f) << (7 * size);
+        if ((b & 0x80) == 0) break;
+      }
+      if (size == max_frame_prefix) return std::unexpected{IoError{EPROTO, "malformed varint"}};
+      if (size == v.size()) return std::nullopt;
+      size += 1;
+    }
+    if (len > opts.max_size()) {
+      return std::unexpected{IoError{EMSGSIZE, "frame of {} bytes over {}", len, opts.max_size()}};
+    }
+    return FrameHeader{static_cast<size_t>(len), size};
+  }
+
+  /**
+   * @brief Splits a byte stream into length prefixed frames. A frame that arrived whole is
+   * returned as a view into the read chunk, only frames spanning reads are assembled in an
+   * internal buffer. Either view is valid until the next call. After an error (oversized frame,
+   * malformed prefix, stream ending inside a frame or a read error) the stream is no longer
+   * framed and the nextable ends.
+   */
+  export struct FrameNextable {
+  private:
+    FrameOptions __opts;
+    // bytes of the current chunk already framed.
+    size_t __off;
+    std::string __pending;
+    bool __pending_used;
+    bool __failed;
+
+    NextAction __continue() noexcept {
+      __off = 0;
+      return NextAction::next_continue;
+    }
+    std::expected<std::string_view, IoError> __fail(IoError e) noexcept {
+      __failed = true;
+      __pending.clear();
+      return std::unexpected{e};
+    }
+
+  public:
+    using value_type = std::expected<std::string_view, IoError>;
+    FrameNextable(FrameOptions opts = FrameOptions{}) :
+      __opts{opts}, __off{0}, __pending{}, __pending_used{false}, __failed{false} {}
+
+    generic::Variant<value_type, NextAction> next(
+      std::optional<std::expected<std::string_view, IoError>> &prev
+    ) {
+      if (__failed) return NextAction::next_end;
+      if (__pending_used) {
+        __pending.clear();
+        __pending_used = false;
+      }
+      if (!prev) {
+        if (__pending.empty()) return NextAction::next_end;
+        return __fail(IoError{EPROTO, "stream ended inside a frame"});
+      }
+      if (!prev->has_value()) return __fail(prev->error());
+      std::string_view avail = prev->value().substr(__off);
+      if (__pending.empty()) {
+        auto hdr = decode_frame_header(avail, __opts);
+        if (!hdr) return __fail(hdr.error());
+        if (*hdr && avail.size() - (*hdr)->size >= (*hdr)->len) {
+          __off += (*hdr)->size + (*hdr)->len;
+          return value_type{avail.substr((*hdr)->size, (*hdr)->len)};
+        }
+        // the frame spans reads.
+        if (*hdr) __pending.reserve((*hdr)->size + (*hdr)->len);
+        __pending.assign(avail);
+        return __continue();
+      }
+      while (true) {
+        auto hdr = decode_frame_header(__pending, __opts);
+        if (!hdr) return __fail(hdr.error());
+        // until the prefix is decoded, copy no further than its end.
+        size_t need = *hdr ? (*hdr)->size + (*hdr)->len - __pending.size()
+          : __opts.prefix_width() == 0 ? 1
+                                       : __opts.prefix_width() - __pending.size();
+        size_t take = std::min(need, avail.size());
+        if (*hdr && __pending.capacity() < __pending.size() + need) {
+          __pending.reserve(__pending.size() + need);
+        }
+        __pending.append(avail.substr(0, take));
+        avail.remove_prefix(take);
+        __off += take;
+        if (*hdr && take == need) {
+          __pending_used = true;
+          return value_type{std::string_view{__pending}.substr((*hdr)->size)};
+        }
+        if (avail.empty()) return __continue();
+      }
+    }
+  };
+
+  /**
+   * @brief Socket types `FrameEncoder` can send through. The handle is polled for writability when
+   * a send would block.
+   */
+  export template <class T>
+  concept VectoredSender = requires(T &s, std::span<const std::string_view> parts) {
+    { s.send_vec(parts, false) } -> std::same_as<std::expected<size_t, IoError>>;
+    { s.native_handle() } -> std::convertible_to<int>;
+  };
+
+  /**
+   * @brief Writes length prefixed frames matching `FrameNextable`. Prefixes are encoded into
+   * scratch storage reused across calls and sent along with the bodies in one vectored send.
+   */
+  export struct FrameEncoder {
+  private:
+    FrameOptions __opts;
+    std::vector<std::array<char, max_frame_prefix>> __headers;
+    std::vector<std::string_view> __parts;
+
+  public:
+    FrameEncoder(FrameOptions opts = FrameOptions{}) : __opts{opts}, __headers{}, __parts{} {}
+
+    /**
+     * @brief Encodes the prefix of a body of len bytes.
+     * @param len Body length.
+     * @param out Storage receiving the prefix.
+     * @return View of the prefix in out, or `EMSGSIZE` when len exceeds the limit or the prefix.
+     */
+    std::expected<std::string_view, IoError> header(
+      size_t len, std::array<char, max_frame_prefix> &out
+    ) const noexcept {
+      size_t width = __opts.prefix_width();
+      bool fits = width == 0 || width == 8 || len < (uint64_t{1} << (8 * width));
+      if (len > __opts.max_size() || !fits) {
+        return std::unexpected{IoError{EMSGSIZE, "frame of {} bytes over the limit", len}};
+      }
+      auto v = static_cast<uint64_t>(len);
+      if (width == 0) {
+        size_t size = 0;
+        do {
+          auto b = static_cast<uint8_t>(v & 0x7f);
+          v >>= 7;
+          out[size++] = static_cast<char>(v != 0 ? b | 0x80 : b);
+        } while (v != 0);
+        return std::string_view{out.data(), size};
+      }
+      for (size_t i = 0; i < width; i += 1) {
+        size_t idx = __opts.endian() == std::endian::big ? width - 1 - i : i;
+        out[idx] = static_cast<char>(v & 0xff);
+        v >>= 8;
+      }
+      return std::string_view{out.data(), width};
+    }
+
+    /**
+     * @brief Sends a batch of frames, blocking until every byte has been written. A send that
+     * would block, on a non-blocking descriptor, waits for the socket to become writable and
+     * resumes from the first unsent byte.
+     * @param s Socket.
+     * @param bodies Frame bodies.
+     * @return Amount of bytes sent, prefixes included, or IO error.
+     */
+    template <VectoredSender Sock>
+    std::expected<size_t, IoError> send(Sock &s, std::span<const std::string_view> bodies) {
+      __headers.resize(std::max(__headers.size(), bodies.size()));
+      __parts.clear();
+      for (size_t i = 0; i < bodies.size(); i += 1) {
+        auto hdr = header(bodies[i].size(), __headers[i]);
+        if (!hdr) return std::unexpected{hdr.error()};
+        __parts.emplace_back(*hdr);
+        if (!bodies[i].empty()) __parts.emplace_back(bodies[i]);
+      }
+      size_t total = 0;
+      size_t idx = 0;
+      while (idx < __parts.size()) {
+        auto res = s.send_vec(std::span<const std::string_view>{__parts}.subspan(idx), false);
+        if (!res) {
+          if (res.error().err_code() == EINTR) continue;
+          if (!res.error().is_would_block()) return std::unexpected{res.error()};
+          pollfd conf{static_cast<int>(s.native_handle()), POLLOUT, 0};
+          auto wait_res = sys_call(::poll, &conf, 1, -1);
+          if (!wait_res && wait_res.error().err_code() != EINTR) {
+            return std::unexpected{wait_res.error()};
+          }
+          continue;
+        }
+        size_t sent = *res;
+        total += sent;
+        while (idx < __parts.size() && sent >= __parts[idx].size()) {
+          sent -= __parts[idx].size();
+          idx += 1;
+        }
+        if (sent != 0) __parts[idx].remove_prefix(sent);
+      }
+      return total;
+    }
+    template <VectoredSender Sock>
+    std::expected<size_t, IoError> send(Sock &s, std::string_view body) {
+      return send(s, std::span<const std::string_view>{&body, 1});
+    }
+  };
+
   export struct CsvNextable {
   private:
     char __sep;
@@ -143,7 +467,10 @@ namespace jowi::io {
       if (__s) {
         auto res = __s->n.next();
         if (res) {
-          __s.emplace(std::move(__s->n), std::move(res.value()));
+          __s->v = std::move(res).value();
+        } else {
+          // compares equal to end() from now on.
+          __s.reset();
         }
       }
     }
@@ -207,4 +534,132 @@ namespace jowi::io {
         BufNextable{std::move(b), f}, LineNextable{sep}
       } {}
   };
+
+  /*
+   * Async
+   */
+  /**
+   * @brief Nextable driven by polling. `poll_next()` is nullopt while the source would block,
+   * otherwise it holds what `next()` of a synchronous nextable returns.
+   */
+  export template <class T>
+  concept AsyncNextable = requires(T it) {
+    { std::declval<typename T::value_type>() };
+    { it.poll_next() } -> std::same_as<std::optional<std::optional<typename T::value_type>>>;
+  };
+
+  /**
+   * @brief Completes with the next value of an async nextable, nullopt once it ended.
+   */
+  export template <class N> struct AsyncNextPoller {
+    N &n;
+
+    using ValueType = std::optional<typename N::value_type>;
+
+    std::optional<ValueType> poll() {
+      return n.poll_next();
+    }
+  };
+
+  /**
+   * @brief `BufNextable` over a non-blocking descriptor (`TcpSocket`, `ReaderPipe`, ...). Every
+   * poll makes one `read`, a would-block read leaves the nextable pending.
+   */
+  export template <RwBuffer buf_type, IsOsFile FileType> struct AsyncBufNextable {
+  private:
+    buf_type __b;
+    const FileType &__f;
+
+  public:
+    using value_type = std::expected<std::string_view, IoError>;
+    AsyncBufNextable(buf_type b, const FileType &f) : __b{std::move(b)}, __f{f} {}
+
+    std::optional<std::optional<value_type>> poll_next() {
+      size_t len = __b.writable_size();
+      auto res =
+        sys_io_poll_call(IoOp::READ, __f.native_handle(), len, ::read, __b.write_beg(), len);
+      if (!res) return std::nullopt;
+      if (!*res) return std::optional<value_type>{std::unexpected{res->error()}};
+      if (**res == 0) return std::optional<value_type>{std::nullopt};
+      __b.mark_write(static_cast<size_t>(**res));
+      std::string_view v{
+        static_cast<const char *>(__b.read_beg()), static_cast<const char *>(__b.read_end())
+      };
+      __b.mark_read(__b.readable_size());
+      return std::optional<value_type>{v};
+    }
+    asio::InfiniteAwaiter<AsyncNextPoller<AsyncBufNextable>> anext() noexcept {
+      return {*this};
+    }
+  };
+
+  /**
+   * @brief `NextableChain` over an async nextable, the same parsing stages (`LineNextable`,
+   * `FrameNextable`, ...) run on each chunk once it arrived.
+   */
+  export template <AsyncNextable N, ChainNextable<typename N::value_type> C>
+  struct AsyncNextableChain {
+  private:
+    N __n;
+    C __c;
+    std::optional<typename N::value_type> __v;
+    // the stage consumed __v, a new chunk has to arrive before it runs again.
+    bool __fetch;
+
+  public:
+    using value_type = typename C::value_type;
+    AsyncNextableChain(N n, C c) :
+      __n{std::move(n)}, __c{std::move(c)}, __v{std::nullopt}, __fetch{true} {}
+
+    std::optional<std::optional<value_type>> poll_next() {
+      using ResultType = std::optional<std::optional<value_type>>;
+      while (true) {
+        if (__fetch) {
+          auto res = __n.poll_next();
+          if (!res) return std::nullopt;
+          __v = std::move(res).value();
+          __fetch = false;
+        }
+        auto res = __c.next(__v).visit(
+          [](value_type v) -> ResultType { return std::optional<value_type>{std::move(v)}; },
+          [&](NextAction n) -> ResultType {
+            if (n == NextAction::next_end) return std::optional<value_type>{std::nullopt};
+            __fetch = true;
+            return std::nullopt;
+          }
+        );
+        if (res) return res;
+      }
+    }
+    asio::InfiniteAwaiter<AsyncNextPoller<AsyncNextableChain>> anext() noexcept {
+      return {*this};
+    }
+  };
+
+  export template <AsyncNextable N, ChainNextable<typename N::value_type> C>
+  AsyncNextableChain<N, C> operator|(N l, C r) {
+    return AsyncNextableChain{std::move(l), std::move(r)};
+  }
+
+  /**
+   * @brief Lines of a non-blocking descriptor, `co_await lines.anext()` until it yields nullopt.
+   */
+  export template <RwBuffer buf, IsOsFile file>
+  struct AsyncLineNextable : AsyncNextableChain<AsyncBufNextable<buf, file>, LineNextable> {
+    AsyncLineNextable(buf b, const file &f, char sep = '\n') :
+      AsyncNextableChain<AsyncBufNextable<buf, file>, LineNextable>{
+        AsyncBufNextable<buf, file>{std::move(b), f}, LineNextable{sep}
+      } {}
+  };
+
+  /**
+   * @brief Length prefixed frames of a non-blocking descriptor.
+   */
+  export template <RwBuffer buf, IsOsFile file>
+  struct AsyncFrameNextable : AsyncNextableChain<AsyncBufNextable<buf, file>, FrameNextable> {
+    AsyncFrameNextable(buf b, const file &f, FrameOptions opts = FrameOptions{}) :
+      AsyncNextableChain<AsyncBufNextable<buf, file>, FrameNextable>{
+        AsyncBufNextable<buf, file>{std::move(b), f}, FrameNextable{opts}
+      } {}
+  };
 }
@@ -0,0 +1,210 @@
+module;
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+export module jowi.io:trace;
+import :metrics;
+
+/**
+ * @file trace.cc
+ * @brief Per thread ring of fixed size IO events, enabled at runtime with `trace_enable()`. While
+ * disabled an IO call costs one relaxed load of the flag. Events are recorded by `sys_io_call` and
+ * `sys_io_poll_call`, so poller wake ups show as would-block events (result `-EAGAIN`) followed by
+ * the completing call.
+ *
+ * A ring has a single writer, its thread. Collecting copies the slots and then drops those the
+ * writer may have overwritten during the copy, so neither side takes a lock on the IO path.
+ */
+namespace jowi::io {
+  /**
+   * @brief One IO call. result is the syscall return value, or minus errno on failure.
+   */
+  export struct TraceEvent {
+    uint64_t ts_ns;
+    uint32_t dur_ns;
+    int32_t fd;
+    int64_t result;
+    uint32_t requested;
+    IoOp op;
+  };
+
+  /**
+   * @brief Events per thread, the oldest are overwritten once a ring is full. A full ring yields
+   * one less, the oldest slot may be in the middle of being overwritten.
+   */
+  export inline constexpr size_t trace_ring_capacity = 1 << 14;
+
+  export struct TraceThread {
+    int tid;
+    // oldest first.
+    std::vector<TraceEvent> events;
+  };
+
+  struct TraceRing {
+    int tid;
+    std::unique_ptr<TraceEvent[]> slots;
+    // events ever written, slot of event i is i % trace_ring_capacity.
+    std::atomic<uint64_t> head;
+    // events before this one were cleared.
+    std::atomic<uint64_t> tail;
+
+    TraceRing(int tid) :
+      tid{tid}, slots{std::make_unique<TraceEvent[]>(trace_ring_capacity)}, head{0}, tail{0} {}
+
+    /*
+     * seqlock style writer. The fence keeps the slot write from moving above the publication of
+     * the previous head, so a reader that copied a half written slot sees head advanced past it.
+     */
+    void push(const TraceEvent &e) noexcept {
+      uint64_t h = head.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slots[h % trace_ring_capacity] = e;
+      head.store(h + 1, std::memory_order_release);
+    }
+
+    std::vector<TraceEvent> copy() const {
+      uint64_t h = head.load(std::memory_order_acquire);
+      uint64_t oldest = h > trace_ring_capacity ? h - trace_ring_capacity : 0;
+      uint64_t beg = std::max(tail.load(std::memory_order_relaxed), oldest);
+      std::vector<TraceEvent> events;
+      events.reserve(h - beg);
+      for (uint64_t i = beg; i < h; i += 1) {
+        events.push_back(slots[i % trace_ring_capacity]);
+      }
+      // the writer overwrites event i - capacity while it writes event i.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint64_t after = head.load(std::memory_order_relaxed);
+      if (after + 1 > beg + trace_ring_capacity) {
+        uint64_t torn = std::min(after + 1 - trace_ring_capacity, h) - beg;
+        events.erase(events.begin(), events.begin() + static_cast<ptrdiff_t>(torn));
+      }
+      return events;
+    }
+  };
+
+  struct TraceRegistry {
+    std::atomic<bool> enabled{false};
+    std::mutex m;
+    std::vector<std::shared_ptr<TraceRing>> rings;
+
+    static TraceRegistry &get() {
+      static TraceRegistry registry;
+      return registry;
+    }
+    std::shared_ptr<TraceRing> attach() {
+      auto ring = std::make_shared<TraceRing>(static_cast<int>(::gettid()));
+      std::lock_guard l{m};
+      rings.push_back(ring);
+      return ring;
+    }
+  };
+
+  /**
+   * @brief Starts or stops recording for every thread.
+   */
+  export void trace_enable(bool on = true) noexcept {
+    TraceRegistry::get().enabled.store(on, std::memory_order_relaxed);
+  }
+  export bool trace_enabled() noexcept {
+    return TraceRegistry::get().enabled.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * records one call, the ring of the thread is allocated by its first traced call.
+   */
+  void trace_record(
+    IoOp op, int fd, int64_t res, int err_no, size_t requested, uint64_t beg_ns, uint64_t dur_ns
+  ) noexcept {
+    if (!trace_enabled()) return;
+    thread_local std::shared_ptr<TraceRing> ring = TraceRegistry::get().attach();
+    ring->push(TraceEvent{
+      beg_ns,
+      static_cast<uint32_t>(std::min<uint64_t>(dur_ns, UINT32_MAX)),
+      fd,
+      res == -1 ? -static_cast<int64_t>(err_no) : res,
+      static_cast<uint32_t>(std::min<size_t>(requested, UINT32_MAX)),
+      op
+    });
+  }
+
+  /**
+   * @brief Copies the events of every thread that traced, threads that exited included.
+   */
+  export std::vector<TraceThread> trace_collect() {
+    auto &registry = TraceRegistry::get();
+    std::lock_guard l{registry.m};
+    std::vector<TraceThread> threads;
+    for (const auto &ring : registry.rings) {
+      threads.emplace_back(TraceThread{ring->tid, ring->copy()});
+    }
+    return threads;
+  }
+
+  /**
+   * @brief Forgets the events recorded so far, rings keep their memory.
+   */
+  export void trace_clear() noexcept {
+    auto &registry = TraceRegistry::get();
+    std::lock_guard l{registry.m};
+    for (const auto &ring : registry.rings) {
+      ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+  }
+
+  const char *trace_op_name(IoOp op) noexcept {
+    switch (op) {
+      case IoOp::READ:
+        return "read";
+      case IoOp::WRITE:
+        return "write";
+      case IoOp::SEND:
+        return "send";
+      case IoOp::RECV:
+        return "recv";
+      case IoOp::ACCEPT:
+        return "accept";
+      case IoOp::CONNECT:
+        return "connect";
+      case IoOp::SYNC:
+        return "sync";
+    }
+    return "io";
+  }
+
+  /**
+   * @brief Chrome trace event JSON (chrome://tracing, Perfetto) of the collected threads, one
+   * complete ("X") event per call with the descriptor, requested size and result as arguments.
+   */
+  export std::string trace_chrome_json(const std::vector<TraceThread> &threads) {
+    std::string out = R"({"displayTimeUnit":"ns","traceEvents":[)";
+    int pid = static_cast<int>(::getpid());
+    bool first = true;
+    for (const auto &t : threads) {
+      for (const auto &e : t.events) {
+        out += std::format(
+          R"({}{{"name":"{}","cat":"io","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":{},"tid":{},)"
+          R"("args":{{"fd":{},"requested":{},"result":{}}}}})",
+          first ? "" : ",",
+          trace_op_name(e.op),
+          static_cast<double>(e.ts_ns) / 1e3,
+          static_cast<double>(e.dur_ns) / 1e3,
+          pid,
+          t.tid,
+          e.fd,
+          e.requested,
+          e.result
+        );
+        first = false;
+      }
+    }
+    out += "]}";
+    return out;
+  }
+}
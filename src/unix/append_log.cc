@@ -0,0 +1,426 @@
+module;
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+export module jowi.io:append_log;
+import jowi.asio;
+import :error;
+import :fd_type;
+import :local_file;
+import :sys_call;
+
+/**
+ * @file unix/append_log.cc
+ * @brief Append only log with group commit, many producers share one write and one fdatasync.
+ */
+
+namespace jowi::io {
+  namespace fs = std::filesystem;
+
+  /*
+   * every committed group is written behind a header, so that the end of the log can be found
+   * again inside a zero filled preallocation. Host byte order.
+   */
+  struct LogGroupHeader {
+    uint32_t magic;
+    uint32_t crc;
+    uint64_t length;
+  };
+  static_assert(sizeof(LogGroupHeader) == 16);
+  constexpr uint32_t log_group_magic = 0x474f4c4a;
+
+  constexpr std::array<uint32_t, 256> crc32c_table = []() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i += 1) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k += 1) {
+        c = (c & 1) != 0 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+
+  /*
+   * CRC-32C, chained over several views by passing the previous result as crc.
+   */
+  uint32_t crc32c(uint32_t crc, std::string_view v) noexcept {
+    crc = ~crc;
+    for (unsigned char ch : v) {
+      crc = crc32c_table[(crc ^ ch) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  /**
+   * @brief Fluent interface for configuring an `AppendLog`.
+   */
+  export struct AppendLogOptions {
+  private:
+    size_t __preallocate;
+
+  public:
+    /**
+     * @brief Initializes with 64 MiB preallocation steps.
+     */
+    AppendLogOptions() noexcept : __preallocate{64 << 20} {}
+
+    /**
+     * @brief Extends the file with zeros in steps of this size ahead of the write offset. Appends
+     * then overwrite blocks that are already allocated and written, so neither the size nor the
+     * extents change and `fdatasync` only flushes data. 0 disables preallocation, every commit
+     * then grows the file.
+     * @return Reference to these options for chaining.
+     */
+    AppendLogOptions &preallocate(size_t bytes) noexcept {
+      __preallocate = bytes;
+      return *this;
+    }
+
+    size_t preallocate() const noexcept {
+      return __preallocate;
+    }
+  };
+
+  export struct AppendLog;
+
+  /**
+   * @brief Completes once the record with the log sequence number is durable.
+   */
+  export struct AppendLogPoller {
+    const AppendLog &log;
+    uint64_t lsn;
+
+    using ValueType = std::expected<uint64_t, IoError>;
+
+    std::optional<ValueType> poll() const noexcept;
+  };
+
+  /**
+   * @brief Append only log writer. Producers on any thread submit records and a flusher thread
+   * writes everything submitted since its last round with one `pwritev` followed by one
+   * `fdatasync`, so a single sync covers every record of the group. Records are numbered by a log
+   * sequence number (LSN) starting at 1, framing them is up to the caller.
+   *
+   * Each group is written behind a 16 byte header holding its length and CRC-32C, into a zero
+   * filled preallocation (see `AppendLogOptions::preallocate`). The file size is not where the
+   * log ends: opening a log scans the groups from the start and appends after the last intact one,
+   * so a group torn by a crash is dropped and overwritten. `replay` reads the records back. The
+   * unused preallocation is released when the log is destroyed. Once a write fails the log stays
+   * failed and every pending and later record resolves to that error.
+   * Completions are also signalled on an eventfd (`native_handle()`) for reactors driving
+   * `asubmit` awaiters.
+   */
+  export struct AppendLog {
+  private:
+    using ResultType = std::expected<uint64_t, IoError>;
+    struct Record {
+      std::string data;
+      uint64_t lsn;
+      std::optional<std::promise<ResultType>> promise;
+    };
+
+    LocalFile __file;
+    AppendLogOptions __opts;
+    FileDescriptor __notify_fd;
+    std::mutex __mtx;
+    std::condition_variable __cv;
+    std::vector<Record> __pending;
+    uint64_t __next_lsn;
+    bool __stopping;
+    // owned by the flusher thread.
+    size_t __offset;
+    size_t __allocated;
+    std::atomic<uint64_t> __durable_lsn;
+    std::atomic<bool> __failed;
+    // written once by the flusher before __failed is set.
+    std::optional<IoError> __error;
+    std::thread __flusher;
+
+    AppendLog(
+      LocalFile file, AppendLogOptions opts, FileDescriptor notify_fd, size_t end, size_t size
+    ) :
+      __file{std::move(file)}, __opts{opts}, __notify_fd{std::move(notify_fd)}, __mtx{}, __cv{},
+      __pending{}, __next_lsn{1}, __stopping{false}, __offset{end}, __allocated{size},
+      __durable_lsn{0}, __failed{false}, __error{std::nullopt}, __flusher{} {}
+
+    /*
+     * pread until len bytes are read, false when the file ends first.
+     */
+    static std::expected<bool, IoError> __read_at(
+      const LocalFile &file, void *dst, size_t len, size_t off
+    ) noexcept {
+      char *p = static_cast<char *>(dst);
+      while (len != 0) {
+        auto res = sys_call(::pread, file.native_handle(), p, len, static_cast<off_t>(off));
+        if (!res) {
+          if (res.error().err_code() == EINTR) continue;
+          return std::unexpected{res.error()};
+        }
+        if (*res == 0) return false;
+        p += *res;
+        off += static_cast<size_t>(*res);
+        len -= static_cast<size_t>(*res);
+      }
+      return true;
+    }
+
+    /*
+     * walks the groups from the start of the file, returns where the last intact one ends.
+     */
+    template <class F>
+    static std::expected<size_t, IoError> __scan(
+      const LocalFile &file, size_t size, F &&on_group
+    ) noexcept {
+      size_t off = 0;
+      std::string data;
+      while (off < size) {
+        LogGroupHeader header{0, 0, 0};
+        size_t len = std::min(sizeof(header), size - off);
+        auto got = __read_at(file, &header, len, off);
+        if (!got) return std::unexpected{got.error()};
+        if (!*got) break;
+        if (header.magic != log_group_magic || len < sizeof(header)) {
+          // zeros are the unused preallocation, anything else is not a log written by us.
+          if (off == 0 && header.magic != 0) {
+            return std::unexpected{IoError{EINVAL, "not an append log"}};
+          }
+          break;
+        }
+        if (header.length > size - off - sizeof(header)) break;
+        data.resize(header.length);
+        got = __read_at(file, data.data(), data.size(), off + sizeof(header));
+        if (!got) return std::unexpected{got.error()};
+        if (!*got || crc32c(0, data) != header.crc) break;
+        on_group(std::string_view{data});
+        off += sizeof(header) + data.size();
+      }
+      return off;
+    }
+
+    std::expected<void, IoError> __reserve(size_t bytes) noexcept {
+      if (__opts.preallocate() == 0 || __offset + bytes <= __allocated) return {};
+      size_t target = std::max(__offset + bytes, __allocated + __opts.preallocate());
+      // written zeros rather than fallocate: unwritten extents would still be converted, and
+      // their metadata journaled, by the first write landing in them.
+      std::string zeros(std::min<size_t>(target - __allocated, 1 << 20), '\0');
+      while (__allocated < target) {
+        size_t len = std::min(zeros.size(), target - __allocated);
+        auto res = sys_call(
+          ::pwrite, __file.native_handle(), zeros.data(), len, static_cast<off_t>(__allocated)
+        );
+        if (!res) {
+          if (res.error().err_code() == EINTR) continue;
+          return std::unexpected{res.error()};
+        }
+        __allocated += static_cast<size_t>(*res);
+      }
+      return {};
+    }
+
+    std::expected<void, IoError> __write_batch(std::vector<Record> &batch) noexcept {
+      LogGroupHeader header{log_group_magic, 0, 0};
+      std::vector<iovec> iov;
+      iov.reserve(batch.size() + 1);
+      iov.emplace_back(iovec{&header, sizeof(header)});
+      for (auto &r : batch) {
+        if (r.data.empty()) continue;
+        iov.emplace_back(iovec{r.data.data(), r.data.size()});
+        header.crc = crc32c(header.crc, r.data);
+        header.length += r.data.size();
+      }
+      if (header.length == 0) return {};
+      size_t bytes = sizeof(header) + header.length;
+      return __reserve(bytes).and_then([&]() -> std::expected<void, IoError> {
+        size_t idx = 0;
+        while (idx < iov.size()) {
+          int count = static_cast<int>(std::min<size_t>(iov.size() - idx, IOV_MAX));
+          auto res = sys_call(
+            ::pwritev, __file.native_handle(), &iov[idx], count, static_cast<off_t>(__offset)
+          );
+          if (!res) {
+            if (res.error().err_code() == EINTR) continue;
+            return std::unexpected{res.error()};
+          }
+          size_t written = static_cast<size_t>(*res);
+          __offset += written;
+          while (idx < iov.size() && written >= iov[idx].iov_len) {
+            written -= iov[idx].iov_len;
+            idx += 1;
+          }
+          if (written != 0) {
+            iov[idx].iov_base = static_cast<char *>(iov[idx].iov_base) + written;
+            iov[idx].iov_len -= written;
+          }
+        }
+        return __file.sync_data();
+      });
+    }
+
+    void __flush_loop() noexcept {
+      std::vector<Record> batch;
+      while (true) {
+        {
+          std::unique_lock lck{__mtx};
+          __cv.wait(lck, [&]() { return __stopping || !__pending.empty(); });
+          if (__pending.empty()) return;
+          batch.swap(__pending);
+        }
+        std::expected<void, IoError> res = __failed.load(std::memory_order_acquire)
+          ? std::expected<void, IoError>{std::unexpected{*__error}}
+          : __write_batch(batch);
+        if (res) {
+          __durable_lsn.store(batch.back().lsn, std::memory_order_release);
+        } else if (!__failed.load(std::memory_order_relaxed)) {
+          __error.emplace(res.error());
+          __failed.store(true, std::memory_order_release);
+        }
+        for (auto &r : batch) {
+          if (!r.promise) continue;
+          if (res) r.promise->set_value(r.lsn);
+          else
+            r.promise->set_value(std::unexpected{res.error()});
+        }
+        batch.clear();
+        (void)sys_eventfd_write(__notify_fd, 1);
+      }
+    }
+
+    uint64_t __push(std::string record, std::optional<std::promise<ResultType>> promise) noexcept {
+      uint64_t lsn;
+      {
+        std::lock_guard lck{__mtx};
+        lsn = __next_lsn++;
+        __pending.emplace_back(Record{std::move(record), lsn, std::move(promise)});
+      }
+      __cv.notify_one();
+      return lsn;
+    }
+
+  public:
+    AppendLog(const AppendLog &) = delete;
+    AppendLog &operator=(const AppendLog &) = delete;
+    ~AppendLog() noexcept {
+      {
+        std::lock_guard lck{__mtx};
+        __stopping = true;
+      }
+      __cv.notify_all();
+      __flusher.join();
+      // gives back the preallocation past the last group.
+      if (__allocated > __offset) (void)__file.truncate(static_cast<off_t>(__offset));
+    }
+
+    /**
+     * @brief Opens or creates the log, new records are appended after the last intact group.
+     * @param p Path of the log file.
+     * @param opts Log options.
+     * @return Heap allocated log, its address is shared with the flusher thread, or IO error.
+     * Fails with `EINVAL` when the file is not empty and does not start with a group.
+     */
+    static std::expected<std::unique_ptr<AppendLog>, IoError> open(
+      const fs::path &p, AppendLogOptions opts = AppendLogOptions{}
+    ) noexcept {
+      return OpenOptions{}.read_write().create().open(p).and_then([&](LocalFile file) {
+        return file.seek_end(0).and_then([&](off_t size) {
+          return __scan(file, static_cast<size_t>(size), [](std::string_view) {})
+            .and_then([&](size_t end) {
+              return sys_eventfd().transform([&](FileDescriptor notify_fd) {
+                auto log = std::unique_ptr<AppendLog>{new AppendLog{
+                  std::move(file), opts, std::move(notify_fd), end, static_cast<size_t>(size)
+                }};
+                log->__flusher = std::thread{[l = log.get()]() { l->__flush_loop(); }};
+                return log;
+              });
+            });
+        });
+      });
+    }
+
+    /**
+     * @brief Reads a log back without opening it for writing.
+     * @param p Path of the log file.
+     * @param on_group Called with the records of every intact group in commit order, the records
+     * of a group concatenated.
+     * @return Bytes of the file holding intact groups, or IO error.
+     */
+    template <class F> requires(std::invocable<F, std::string_view>)
+    static std::expected<size_t, IoError> replay(const fs::path &p, F &&on_group) noexcept {
+      return OpenOptions{}.read().open(p).and_then([&](LocalFile file) {
+        return file.seek_end(0).and_then([&](off_t size) {
+          return __scan(file, static_cast<size_t>(size), on_group);
+        });
+      });
+    }
+
+    /**
+     * @brief Submits a record from any thread.
+     * @param record Bytes appended to the log.
+     * @return Future resolving to the LSN of the record once it is durable, or IO error.
+     */
+    std::future<ResultType> submit(std::string record) noexcept {
+      std::promise<ResultType> promise;
+      auto fut = promise.get_future();
+      __push(std::move(record), std::move(promise));
+      return fut;
+    }
+    /**
+     * @brief Submits a record, the write starts right away.
+     * @param record Bytes appended to the log.
+     * @return Awaiter resolving to the LSN of the record once it is durable, or IO error.
+     */
+    asio::InfiniteAwaiter<AppendLogPoller> asubmit(std::string record) noexcept {
+      return {*this, __push(std::move(record), std::nullopt)};
+    }
+
+    /**
+     * @brief Every record up to and including this LSN is durable.
+     */
+    uint64_t durable_lsn() const noexcept {
+      return __durable_lsn.load(std::memory_order_acquire);
+    }
+    /**
+     * @brief Error that failed the log, if any.
+     */
+    std::optional<IoError> error() const noexcept {
+      if (!__failed.load(std::memory_order_acquire)) return std::nullopt;
+      return __error;
+    }
+    /**
+     * @brief Eventfd readable whenever a group has been committed since the last `on_notify()`.
+     */
+    int native_handle() const noexcept {
+      return __notify_fd.get_or(-1);
+    }
+    /**
+     * @brief Consumes the commit notifications.
+     * @return Amount of groups committed since the last call or IO error.
+     */
+    std::expected<uint64_t, IoError> on_notify() noexcept {
+      return sys_eventfd_read(__notify_fd);
+    }
+  };
+
+  std::optional<AppendLogPoller::ValueType> AppendLogPoller::poll() const noexcept {
+    if (log.durable_lsn() >= lsn) return lsn;
+    if (auto err = log.error()) return std::unexpected{*err};
+    return std::nullopt;
+  }
+}
@@ -0,0 +1,367 @@
+module;
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+export module jowi.io:directory;
+import :error;
+import :fd_type;
+import :file;
+import :sys_call;
+
+/**
+ * @file unix/directory.cc
+ * @brief Batched directory reading with getdents64 and a parallel work stealing walker.
+ */
+
+namespace jowi::io {
+  namespace fs = std::filesystem;
+
+  /**
+   * @brief Type of a directory entry. `UNKNOWN` when the filesystem does not fill `d_type`, see
+   * `Directory::entry_type`.
+   */
+  export enum struct EntryType { UNKNOWN, FILE, DIRECTORY, SYMLINK, BLOCK, CHAR, FIFO, SOCKET };
+
+  /**
+   * @brief Directory entry. The name is null terminated and points into the buffer of the
+   * `DirNextable` that produced it, it is valid until the next call to `next()`.
+   */
+  export struct DirEntry {
+    std::string_view name;
+    uint64_t inode;
+    EntryType type;
+  };
+
+  EntryType entry_type_from_dtype(unsigned char d_type) noexcept {
+    switch (d_type) {
+      case DT_REG:
+        return EntryType::FILE;
+      case DT_DIR:
+        return EntryType::DIRECTORY;
+      case DT_LNK:
+        return EntryType::SYMLINK;
+      case DT_BLK:
+        return EntryType::BLOCK;
+      case DT_CHR:
+        return EntryType::CHAR;
+      case DT_FIFO:
+        return EntryType::FIFO;
+      case DT_SOCK:
+        return EntryType::SOCKET;
+      default:
+        return EntryType::UNKNOWN;
+    }
+  }
+
+  EntryType entry_type_from_mode(mode_t mode) noexcept {
+    switch (mode & S_IFMT) {
+      case S_IFREG:
+        return EntryType::FILE;
+      case S_IFDIR:
+        return EntryType::DIRECTORY;
+      case S_IFLNK:
+        return EntryType::SYMLINK;
+      case S_IFBLK:
+        return EntryType::BLOCK;
+      case S_IFCHR:
+        return EntryType::CHAR;
+      case S_IFIFO:
+        return EntryType::FIFO;
+      case S_IFSOCK:
+        return EntryType::SOCKET;
+      default:
+        return EntryType::UNKNOWN;
+    }
+  }
+
+  /**
+   * @brief Open directory descriptor.
+   */
+  export struct Directory {
+  private:
+    FileDescriptor __f;
+    Directory(FileDescriptor f) noexcept : __f{std::move(f)} {}
+    static Directory from(FileDescriptor f) noexcept {
+      return Directory{std::move(f)};
+    }
+
+  public:
+    /**
+     * @brief Opens a directory.
+     * @param p Path of the directory.
+     * @return Directory or IO error.
+     */
+    static std::expected<Directory, IoError> open(const fs::path &p) noexcept {
+      return sys_call(::open, p.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+        .transform(FileDescriptor::manage_default)
+        .transform(Directory::from);
+    }
+    /**
+     * @brief Opens a subdirectory relative to this one (`openat`), without following symlinks.
+     * @param name Null terminated name of the subdirectory.
+     * @return Directory or IO error.
+     */
+    std::expected<Directory, IoError> open_at(const char *name) const noexcept {
+      int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+      return sys_call(::openat, __f.get_or(-1), name, flags)
+        .transform(FileDescriptor::manage_default)
+        .transform(Directory::from);
+    }
+    std::expected<Directory, IoError> open_at(const DirEntry &e) const noexcept {
+      return open_at(e.name.data());
+    }
+    /**
+     * @brief Type of an entry of this directory, with a `fstatat` only when the filesystem did not
+     * report it.
+     * @param e Entry read from this directory.
+     * @return Entry type or IO error.
+     */
+    std::expected<EntryType, IoError> entry_type(const DirEntry &e) const noexcept {
+      if (e.type != EntryType::UNKNOWN) return e.type;
+      return sys_stat_at(__f, e.name.data()).transform(entry_type_from_mode);
+    }
+    /**
+     * @brief Moves back to the first entry.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> rewind() noexcept {
+      return sys_seek(__f, SeekMode::START, 0).transform([](off_t) {});
+    }
+    const FileDescriptor &handle() const noexcept {
+      return __f;
+    }
+    auto native_handle() const noexcept {
+      return __f.get_or(-1);
+    }
+  };
+
+  /**
+   * @brief Nextable over the entries of a directory, reading as many entries as fit its buffer
+   * per `getdents64` call. `.` and `..` are skipped.
+   */
+  export struct DirNextable {
+  private:
+    const Directory *__dir;
+    std::vector<char> __buf;
+    size_t __pos;
+    size_t __end;
+    bool __eof;
+
+  public:
+    using value_type = std::expected<DirEntry, IoError>;
+
+    DirNextable(const Directory &dir, size_t buffer_size = 256 * 1024) :
+      __dir{&dir}, __buf(buffer_size), __pos{0}, __end{0}, __eof{false} {}
+
+    /**
+     * @brief Continues with another directory, keeping the buffer.
+     */
+    void reset(const Directory &dir) noexcept {
+      __dir = &dir;
+      __pos = 0;
+      __end = 0;
+      __eof = false;
+    }
+
+    std::optional<value_type> next() {
+      while (true) {
+        if (__pos >= __end) {
+          if (__eof) return std::nullopt;
+          auto res = sys_getdents(__dir->handle(), __buf.data(), __buf.size());
+          if (!res) {
+            __eof = true;
+            return std::unexpected{res.error()};
+          }
+          if (*res == 0) {
+            __eof = true;
+            return std::nullopt;
+          }
+          __pos = 0;
+          __end = *res;
+        }
+        auto *d = reinterpret_cast<const dirent64 *>(__buf.data() + __pos);
+        __pos += d->d_reclen;
+        std::string_view name{d->d_name};
+        if (name == "." || name == "..") continue;
+        return DirEntry{name, d->d_ino, entry_type_from_dtype(d->d_type)};
+      }
+    }
+  };
+
+  /**
+   * @brief Totals of a `walk_parallel`.
+   */
+  export struct WalkStats {
+    size_t directories;
+    size_t entries;
+    // subdirectories that could not be opened or read (e.g. EACCES), they are skipped.
+    size_t errors;
+  };
+
+  /*
+   * subdirectory waiting to be read. It is opened once a worker takes it, so queued work holds no
+   * descriptor of its own, only its parent stays open until the last queued child is opened.
+   */
+  struct WalkItem {
+    std::shared_ptr<const Directory> parent;
+    std::string name;
+  };
+
+  struct WalkQueue {
+    std::mutex mtx;
+    std::deque<WalkItem> items;
+  };
+
+  /**
+   * @brief Walks a tree on several threads. Every worker keeps its own queue of subdirectories to
+   * read, taking from its back (depth first) and stealing from the front of the other queues when
+   * it runs dry, idle workers sleep until something is queued. A queued subdirectory is its name
+   * next to its parent and is opened with `openat` only when taken, so open descriptors are
+   * bounded by the directories being read and the parents of queued ones, not by the fan-out.
+   * Symlinks are not followed.
+   * @param root Root of the tree, it is not passed to the visitor.
+   * @param thread_count Amount of workers, 0 uses the hardware concurrency.
+   * @param visit Invoked concurrently with the parent directory and every entry below root, whose
+   * type is already resolved.
+   * @return Totals or the IO error opening root.
+   */
+  export template <class Visitor>
+    requires(std::invocable<Visitor &, const Directory &, const DirEntry &>)
+  std::expected<WalkStats, IoError> walk_parallel(
+    const fs::path &root, size_t thread_count, Visitor &&visit
+  ) {
+    auto root_dir = Directory::open(root);
+    if (!root_dir) return std::unexpected{root_dir.error()};
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<WalkQueue> queues(thread_count);
+    // directories queued or being read, the walk is done once it drops to 0.
+    std::atomic<size_t> pending{1};
+    // directories sitting in a queue, idle workers wait for it to become non zero.
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleepers{0};
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    std::atomic<size_t> directories{0};
+    std::atomic<size_t> entries{0};
+    std::atomic<size_t> errors{0};
+
+    auto take = [&](size_t self) -> std::optional<WalkItem> {
+      std::optional<WalkItem> item;
+      {
+        std::lock_guard lck{queues[self].mtx};
+        if (!queues[self].items.empty()) {
+          item.emplace(std::move(queues[self].items.back()));
+          queues[self].items.pop_back();
+        }
+      }
+      for (size_t i = 1; !item && i < thread_count; i += 1) {
+        auto &victim = queues[(self + i) % thread_count];
+        std::lock_guard lck{victim.mtx};
+        if (!victim.items.empty()) {
+          item.emplace(std::move(victim.items.front()));
+          victim.items.pop_front();
+        }
+      }
+      if (item) queued.fetch_sub(1);
+      return item;
+    };
+    // a waiter registers in sleepers before checking queued, a producer bumps queued before
+    // checking sleepers, so one of them always sees the other.
+    auto wait_for_work = [&]() {
+      std::unique_lock lck{idle_mtx};
+      sleepers.fetch_add(1);
+      idle_cv.wait(lck, [&]() { return queued.load() != 0 || pending.load() == 0; });
+      sleepers.fetch_sub(1);
+    };
+    auto wake = [&](bool all) {
+      if (sleepers.load() == 0) return;
+      std::lock_guard lck{idle_mtx};
+      if (all) idle_cv.notify_all();
+      else
+        idle_cv.notify_one();
+    };
+    auto finish_one = [&]() {
+      if (pending.fetch_sub(1) == 1) wake(true);
+    };
+
+    auto work = [&](size_t self, std::shared_ptr<const Directory> dir) {
+      // one buffer per worker, reused for every directory it reads.
+      std::optional<DirNextable> nextable;
+      size_t local_dirs = 0;
+      size_t local_entries = 0;
+      size_t local_errors = 0;
+      while (true) {
+        if (!dir) {
+          auto item = take(self);
+          if (!item) {
+            if (pending.load() == 0) break;
+            wait_for_work();
+            continue;
+          }
+          auto opened = item->parent->open_at(item->name.c_str());
+          item.reset();
+          if (!opened) {
+            local_errors += 1;
+            finish_one();
+            continue;
+          }
+          dir = std::make_shared<const Directory>(std::move(opened).value());
+        }
+        if (nextable) nextable->reset(*dir);
+        else
+          nextable.emplace(*dir);
+        while (auto res = nextable->next()) {
+          if (!*res) {
+            local_errors += 1;
+            break;
+          }
+          DirEntry e = **res;
+          e.type = dir->entry_type(e).value_or(EntryType::UNKNOWN);
+          local_entries += 1;
+          visit(*dir, e);
+          if (e.type != EntryType::DIRECTORY) continue;
+          pending.fetch_add(1);
+          {
+            std::lock_guard lck{queues[self].mtx};
+            queues[self].items.emplace_back(WalkItem{dir, std::string{e.name}});
+          }
+          queued.fetch_add(1);
+          wake(false);
+        }
+        local_dirs += 1;
+        dir.reset();
+        finish_one();
+      }
+      directories += local_dirs;
+      entries += local_entries;
+      errors += local_errors;
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count - 1);
+    for (size_t i = 1; i < thread_count; i += 1) {
+      workers.emplace_back(work, i, nullptr);
+    }
+    work(0, std::make_shared<const Directory>(std::move(root_dir).value()));
+    for (auto &w : workers) {
+      w.join();
+    }
+    return WalkStats{directories.load(), entries.load(), errors.load()};
+  }
+}
@@ -1,18 +1,27 @@
 module;
 #include <sys/fcntl.h>
+#include <algorithm>
 #include <bitset>
+#include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <expected>
 #include <filesystem>
+#include <optional>
 #include <string_view>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 export module jowi.io:local_file;
 import jowi.asio;
 import :fd_type;
 import :error;
 import :file;
 import :buffer;
+import :offload;
 import :sys_call;
+import :metrics;
+import :timer_wheel;
 
 /**
  * @file unix/LocalFile.cc
@@ -22,6 +31,141 @@ import :sys_call;
 namespace jowi::io {
   namespace fs = std::filesystem;
 
+  /**
+   * @brief Mechanism used by `LocalFile::copy_to`, in the order they are tried.
+   */
+  export enum struct CopyMethod { REFLINK, COPY_FILE_RANGE, SENDFILE, BUFFERED };
+
+  /**
+   * @brief Progress of a `LocalFile::copy_to`.
+   */
+  export struct CopyProgress {
+    size_t copied;
+    size_t total;
+    CopyMethod method;
+  };
+
+  struct CopyNoProgress {
+    void operator()(const CopyProgress &) const noexcept {}
+  };
+
+  /*
+   * copy state machine used by copy_to. Every step copies at most one chunk with the
+   * current method. When a method is not supported for this pair of files, and nothing has been
+   * copied yet, the next one is tried.
+   */
+  struct FileCopyState {
+    const FileDescriptor &src;
+    const FileDescriptor &dst;
+    off_t offset;
+    size_t len;
+    size_t chunk;
+    size_t copied = 0;
+    CopyMethod method = CopyMethod::REFLINK;
+    bool done = false;
+    std::vector<char> buf{};
+
+    static bool unsupported(const IoError &e) noexcept {
+      int err_code = e.err_code();
+      return err_code == EOPNOTSUPP || err_code == ENOTSUP || err_code == EXDEV ||
+        err_code == EINVAL || err_code == ENOSYS || err_code == ENOTTY;
+    }
+
+    CopyProgress progress() const noexcept {
+      return CopyProgress{copied, len, method};
+    }
+
+    std::expected<void, IoError> advance(
+      std::expected<size_t, IoError> res, CopyMethod next
+    ) noexcept {
+      if (!res) {
+        if (copied != 0 || !unsupported(res.error())) return std::unexpected{res.error()};
+        method = next;
+        return {};
+      }
+      copied += *res;
+      done = *res == 0 || copied == len;
+      return {};
+    }
+
+    std::expected<void, IoError> step() noexcept {
+      if (copied == len) {
+        done = true;
+        return {};
+      }
+      off_t src_off = offset + static_cast<off_t>(copied);
+      off_t dst_off = src_off;
+      size_t n = std::min(chunk, len - copied);
+      switch (method) {
+        case CopyMethod::REFLINK:
+          // a clone is all or nothing, it is not chunked.
+          return advance(
+            sys_clone_range(src, src_off, len - copied, dst, dst_off).transform([&]() {
+              return len - copied;
+            }),
+            CopyMethod::COPY_FILE_RANGE
+          );
+        case CopyMethod::COPY_FILE_RANGE:
+          return advance(
+            sys_copy_file_range(src, src_off, dst, dst_off, n), CopyMethod::SENDFILE
+          );
+        case CopyMethod::SENDFILE:
+          return advance(
+            sys_seek(dst, SeekMode::START, dst_off).and_then([&](off_t) {
+              return sys_sendfile(dst, src, src_off, n);
+            }),
+            CopyMethod::BUFFERED
+          );
+        case CopyMethod::BUFFERED:
+          if (buf.size() < n) buf.resize(n);
+          return advance(
+            sys_call(::pread, src.get_or(-1), buf.data(), n, src_off)
+              .and_then([&](ssize_t got) -> std::expected<size_t, IoError> {
+                size_t put = 0;
+                while (put < static_cast<size_t>(got)) {
+                  auto res = sys_call(
+                    ::pwrite,
+                    dst.get_or(-1),
+                    buf.data() + put,
+                    static_cast<size_t>(got) - put,
+                    dst_off + static_cast<off_t>(put)
+                  );
+                  if (!res) return std::unexpected{res.error()};
+                  put += static_cast<size_t>(*res);
+                }
+                return put;
+              }),
+            CopyMethod::BUFFERED
+          );
+      }
+      return {};
+    }
+  };
+
+  export struct LocalFile;
+
+  /**
+   * @brief Writes through `LocalFile::write`, so direct files are checked for alignment.
+   */
+  export struct LocalFileWritePoller {
+    LocalFile &file;
+    std::string_view v;
+
+    using ValueType = std::expected<size_t, IoError>;
+    std::optional<ValueType> poll() noexcept;
+  };
+
+  /**
+   * @brief Reads through `LocalFile::read`, so direct files are checked for alignment.
+   */
+  export template <WritableBuffer buf_type> struct LocalFileReadPoller {
+    LocalFile &file;
+    buf_type &buf;
+
+    using ValueType = std::expected<void, IoError>;
+    std::optional<ValueType> poll() noexcept;
+  };
+
   /**
    * @brief RAII-style local file abstraction built on top of `FileType`.
    */
@@ -29,28 +173,91 @@ namespace jowi::io {
   private:
     FileDescriptor __f;
     bool __eof;
-    LocalFile(FileDescriptor f) noexcept : __f{std::move(f)}, __eof{false} {}
+    // alignment of O_DIRECT transfers, 0 for buffered files.
+    size_t __dio_align;
+    LocalFile(FileDescriptor f, size_t dio_align = 0) noexcept :
+      __f{std::move(f)}, __eof{false}, __dio_align{dio_align} {}
     friend struct OpenOptions;
     static LocalFile from(FileDescriptor f) noexcept {
       return LocalFile{std::move(f)};
     }
 
+    /*
+     * O_DIRECT transfers need the buffer address, the file offset and the length aligned. Reads
+     * round the length down to the alignment, writes have to be aligned by the caller. Fails with
+     * EINVAL before reaching the kernel, buffered files pass through.
+     */
+    std::expected<size_t, IoError> __direct_len(
+      const void *p, size_t len, off_t offset, bool round_down
+    ) const noexcept {
+      if (__dio_align == 0) return len;
+      if (round_down) len -= len % __dio_align;
+      bool aligned = reinterpret_cast<uintptr_t>(p) % __dio_align == 0 &&
+        static_cast<size_t>(offset) % __dio_align == 0 && len % __dio_align == 0;
+      if (!aligned || (round_down && len == 0)) {
+        return std::unexpected{IoError{EINVAL, "misaligned direct io, alignment {}", __dio_align}};
+      }
+      return len;
+    }
+    /*
+     * position direct reads and writes start at, buffered files skip the lseek.
+     */
+    std::expected<off_t, IoError> __direct_pos() const noexcept {
+      if (__dio_align == 0) return 0;
+      return sys_seek(__f, SeekMode::CURRENT, 0);
+    }
+
   public:
+    /**
+     * @brief Takes ownership of an open descriptor, such as one received with `recv_fds`, as a
+     * buffered file.
+     * @param f Descriptor to own.
+     * @return File wrapping the descriptor.
+     */
+    static LocalFile adopt(FileDescriptor f) noexcept {
+      return LocalFile{std::move(f)};
+    }
     /**
      * @brief Writes bytes to the file.
      * @param v Bytes to append or overwrite depending on open mode.
      * @return Number of bytes written or IO error.
      */
     std::expected<size_t, IoError> write(std::string_view v) noexcept {
-      return sys_write(__f, v);
+      return __direct_pos()
+        .and_then([&](off_t pos) { return __direct_len(v.data(), v.length(), pos, false); })
+        .and_then([&](size_t) { return sys_write(__f, v); });
+    }
+    /**
+     * @brief Writes bytes at an offset without moving the file position.
+     * @param v Bytes to write, aligned in address and length for direct files.
+     * @param offset File offset, aligned for direct files.
+     * @return Number of bytes written or IO error.
+     */
+    std::expected<size_t, IoError> write_at(std::string_view v, off_t offset) noexcept {
+      return __direct_len(v.data(), v.length(), offset, false).and_then([&](size_t len) {
+        return sys_io_call(IoOp::WRITE, __f.get_or(-1), len, ::pwrite, v.data(), len, offset)
+          .transform([](ssize_t n) { return static_cast<size_t>(n); });
+      });
     }
-    asio::InfiniteAwaiter<SysWritePoller> awrite(std::string_view v) noexcept {
-      return {__f, v};
+    asio::InfiniteAwaiter<LocalFileWritePoller> awrite(std::string_view v) noexcept {
+      return {*this, v};
     }
-    asio::TimedAwaiter<SysWritePoller> awrite(
+    asio::InfiniteAwaiter<DeadlinePoller<LocalFileWritePoller>> awrite(
       std::string_view v, std::chrono::milliseconds dur
     ) noexcept {
-      return {dur, __f, v};
+      return {dur, *this, v};
+    }
+    /**
+     * @brief Writes on a worker of the pool, for files whose writes block the calling thread. The
+     * file and the bytes have to stay in place until the awaiter completes.
+     * @param pool Pool running the write.
+     * @param v Bytes to write.
+     * @return Awaiter completing with the number of bytes written or IO error.
+     */
+    asio::InfiniteAwaiter<OffloadPoller<std::expected<size_t, IoError>>> awrite(
+      OffloadPool &pool, std::string_view v
+    ) noexcept {
+      return pool.submit([this, v]() { return write(v); });
     }
 
     /**
@@ -59,18 +266,53 @@ namespace jowi::io {
      * @return Success or IO error.
      */
     std::expected<void, IoError> read(WritableBuffer auto &buf) noexcept {
-      return sys_read(__f, buf);
+      if (__dio_align == 0) return sys_read(__f, buf);
+      return __direct_pos()
+        .and_then([&](off_t pos) {
+          return __direct_len(buf.write_beg(), buf.writable_size(), pos, true);
+        })
+        .and_then([&](size_t len) {
+          return sys_io_call(IoOp::READ, __f.get_or(-1), len, ::read, buf.write_beg(), len)
+            .transform(BufferWriteMarker{buf});
+        });
+    }
+    /**
+     * @brief Reads bytes at an offset without moving the file position. Direct files read the
+     * largest aligned amount that fits the buffer.
+     * @param buf Writable buffer populated with file contents.
+     * @param offset File offset, aligned for direct files.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> read_at(WritableBuffer auto &buf, off_t offset) noexcept {
+      return __direct_len(buf.write_beg(), buf.writable_size(), offset, true)
+        .and_then([&](size_t len) {
+          return sys_io_call(IoOp::READ, __f.get_or(-1), len, ::pread, buf.write_beg(), len, offset)
+            .transform(BufferWriteMarker{buf});
+        });
     }
     template <WritableBuffer buf_type>
-    asio::InfiniteAwaiter<SysReadPoller<buf_type>> aread(buf_type &buf) noexcept {
-      return {__f, buf};
+    asio::InfiniteAwaiter<LocalFileReadPoller<buf_type>> aread(buf_type &buf) noexcept {
+      return {*this, buf};
     }
 
     template <WritableBuffer buf_type>
-    asio::TimedAwaiter<SysReadPoller<buf_type>> aread(
+    asio::InfiniteAwaiter<DeadlinePoller<LocalFileReadPoller<buf_type>>> aread(
       buf_type &buf, std::chrono::milliseconds dur
     ) noexcept {
-      return {dur, __f, buf};
+      return {dur, *this, buf};
+    }
+    /**
+     * @brief Reads on a worker of the pool, for files whose reads block the calling thread. The
+     * file and the buffer have to stay in place until the awaiter completes.
+     * @param pool Pool running the read.
+     * @param buf Writable buffer populated with file contents.
+     * @return Awaiter completing with success or IO error.
+     */
+    template <WritableBuffer buf_type>
+    asio::InfiniteAwaiter<OffloadPoller<std::expected<void, IoError>>> aread(
+      OffloadPool &pool, buf_type &buf
+    ) noexcept {
+      return pool.submit([this, &buf]() { return read(buf); });
     }
 
     /**
@@ -139,6 +381,132 @@ namespace jowi::io {
     std::expected<void, IoError> sync() noexcept {
       return sys_sync(__f);
     }
+    /**
+     * @brief Flushes file data, skipping metadata that is not needed to read it back (e.g. mtime).
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> sync_data() noexcept {
+      return sys_sync_data(__f);
+    }
+    /**
+     * @brief Flushes in-memory changes to disk on a worker of the pool. The file has to stay in
+     * place until the awaiter completes.
+     * @param pool Pool running the flush.
+     * @return Awaiter completing with success or IO error.
+     */
+    asio::InfiniteAwaiter<OffloadPoller<std::expected<void, IoError>>> async(
+      OffloadPool &pool
+    ) noexcept {
+      return pool.submit([this]() { return sys_sync(__f); });
+    }
+    /**
+     * @brief Allocates blocks for a range up front so later writes neither fragment the file nor
+     * fail with `ENOSPC`.
+     * @param offset Start of the range.
+     * @param len Length of the range.
+     * @param keep_size When true the file size is left as is (`FALLOC_FL_KEEP_SIZE`).
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> allocate(
+      off_t offset, off_t len, bool keep_size = false
+    ) noexcept {
+      return sys_fallocate(__f, keep_size ? FALLOC_FL_KEEP_SIZE : 0, offset, len);
+    }
+    /**
+     * @brief Deallocates the blocks of a range, which then reads back as zeroes. The file size is
+     * kept.
+     * @param offset Start of the range.
+     * @param len Length of the range.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> punch_hole(off_t offset, off_t len) noexcept {
+      return sys_fallocate(__f, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+    }
+    /**
+     * @brief Starts writeback of a range, and with `wait` blocks until it has been written. Used to
+     * pace writeback of large files instead of leaving it all to one `sync()`. This does not make
+     * the range durable, metadata and device caches are not flushed.
+     * @param offset Start of the range.
+     * @param len Length of the range, 0 extends to the end of file.
+     * @param wait Waits for the writeback of the range to complete.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> sync_range(off_t offset, off_t len, bool wait = false) noexcept {
+      unsigned int flags = wait
+        ? SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER
+        : SYNC_FILE_RANGE_WRITE;
+      return sys_sync_range(__f, offset, len, flags);
+    }
+    /**
+     * @brief Declares the access pattern of a range, `DONT_NEED` drops its clean pages from the
+     * page cache.
+     * @param advice Expected access pattern.
+     * @param offset Start of the range.
+     * @param len Length of the range, 0 extends to the end of file.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> advise(
+      FileAdvice advice, off_t offset = 0, off_t len = 0
+    ) noexcept {
+      return sys_fadvise(__f, advice, offset, len);
+    }
+    /**
+     * @brief Reads a range into the page cache in the background.
+     * @param offset Start of the range.
+     * @param len Length of the range.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> readahead(off_t offset, size_t len) noexcept {
+      return sys_readahead(__f, offset, len);
+    }
+    /**
+     * @brief Copies a range to the same offset of another file without moving the bytes through
+     * user space where possible. Tries a reflink (`FICLONERANGE`) first, then `copy_file_range`,
+     * then `sendfile`, then a buffered loop. Copying stops early at the end of this file. The
+     * position of `dst` may be moved.
+     * @param dst Destination file, opened for writing without append.
+     * @param offset Start of the range, in both files.
+     * @param len Length of the range.
+     * @param on_progress Invoked with the progress after every chunk.
+     * @return Final progress, with the amount copied and the method used, or IO error.
+     */
+    template <class OnProgress = CopyNoProgress>
+      requires(std::invocable<OnProgress &, const CopyProgress &>)
+    std::expected<CopyProgress, IoError> copy_to(
+      LocalFile &dst, off_t offset, size_t len, OnProgress on_progress = {}
+    ) noexcept {
+      FileCopyState state{__f, dst.__f, offset, len, 8 << 20};
+      while (!state.done) {
+        size_t before = state.copied;
+        auto res = state.step();
+        if (!res) return std::unexpected{res.error()};
+        if (state.copied != before) on_progress(state.progress());
+      }
+      return state.progress();
+    }
+    /**
+     * @brief Runs `copy_to` on a worker of the pool, a copy blocks for as long as the kernel takes
+     * to move the bytes (an unchunked reflink included). Both files have to stay in place until the
+     * awaiter completes, on_progress is invoked on the worker.
+     * @param pool Pool running the copy.
+     * @return Awaiter completing with the final progress or IO error.
+     */
+    template <class OnProgress = CopyNoProgress>
+      requires(std::invocable<OnProgress &, const CopyProgress &>)
+    asio::InfiniteAwaiter<OffloadPoller<std::expected<CopyProgress, IoError>>> acopy_to(
+      OffloadPool &pool, LocalFile &dst, off_t offset, size_t len, OnProgress on_progress = {}
+    ) noexcept {
+      return pool.submit([this, &dst, offset, len, on_progress = std::move(on_progress)]() {
+        return copy_to(dst, offset, len, on_progress);
+      });
+    }
+    /**
+     * @brief Alignment required for transfers on files opened with `OpenOptions::direct()`.
+     * @return Alignment in bytes, 0 for buffered files.
+     */
+    size_t direct_alignment() const noexcept {
+      return __dio_align;
+    }
     /**
      * @brief Returns a borrowed file handle.
      * @return Non-owning file handle for the underlying descriptor.
@@ -148,18 +516,48 @@ namespace jowi::io {
     }
   };
 
+  std::optional<LocalFileWritePoller::ValueType> LocalFileWritePoller::poll() noexcept {
+    auto res = file.write(v);
+    if (!res && res.error().is_would_block()) return std::nullopt;
+    return res;
+  }
+
+  template <WritableBuffer buf_type>
+  std::optional<typename LocalFileReadPoller<buf_type>::ValueType> LocalFileReadPoller<
+    buf_type>::poll() noexcept {
+    auto res = file.read(buf);
+    if (!res && res.error().is_would_block()) return std::nullopt;
+    return res;
+  }
+
   /**
    * @brief Fluent interface for configuring file open flags.
    */
   export struct OpenOptions {
   private:
     std::bitset<32> __opt;
+    off_t __prealloc_len;
+    bool __prealloc_keep_size;
+    std::optional<FileAdvice> __advice;
+
+    std::expected<LocalFile, IoError> __prepare(LocalFile file) const noexcept {
+      if (__prealloc_len != 0) {
+        auto res = file.allocate(0, __prealloc_len, __prealloc_keep_size);
+        if (!res) return std::unexpected{res.error()};
+      }
+      if (__advice) {
+        auto res = file.advise(*__advice);
+        if (!res) return std::unexpected{res.error()};
+      }
+      return file;
+    }
 
   public:
     /**
      * @brief Initializes with no flags set.
      */
-    OpenOptions() noexcept : __opt{0} {}
+    OpenOptions() noexcept :
+      __opt{0}, __prealloc_len{0}, __prealloc_keep_size{true}, __advice{std::nullopt} {}
     /**
      * @brief Requests read-only access.
      * @return Reference to these options for chaining.
@@ -215,14 +613,64 @@ namespace jowi::io {
       return *this;
     }
     /**
-     * @brief Opens the file described by the configuration.
+     * @brief Bypasses the page cache (`O_DIRECT`). Transfers then have to be aligned to
+     * `LocalFile::direct_alignment()`, see `AlignedBuffer`.
+     * @return Reference to these options for chaining.
+     */
+    OpenOptions &direct() noexcept {
+      __opt |= O_DIRECT;
+      return *this;
+    }
+    /**
+     * @brief Allocates the first `len` bytes once the file is open, see `LocalFile::allocate`.
+     * This happens on every open, reopening an existing file leaves its size alone unless
+     * `keep_size` is turned off.
+     * @param len Amount of bytes to allocate.
+     * @param keep_size When true the file size is left as is.
+     * @return Reference to these options for chaining.
+     */
+    OpenOptions &preallocate(off_t len, bool keep_size = true) noexcept {
+      __prealloc_len = len;
+      __prealloc_keep_size = keep_size;
+      return *this;
+    }
+    /**
+     * @brief Declares the access pattern of the whole file once it is open.
+     * @param advice Expected access pattern.
+     * @return Reference to these options for chaining.
+     */
+    OpenOptions &advise(FileAdvice advice) noexcept {
+      __advice = advice;
+      return *this;
+    }
+    /**
+     * @brief Opens the file described by the configuration. Direct files query their alignment.
      * @param p Filesystem path to open.
      * @return Local file object or IO error.
      */
     std::expected<LocalFile, IoError> open(const fs::path &p) const noexcept {
-      return sys_call(::open, p.c_str(), static_cast<int>(__opt.to_ulong()))
+      int flags = static_cast<int>(__opt.to_ulong());
+      return sys_call(::open, p.c_str(), flags, 0644)
         .transform(FileDescriptor::manage_default)
-        .transform(LocalFile::from);
+        .and_then([&](FileDescriptor f) -> std::expected<LocalFile, IoError> {
+          if ((flags & O_DIRECT) == 0) return LocalFile::from(std::move(f));
+          return sys_dio_alignment(f).transform([&](size_t align) {
+            return LocalFile{std::move(f), align};
+          });
+        })
+        .and_then([&](LocalFile file) { return __prepare(std::move(file)); });
+    }
+    /**
+     * @brief Opens the file on a worker of the pool, path resolution on slow or remote filesystems
+     * blocks.
+     * @param pool Pool running the open.
+     * @param p Filesystem path to open.
+     * @return Awaiter completing with the local file or IO error.
+     */
+    asio::InfiniteAwaiter<OffloadPoller<std::expected<LocalFile, IoError>>> aopen(
+      OffloadPool &pool, fs::path p
+    ) const noexcept {
+      return pool.submit([opts = *this, p = std::move(p)]() { return opts.open(p); });
     }
   };
 }
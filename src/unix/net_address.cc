@@ -27,6 +27,16 @@ namespace jowi::io {
     sockaddr_in __addr;
 
     Ipv4Address(sockaddr_in addr) noexcept : __addr{addr} {}
+    /*
+     * fields are assigned by name, the layout of sockaddr_in differs between platforms (sin_len).
+     */
+    static Ipv4Address __make(unsigned short port, in_addr_t host) noexcept {
+      sockaddr_in addr{};
+      addr.sin_family = addr_family();
+      addr.sin_port = port;
+      addr.sin_addr.s_addr = host;
+      return Ipv4Address{addr};
+    }
 
   public:
     int port() const noexcept {
@@ -47,12 +57,10 @@ namespace jowi::io {
       return AF_INET;
     }
     static Ipv4Address empty() noexcept {
-      return Ipv4Address{{sizeof(__addr), static_cast<unsigned char>(addr_family()), 0, 0}};
+      return __make(0, 0);
     }
     static Ipv4Address listen_all(unsigned short port) noexcept {
-      return Ipv4Address{
-        {sizeof(__addr), static_cast<unsigned char>(addr_family()), port, INADDR_ANY}
-      };
+      return __make(port, INADDR_ANY);
     }
     static std::expected<Ipv4Address, IoError> create(
       std::string_view host, unsigned short port
@@ -0,0 +1,202 @@
+module;
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <expected>
+#include <optional>
+#include <vector>
+export module jowi.io:net_info;
+import :error;
+import :fd_type;
+import :buffer;
+import :sys_call;
+import :metrics;
+
+/**
+ * @file unix/net_info.cc
+ * @brief Kernel side socket numbers: `TCP_INFO` snapshots and `SO_TIMESTAMPING` software
+ * timestamps, used to split application latency from the time spent in kernel queues.
+ */
+
+namespace jowi::io {
+  /**
+   * @brief Snapshot of a TCP connection as the kernel sees it.
+   */
+  export struct TcpInfo {
+    // TCP_ESTABLISHED, TCP_CLOSE_WAIT, ... from <netinet/tcp.h>.
+    uint8_t state;
+    std::chrono::microseconds rtt;
+    std::chrono::microseconds rtt_var;
+    std::chrono::microseconds rto;
+    // congestion window and maximum segment size, in segments and bytes.
+    uint32_t snd_cwnd;
+    uint32_t snd_mss;
+    // segments sent and not acknowledged yet, and those of them considered lost.
+    uint32_t unacked;
+    uint32_t lost;
+    uint32_t total_retransmits;
+    // bytes written and not acknowledged by the peer, the unsent part of them, and bytes received
+    // and not read yet.
+    size_t send_queue;
+    size_t not_sent;
+    size_t recv_queue;
+  };
+
+  /*
+   * one getsockopt(TCP_INFO) followed by the SIOCOUTQ, SIOCOUTQNSD and SIOCINQ ioctls.
+   */
+  std::expected<TcpInfo, IoError> sys_tcp_info(const FileDescriptor &fd) noexcept {
+    int f = fd.get_or(-1);
+    tcp_info raw{};
+    socklen_t len = sizeof(raw);
+    int out_q = 0;
+    int not_sent = 0;
+    int in_q = 0;
+    return sys_call_void(::getsockopt, f, IPPROTO_TCP, TCP_INFO, &raw, &len)
+      .and_then([&]() { return sys_call_void(::ioctl, f, SIOCOUTQ, &out_q); })
+      .and_then([&]() { return sys_call_void(::ioctl, f, SIOCOUTQNSD, &not_sent); })
+      .and_then([&]() { return sys_call_void(::ioctl, f, SIOCINQ, &in_q); })
+      .transform([&]() {
+        return TcpInfo{
+          raw.tcpi_state,
+          std::chrono::microseconds{raw.tcpi_rtt},
+          std::chrono::microseconds{raw.tcpi_rttvar},
+          std::chrono::microseconds{raw.tcpi_rto},
+          raw.tcpi_snd_cwnd,
+          raw.tcpi_snd_mss,
+          raw.tcpi_unacked,
+          raw.tcpi_lost,
+          raw.tcpi_total_retrans,
+          static_cast<size_t>(out_q),
+          static_cast<size_t>(not_sent),
+          static_cast<size_t>(in_q)
+        };
+      });
+  }
+
+  /**
+   * @brief Kernel software timestamp, on the `CLOCK_REALTIME` time line.
+   */
+  export using NetTimestamp = std::chrono::sys_time<std::chrono::nanoseconds>;
+
+  /**
+   * @brief Where a sent packet was when it was stamped. `SCHED` is entering the queueing layer,
+   * `SENT` is handing it to the device and `ACKED` is the peer acknowledging it (TCP only).
+   */
+  export enum struct TxStage : uint8_t { SCHED, SENT, ACKED };
+
+  /**
+   * @brief Transmit timestamp read from the error queue. id numbers the send it belongs to: for
+   * TCP the offset of the last byte of that send in the stream since timestamps were enabled, for
+   * UDP the count of datagrams sent before it.
+   */
+  export struct TxTimestamp {
+    uint32_t id;
+    TxStage stage;
+    NetTimestamp at;
+  };
+
+  /*
+   * software receive and transmit timestamps, ids per send and no payload looped back with the
+   * transmit timestamps. ACK timestamps are only generated by TCP.
+   */
+  std::expected<void, IoError> sys_enable_timestamping(const FileDescriptor &fd) noexcept {
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+      SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_ACK |
+      SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    return sys_setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, flags);
+  }
+
+  NetTimestamp timespec_to_timestamp(const timespec &ts) noexcept {
+    return NetTimestamp{std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec}};
+  }
+
+  /*
+   * software stamp of a SCM_TIMESTAMPING control message, nullopt when msg carries none.
+   */
+  std::optional<NetTimestamp> sys_read_timestamp(msghdr &msg) noexcept {
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_TIMESTAMPING) continue;
+      auto *tss = reinterpret_cast<const scm_timestamping *>(CMSG_DATA(cm));
+      if (tss->ts[0].tv_sec == 0 && tss->ts[0].tv_nsec == 0) return std::nullopt;
+      return timespec_to_timestamp(tss->ts[0]);
+    }
+    return std::nullopt;
+  }
+
+  /*
+   * control space for one SCM_TIMESTAMPING and one IP(V6)_RECVERR message.
+   */
+  inline constexpr size_t timestamp_control_size = 256;
+
+  /*
+   * recvmsg into buf, reporting the receive timestamp of the data. For TCP the kernel stamps the
+   * last segment read. addr, when given, receives the sender address.
+   */
+  std::expected<std::optional<NetTimestamp>, IoError> sys_recv_timestamped(
+    const FileDescriptor &fd,
+    WritableBuffer auto &buf,
+    int flags,
+    sockaddr *addr = nullptr,
+    socklen_t *addr_len = nullptr
+  ) noexcept {
+    std::array<char, timestamp_control_size> control;
+    size_t len = buf.writable_size();
+    iovec iov{buf.write_beg(), len};
+    msghdr msg{};
+    msg.msg_name = addr;
+    msg.msg_namelen = addr_len ? *addr_len : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    return sys_io_call(IoOp::RECV, fd.get_or(-1), len, ::recvmsg, &msg, flags)
+      .transform([&](ssize_t n) {
+        buf.mark_write(static_cast<size_t>(n));
+        if (addr_len) *addr_len = msg.msg_namelen;
+        return sys_read_timestamp(msg);
+      });
+  }
+
+  /*
+   * drains the error queue into out, returns the amount of timestamps appended. Entries that are
+   * not timestamps, such as zero copy completions, are dropped.
+   */
+  std::expected<size_t, IoError> sys_read_tx_timestamps(
+    const FileDescriptor &fd, std::vector<TxTimestamp> &out
+  ) noexcept {
+    size_t before = out.size();
+    while (true) {
+      std::array<char, timestamp_control_size> control;
+      msghdr msg{};
+      msg.msg_control = control.data();
+      msg.msg_controllen = control.size();
+      auto res = sys_call(::recvmsg, fd.get_or(-1), &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+      if (!res) {
+        if (res.error().is_would_block()) return out.size() - before;
+        return std::unexpected{res.error()};
+      }
+      auto at = sys_read_timestamp(msg);
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+        bool is_recv_err = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+          (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+        if (!is_recv_err) continue;
+        auto *serr = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+        if (serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || !at) continue;
+        TxStage stage = serr->ee_info == SCM_TSTAMP_SCHED ? TxStage::SCHED
+          : serr->ee_info == SCM_TSTAMP_ACK               ? TxStage::ACKED
+                                                          : TxStage::SENT;
+        out.emplace_back(TxTimestamp{serr->ee_data, stage, *at});
+      }
+    }
+  }
+}
@@ -0,0 +1,189 @@
+module;
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <expected>
+#include <optional>
+export module jowi.io:net_option;
+import :error;
+import :fd_type;
+import :sys_call;
+
+/**
+ * @file unix/net_option.cc
+ * @brief Fluent socket option builder applied when sockets are created or afterwards.
+ */
+
+namespace jowi::io {
+  /**
+   * @brief Fluent interface for configuring socket options. Only the options that have been set
+   * are applied, in declaration order, and the first failing `setsockopt` is reported. TCP level
+   * options fail with `EOPNOTSUPP` when applied to `LocalAddress` sockets.
+   */
+  export struct SocketOptions {
+  private:
+    std::optional<int> __no_delay;
+    std::optional<int> __cork;
+    std::optional<int> __quick_ack;
+    std::optional<int> __send_buf;
+    std::optional<int> __recv_buf;
+    std::optional<int> __busy_poll;
+    std::optional<int> __not_sent_lowat;
+    std::optional<int> __reuse_addr;
+    std::optional<int> __reuse_port;
+    std::optional<int> __keep_alive;
+    std::optional<int> __keep_idle;
+    std::optional<int> __keep_interval;
+    std::optional<int> __keep_count;
+    std::optional<int> __defer_accept;
+
+    static std::expected<void, IoError> __apply(
+      const FileDescriptor &fd, int level, int opt_name, const std::optional<int> &v
+    ) noexcept {
+      if (!v) return {};
+      return sys_setsockopt(fd, level, opt_name, *v);
+    }
+
+  public:
+    /**
+     * @brief Initializes with no options set.
+     */
+    SocketOptions() noexcept = default;
+
+    /**
+     * @brief Disables Nagle's algorithm (`TCP_NODELAY`).
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &no_delay(bool enable = true) noexcept {
+      __no_delay = enable;
+      return *this;
+    }
+    /**
+     * @brief Holds back partial frames until uncorked (`TCP_CORK`). Use `send_more` for per call
+     * corking through `MSG_MORE`.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &cork(bool enable = true) noexcept {
+      __cork = enable;
+      return *this;
+    }
+    /**
+     * @brief Sends ACKs immediately instead of delaying them (`TCP_QUICKACK`). The kernel resets
+     * this flag on its own, reapply it after reads when it matters.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &quick_ack(bool enable = true) noexcept {
+      __quick_ack = enable;
+      return *this;
+    }
+    /**
+     * @brief Sets the kernel send buffer size (`SO_SNDBUF`).
+     * @param size Requested size in bytes, the kernel doubles this value for bookkeeping.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &send_buffer(int size) noexcept {
+      __send_buf = size;
+      return *this;
+    }
+    /**
+     * @brief Sets the kernel receive buffer size (`SO_RCVBUF`).
+     * @param size Requested size in bytes, the kernel doubles this value for bookkeeping.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &recv_buffer(int size) noexcept {
+      __recv_buf = size;
+      return *this;
+    }
+    /**
+     * @brief Busy polls the device queue on blocking receives (`SO_BUSY_POLL`).
+     * @param dur Amount of time to busy poll for.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &busy_poll(std::chrono::microseconds dur) noexcept {
+      __busy_poll = static_cast<int>(dur.count());
+      return *this;
+    }
+    /**
+     * @brief Limits the amount of unsent bytes in the send queue (`TCP_NOTSENT_LOWAT`).
+     * @param bytes Threshold below which the socket reports as writable.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &not_sent_lowat(int bytes) noexcept {
+      __not_sent_lowat = bytes;
+      return *this;
+    }
+    /**
+     * @brief Allows rebinding an address in TIME_WAIT (`SO_REUSEADDR`).
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &reuse_addr(bool enable = true) noexcept {
+      __reuse_addr = enable;
+      return *this;
+    }
+    /**
+     * @brief Allows multiple sockets to bind the same port (`SO_REUSEPORT`).
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &reuse_port(bool enable = true) noexcept {
+      __reuse_port = enable;
+      return *this;
+    }
+    /**
+     * @brief Enables keepalive probes (`SO_KEEPALIVE`).
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &keep_alive(bool enable = true) noexcept {
+      __keep_alive = enable;
+      return *this;
+    }
+    /**
+     * @brief Enables keepalive probes and tunes them (`TCP_KEEPIDLE`, `TCP_KEEPINTVL`,
+     * `TCP_KEEPCNT`).
+     * @param idle Idle time before the first probe.
+     * @param interval Time between probes.
+     * @param count Unanswered probes before the connection is dropped.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &keep_alive(
+      std::chrono::seconds idle, std::chrono::seconds interval, int count
+    ) noexcept {
+      __keep_alive = true;
+      __keep_idle = static_cast<int>(idle.count());
+      __keep_interval = static_cast<int>(interval.count());
+      __keep_count = count;
+      return *this;
+    }
+    /**
+     * @brief Only completes accepts once data has arrived (`TCP_DEFER_ACCEPT`).
+     * @param timeout Time to wait for the first payload.
+     * @return Reference to these options for chaining.
+     */
+    SocketOptions &defer_accept(std::chrono::seconds timeout) noexcept {
+      __defer_accept = static_cast<int>(timeout.count());
+      return *this;
+    }
+
+    /**
+     * @brief Applies every option that has been set to the descriptor.
+     * @param fd Socket descriptor.
+     * @return Success or the first IO error.
+     */
+    std::expected<void, IoError> apply(const FileDescriptor &fd) const noexcept {
+      return __apply(fd, SOL_SOCKET, SO_REUSEADDR, __reuse_addr)
+        .and_then([&]() { return __apply(fd, SOL_SOCKET, SO_REUSEPORT, __reuse_port); })
+        .and_then([&]() { return __apply(fd, SOL_SOCKET, SO_SNDBUF, __send_buf); })
+        .and_then([&]() { return __apply(fd, SOL_SOCKET, SO_RCVBUF, __recv_buf); })
+        .and_then([&]() { return __apply(fd, SOL_SOCKET, SO_BUSY_POLL, __busy_poll); })
+        .and_then([&]() { return __apply(fd, SOL_SOCKET, SO_KEEPALIVE, __keep_alive); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_KEEPIDLE, __keep_idle); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_KEEPINTVL, __keep_interval); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_KEEPCNT, __keep_count); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_NODELAY, __no_delay); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_CORK, __cork); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_QUICKACK, __quick_ack); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, __not_sent_lowat); })
+        .and_then([&]() { return __apply(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, __defer_accept); });
+    }
+  };
+}
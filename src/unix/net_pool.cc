@@ -0,0 +1,298 @@
+module;
+#include <sys/poll.h>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <expected>
+#include <optional>
+#include <utility>
+export module jowi.io:net_pool;
+import jowi.asio;
+import :error;
+import :net_address;
+import :net_option;
+import :net_socket;
+import :sys_call;
+
+/**
+ * @file unix/net_pool.cc
+ * @brief Client side pool of connected `TcpSocket`s to a single upstream address.
+ */
+
+namespace jowi::io {
+  /**
+   * @brief Fluent interface for configuring a `TcpConnectionPool`.
+   */
+  export struct PoolOptions {
+  private:
+    size_t __max_idle;
+    size_t __max_total;
+    std::chrono::milliseconds __idle_timeout;
+    SocketOptions __sock_opts;
+
+  public:
+    /**
+     * @brief Initializes with 8 idle connections, 64 connections in total and a 30 second idle
+     * timeout.
+     */
+    PoolOptions() noexcept :
+      __max_idle{8}, __max_total{64}, __idle_timeout{std::chrono::seconds{30}}, __sock_opts{} {}
+
+    /**
+     * @brief Caps the amount of idle connections kept around, extra ones are closed on release.
+     * @return Reference to these options for chaining.
+     */
+    PoolOptions &max_idle(size_t n) noexcept {
+      __max_idle = n;
+      return *this;
+    }
+    /**
+     * @brief Caps the amount of connections, idle and leased, open at the same time.
+     * @return Reference to these options for chaining.
+     */
+    PoolOptions &max_total(size_t n) noexcept {
+      __max_total = n;
+      return *this;
+    }
+    /**
+     * @brief Closes idle connections that have not been used for this long.
+     * @return Reference to these options for chaining.
+     */
+    PoolOptions &idle_timeout(std::chrono::milliseconds dur) noexcept {
+      __idle_timeout = dur;
+      return *this;
+    }
+    /**
+     * @brief Options applied to every new connection.
+     * @return Reference to these options for chaining.
+     */
+    PoolOptions &socket_options(const SocketOptions &opts) noexcept {
+      __sock_opts = opts;
+      return *this;
+    }
+
+    size_t max_idle() const noexcept {
+      return __max_idle;
+    }
+    size_t max_total() const noexcept {
+      return __max_total;
+    }
+    std::chrono::milliseconds idle_timeout() const noexcept {
+      return __idle_timeout;
+    }
+    const SocketOptions &socket_options() const noexcept {
+      return __sock_opts;
+    }
+  };
+
+  export template <NetAddress Addr> struct TcpConnectionPool;
+  export template <NetAddress Addr> struct PoolAcquirePoller;
+
+  /**
+   * @brief Connection leased from a `TcpConnectionPool`. It goes back to the pool when destroyed,
+   * call `discard()` when the connection is left in an unknown protocol state.
+   */
+  export template <NetAddress Addr> struct PooledTcpSocket {
+  private:
+    TcpConnectionPool<Addr> *__pool;
+    std::optional<TcpSocket<Addr>> __sock;
+
+    PooledTcpSocket(TcpConnectionPool<Addr> &pool, TcpSocket<Addr> sock) noexcept :
+      __pool{&pool}, __sock{std::move(sock)} {}
+    friend struct TcpConnectionPool<Addr>;
+    friend struct PoolAcquirePoller<Addr>;
+
+  public:
+    PooledTcpSocket(PooledTcpSocket &&o) noexcept :
+      __pool{o.__pool}, __sock{std::exchange(o.__sock, std::nullopt)} {}
+    PooledTcpSocket &operator=(PooledTcpSocket &&o) noexcept {
+      if (this != &o) {
+        release();
+        __pool = o.__pool;
+        __sock = std::exchange(o.__sock, std::nullopt);
+      }
+      return *this;
+    }
+    PooledTcpSocket(const PooledTcpSocket &) = delete;
+    ~PooledTcpSocket() noexcept {
+      release();
+    }
+
+    TcpSocket<Addr> &operator*() noexcept {
+      return *__sock;
+    }
+    const TcpSocket<Addr> &operator*() const noexcept {
+      return *__sock;
+    }
+    TcpSocket<Addr> *operator->() noexcept {
+      return &*__sock;
+    }
+    const TcpSocket<Addr> *operator->() const noexcept {
+      return &*__sock;
+    }
+
+    /**
+     * @brief Returns the connection to the pool early.
+     */
+    void release() noexcept {
+      if (__sock) __pool->__release(std::exchange(__sock, std::nullopt).value());
+    }
+    /**
+     * @brief Closes the connection instead of returning it to the pool.
+     */
+    void discard() noexcept {
+      if (__sock) {
+        __sock.reset();
+        __pool->__total -= 1;
+      }
+    }
+  };
+
+  /**
+   * @brief Pool of connections to one upstream. Idle connections are handed out most recently
+   * used first and are probed with `TcpSocket::probe_idle` before being reused, so a request never
+   * pays for the handshake when a healthy connection is available. The pool is not thread safe and
+   * has to outlive every connection leased from it.
+   */
+  export template <NetAddress Addr> struct TcpConnectionPool {
+  private:
+    using clock_type = std::chrono::steady_clock;
+    struct IdleEntry {
+      TcpSocket<Addr> sock;
+      clock_type::time_point since;
+    };
+    Addr __addr;
+    PoolOptions __opts;
+    std::deque<IdleEntry> __idle;
+    size_t __total;
+
+    friend struct PooledTcpSocket<Addr>;
+    friend struct PoolAcquirePoller<Addr>;
+
+    void __release(TcpSocket<Addr> sock) noexcept {
+      if (__idle.size() < __opts.max_idle()) {
+        __idle.emplace_back(IdleEntry{std::move(sock), clock_type::now()});
+      } else {
+        __total -= 1;
+      }
+    }
+
+    std::optional<TcpSocket<Addr>> __take_idle() noexcept {
+      auto now = clock_type::now();
+      while (!__idle.empty()) {
+        IdleEntry entry = std::move(__idle.back());
+        __idle.pop_back();
+        if (now - entry.since < __opts.idle_timeout() && entry.sock.probe_idle()) {
+          return std::move(entry.sock);
+        }
+        __total -= 1;
+      }
+      return std::nullopt;
+    }
+
+  public:
+    TcpConnectionPool(Addr addr, PoolOptions opts = PoolOptions{}) noexcept :
+      __addr{addr}, __opts{std::move(opts)}, __idle{}, __total{0} {}
+    TcpConnectionPool(const TcpConnectionPool &) = delete;
+    TcpConnectionPool &operator=(const TcpConnectionPool &) = delete;
+
+    /**
+     * @brief Leases a healthy idle connection or opens a new one. A new connection is handed out
+     * once its handshake completed, waiting for it on the calling thread, a failed handshake does
+     * not take a slot in the pool.
+     * @return Leased connection, or IO error. Fails with `EAGAIN` when `max_total` connections
+     * are already open.
+     */
+    std::expected<PooledTcpSocket<Addr>, IoError> acquire() noexcept {
+      if (auto sock = __take_idle()) {
+        return PooledTcpSocket<Addr>{*this, std::move(sock).value()};
+      }
+      if (__total >= __opts.max_total()) {
+        return std::unexpected{IoError{EAGAIN, "connection pool exhausted"}};
+      }
+      TcpConnectPoller<Addr> connecting{__addr, __opts.socket_options()};
+      while (true) {
+        auto res = connecting.poll();
+        if (res) {
+          if (!res->has_value()) return std::unexpected{res->error()};
+          __total += 1;
+          return PooledTcpSocket<Addr>{*this, std::move(res).value().value()};
+        }
+        if (auto wait_res = sys_poll_wait(*connecting.fd, POLLOUT); !wait_res) {
+          return std::unexpected{wait_res.error()};
+        }
+      }
+    }
+    /**
+     * @brief Leases a connection asynchronously, new connections complete their handshake first.
+     * Waits for a release when `max_total` connections are already open.
+     */
+    asio::InfiniteAwaiter<PoolAcquirePoller<Addr>> aacquire() noexcept {
+      return {*this};
+    }
+
+    /**
+     * @brief Closes idle connections that exceeded the idle timeout or failed the probe.
+     */
+    void prune() noexcept {
+      auto now = clock_type::now();
+      std::erase_if(__idle, [&](const IdleEntry &e) {
+        bool drop = now - e.since >= __opts.idle_timeout() || !e.sock.probe_idle();
+        if (drop) __total -= 1;
+        return drop;
+      });
+    }
+
+    size_t idle_count() const noexcept {
+      return __idle.size();
+    }
+    size_t total_count() const noexcept {
+      return __total;
+    }
+    const Addr &addr() const noexcept {
+      return __addr;
+    }
+  };
+
+  /**
+   * @brief Completes with an idle connection, a released one or a newly connected one once the
+   * pool has room for it. A new connection is only handed out once established, a failed
+   * handshake gives its slot back.
+   */
+  export template <NetAddress Addr> struct PoolAcquirePoller {
+    TcpConnectionPool<Addr> &pool;
+    std::optional<TcpConnectPoller<Addr>> connecting = std::nullopt;
+
+    using ValueType = std::expected<PooledTcpSocket<Addr>, IoError>;
+
+    PoolAcquirePoller(TcpConnectionPool<Addr> &pool) noexcept : pool{pool} {}
+    PoolAcquirePoller(PoolAcquirePoller &&o) noexcept :
+      pool{o.pool}, connecting{std::exchange(o.connecting, std::nullopt)} {}
+    ~PoolAcquirePoller() noexcept {
+      // an abandoned connect gives its reserved slot back.
+      if (connecting) pool.__total -= 1;
+    }
+
+    std::optional<ValueType> poll() noexcept {
+      if (!connecting) {
+        if (auto sock = pool.__take_idle()) {
+          return PooledTcpSocket<Addr>{pool, std::move(sock).value()};
+        }
+        if (pool.__total >= pool.__opts.max_total()) return std::nullopt;
+        pool.__total += 1;
+        connecting.emplace(pool.__addr, pool.__opts.socket_options());
+      }
+      auto res = connecting->poll();
+      if (!res) return std::nullopt;
+      connecting.reset();
+      if (!res->has_value()) {
+        pool.__total -= 1;
+        return std::unexpected{res->error()};
+      }
+      return PooledTcpSocket<Addr>{pool, std::move(res).value().value()};
+    }
+  };
+
+  template struct TcpConnectionPool<Ipv4Address>;
+  template struct TcpConnectionPool<LocalAddress>;
+}
@@ -1,15 +1,31 @@
 module;
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <array>
 #include <cerrno>
 #include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
 #include <expected>
 #include <optional>
+#include <span>
 #include <string_view>
+#include <vector>
 export module jowi.io:net_socket;
 import jowi.asio;
 import :error;
 import :sys_call;
+import :metrics;
 import :net_address;
+import :net_option;
+import :net_info;
+import :timer_wheel;
 import :buffer;
 
 namespace jowi::io {
@@ -17,21 +33,246 @@ namespace jowi::io {
   struct TcpSocketSendPoller {
     const FileDescriptor &f;
     std::string_view payload;
+    int flags = 0;
 
     using ValueType = std::expected<size_t, IoError>;
 
     std::optional<ValueType> poll() const noexcept {
-      std::optional<ValueType> res = sys_call(
-        ::send,
+      return sys_io_poll_call(
+        IoOp::SEND,
         f.get_or(-1),
+        payload.length(),
+        ::send,
         static_cast<const void *>(payload.data()),
         payload.length(),
-        MSG_DONTWAIT
+        MSG_DONTWAIT | flags
       );
-      if (!res->has_value() &&
-          (res->error().err_code() == EAGAIN || res->error().err_code() == EWOULDBLOCK)) {
-        res.reset();
+    }
+  };
+
+  /*
+   * zero copy bookkeeping. The kernel numbers every successful MSG_ZEROCOPY send on a socket,
+   * starting from 0, and reports completed ranges of those numbers through the error queue.
+   */
+  export struct ZeroCopyState {
+    bool enabled = false;
+    size_t threshold = 0;
+    uint32_t next_id = 0;
+    // every id before completed has been released by the kernel.
+    uint32_t completed = 0;
+    // amount of sends for which the kernel fell back to copying (e.g. loopback).
+    uint64_t copied = 0;
+
+    bool is_released(uint32_t id) const noexcept {
+      return static_cast<int32_t>(completed - id) > 0;
+    }
+  };
+
+  /*
+   * reads every pending zero copy completion from the error queue.
+   */
+  std::expected<void, IoError> sys_reap_zero_copy(
+    const FileDescriptor &f, ZeroCopyState &zc
+  ) noexcept {
+    while (true) {
+      std::array<char, 128> control;
+      msghdr msg{};
+      msg.msg_control = control.data();
+      msg.msg_controllen = control.size();
+      auto res = sys_call(recvmsg, f.get_or(-1), &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+      if (!res) {
+        if (res.error().is_would_block()) return {};
+        return std::unexpected{res.error()};
+      }
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+        bool is_recv_err = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+          (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+        if (!is_recv_err) continue;
+        auto *serr = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) continue;
+        uint32_t lo = serr->ee_info;
+        uint32_t hi = serr->ee_data;
+        if (static_cast<int32_t>(hi + 1 - zc.completed) > 0) zc.completed = hi + 1;
+        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zc.copied += hi - lo + 1;
+      }
+    }
+  }
+
+  /*
+   * sends the whole payload with MSG_ZEROCOPY and only completes once the kernel has released every
+   * page of it, so the caller may reuse the buffer afterwards. Payloads below the threshold, or
+   * sockets without zero copy enabled, are sent regularly, still to completion.
+   */
+  struct TcpSocketZeroCopySendPoller {
+    const FileDescriptor &f;
+    ZeroCopyState &zc;
+    std::string_view payload;
+    size_t sent = 0;
+    std::optional<uint32_t> last_id = std::nullopt;
+
+    using ValueType = std::expected<size_t, IoError>;
+
+    std::optional<ValueType> poll() noexcept {
+      bool zero_copy = zc.enabled && payload.length() >= zc.threshold;
+      int flags = MSG_DONTWAIT | (zero_copy ? MSG_ZEROCOPY : 0);
+      while (sent < payload.length()) {
+        auto res = sys_io_call(
+          IoOp::SEND,
+          f.get_or(-1),
+          payload.length() - sent,
+          ::send,
+          static_cast<const void *>(payload.data() + sent),
+          payload.length() - sent,
+          flags
+        );
+        if (!res) {
+          // ENOBUFS : the socket ran out of option memory until completions are reaped.
+          if (res.error().is_would_block() || res.error().err_code() == ENOBUFS) break;
+          return std::unexpected{res.error()};
+        }
+        sent += *res;
+        if (zero_copy) last_id = zc.next_id++;
       }
+      if (zero_copy) {
+        auto reaped = sys_reap_zero_copy(f, zc);
+        if (!reaped) {
+          return std::unexpected{reaped.error()};
+        }
+      }
+      if (sent < payload.length() || (last_id && !zc.is_released(*last_id))) {
+        return std::nullopt;
+      }
+      return sent;
+    }
+  };
+
+  /*
+   * sendmsg over a list of views, at most max_send_vec of them per call.
+   */
+  static constexpr size_t max_send_vec = 128;
+  std::expected<size_t, IoError> sys_send_vec(
+    const FileDescriptor &f, std::span<const std::string_view> parts, int flags
+  ) noexcept {
+    std::array<iovec, max_send_vec> iov;
+    size_t count = std::min(parts.size(), max_send_vec);
+    for (size_t i = 0; i < count; i += 1) {
+      iov[i] = iovec{const_cast<char *>(parts[i].data()), parts[i].size()};
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; i += 1) {
+      total += parts[i].size();
+    }
+    msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = count;
+    return sys_io_call(IoOp::SEND, f.get_or(-1), total, ::sendmsg, &msg, flags)
+      .transform([](ssize_t n) { return static_cast<size_t>(n); });
+  }
+
+  struct TcpSocketSendVecPoller {
+    const FileDescriptor &f;
+    std::span<const std::string_view> parts;
+
+    using ValueType = std::expected<size_t, IoError>;
+
+    std::optional<ValueType> poll() const noexcept {
+      auto res = sys_send_vec(f, parts, MSG_DONTWAIT);
+      if (!res && res.error().is_would_block()) return std::nullopt;
+      return res;
+    }
+  };
+
+  /*
+   * descriptor passing (SCM_RIGHTS) on local sockets. A message carries at most max_passed_fds
+   * descriptors along with a non empty payload, the descriptors travel with its first byte.
+   */
+  export inline constexpr size_t max_passed_fds = 64;
+  inline constexpr size_t passed_fds_control_size = CMSG_SPACE(sizeof(int) * max_passed_fds);
+
+  std::expected<size_t, IoError> sys_send_fds(
+    const FileDescriptor &f, std::string_view payload, std::span<const int> fds, int flags
+  ) noexcept {
+    if (payload.empty() || fds.size() > max_passed_fds) {
+      return std::unexpected{IoError::str_error(EINVAL)};
+    }
+    alignas(cmsghdr) std::array<char, passed_fds_control_size> control;
+    iovec iov{const_cast<char *>(payload.data()), payload.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!fds.empty()) {
+      msg.msg_control = control.data();
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+      cmsghdr *c = CMSG_FIRSTHDR(&msg);
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_RIGHTS;
+      c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+      std::memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+    }
+    return sys_io_call(IoOp::SEND, f.get_or(-1), payload.size(), ::sendmsg, &msg, flags)
+      .transform([](ssize_t n) { return static_cast<size_t>(n); });
+  }
+
+  /*
+   * recvmsg into buf, appending the descriptors that came along to out. They are close-on-exec
+   * (MSG_CMSG_CLOEXEC) and owned from the moment they are received. Fails with EMSGSIZE when the
+   * kernel had to drop descriptors, what did arrive is kept in buf and out.
+   */
+  std::expected<size_t, IoError> sys_recv_fds(
+    const FileDescriptor &f, WritableBuffer auto &buf, std::vector<FileDescriptor> &out, int flags
+  ) noexcept {
+    alignas(cmsghdr) std::array<char, passed_fds_control_size> control;
+    size_t len = buf.writable_size();
+    iovec iov{buf.write_beg(), len};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    return sys_io_call(IoOp::RECV, f.get_or(-1), len, ::recvmsg, &msg, flags | MSG_CMSG_CLOEXEC)
+      .and_then([&](ssize_t n) -> std::expected<size_t, IoError> {
+        buf.mark_write(static_cast<size_t>(n));
+        size_t before = out.size();
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+          if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+          size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          for (size_t i = 0; i < count; i += 1) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            out.emplace_back(FileDescriptor::manage_default(fd));
+          }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+          return std::unexpected{IoError{EMSGSIZE, "descriptors dropped by the kernel"}};
+        }
+        return out.size() - before;
+      });
+  }
+
+  struct TcpSocketSendFdsPoller {
+    const FileDescriptor &f;
+    std::string_view payload;
+    std::span<const int> fds;
+
+    using ValueType = std::expected<size_t, IoError>;
+
+    std::optional<ValueType> poll() const noexcept {
+      auto res = sys_send_fds(f, payload, fds, MSG_DONTWAIT);
+      if (!res && res.error().is_would_block()) return std::nullopt;
+      return res;
+    }
+  };
+
+  template <WritableBuffer Buffer> struct TcpSocketRecvFdsPoller {
+    const FileDescriptor &f;
+    Buffer &buf;
+    std::vector<FileDescriptor> &out;
+
+    using ValueType = std::expected<size_t, IoError>;
+
+    std::optional<ValueType> poll() const noexcept {
+      auto res = sys_recv_fds(f, buf, out, MSG_DONTWAIT);
+      if (!res && res.error().is_would_block()) return std::nullopt;
       return res;
     }
   };
@@ -43,14 +284,11 @@ namespace jowi::io {
     using ValueType = std::expected<void, IoError>;
 
     std::optional<ValueType> poll() const noexcept {
-      std::optional<ValueType> res =
-        sys_call(::recv, f.get_or(-1), buf.write_beg(), buf.writable_size(), MSG_DONTWAIT)
-          .transform(BufferWriteMarker{buf});
-      if (!res->has_value() &&
-          (res->error().err_code() == EAGAIN || res->error().err_code() == EWOULDBLOCK)) {
-        res.reset();
-      }
-      return res;
+      size_t len = buf.writable_size();
+      return sys_io_poll_call(
+               IoOp::RECV, f.get_or(-1), len, ::recv, buf.write_beg(), len, MSG_DONTWAIT
+      )
+        .transform([&](auto res) { return res.transform(BufferWriteMarker{buf}); });
     }
   };
 
@@ -61,24 +299,94 @@ namespace jowi::io {
   private:
     Addr __addr;
     FileDescriptor __f;
+    ZeroCopyState __zc;
+
+    /*
+     * the blocking mode of the calls below. Accepted and connected sockets are O_NONBLOCK, which
+     * dropping MSG_DONTWAIT does not override, so a blocking call waits for the descriptor and
+     * retries while the non-blocking call would block.
+     */
+    template <class F>
+    auto __wait_until_done(bool non_blocking, short events, F &&call) const noexcept {
+      while (true) {
+        auto res = call();
+        if (non_blocking || res || !res.error().is_would_block()) return res;
+        if (auto wait_res = sys_poll_wait(__f, events); !wait_res) {
+          return decltype(res){std::unexpected{wait_res.error()}};
+        }
+      }
+    }
 
   public:
-    TcpSocket(Addr addr, FileDescriptor f) : __addr{addr}, __f{std::move(f)} {}
+    TcpSocket(Addr addr, FileDescriptor f) : __addr{addr}, __f{std::move(f)}, __zc{} {}
+
+    /*
+     * takes ownership of a connected socket, such as one received with recv_fds. The address is
+     * the peer's, as accept reports it.
+     */
+    static std::expected<TcpSocket, IoError> adopt(FileDescriptor f) noexcept {
+      auto addr = Addr::empty();
+      auto [raw_addr, len] = addr.sys_addr();
+      return sys_call_void(::getpeername, f.get_or(-1), raw_addr, &len).transform([&]() {
+        return TcpSocket{addr, std::move(f)};
+      });
+    }
 
     std::expected<size_t, IoError> send(
       std::string_view v, bool non_blocking = true
     ) const noexcept {
-      int flags = non_blocking ? MSG_DONTWAIT : 0;
-      return sys_call(
-        ::send, __f.get_or(-1), static_cast<const void *>(v.data()), v.length(), flags
-      );
+      return __wait_until_done(non_blocking, POLLOUT, [&]() {
+        return sys_io_call(
+          IoOp::SEND, __f.get_or(-1), v.length(), ::send, v.data(), v.length(), MSG_DONTWAIT
+        );
+      });
+    }
+    /*
+     * send with MSG_MORE, the kernel holds the bytes back until a send without MSG_MORE so that a
+     * header and body written separately leave in one segment.
+     */
+    std::expected<size_t, IoError> send_more(
+      std::string_view v, bool non_blocking = true
+    ) const noexcept {
+      return __wait_until_done(non_blocking, POLLOUT, [&]() {
+        return sys_io_call(
+          IoOp::SEND,
+          __f.get_or(-1),
+          v.length(),
+          ::send,
+          v.data(),
+          v.length(),
+          MSG_MORE | MSG_DONTWAIT
+        );
+      });
+    }
+    /*
+     * one sendmsg over every view (up to 128), the return value counts bytes across the views.
+     */
+    std::expected<size_t, IoError> send_vec(
+      std::span<const std::string_view> parts, bool non_blocking = true
+    ) const noexcept {
+      return __wait_until_done(non_blocking, POLLOUT, [&]() {
+        return sys_send_vec(__f, parts, MSG_DONTWAIT);
+      });
     }
     std::expected<void, IoError> recv(
       WritableBuffer auto &buf, bool non_blocking = true
     ) const noexcept {
-      int flags = non_blocking ? MSG_DONTWAIT : 0;
-      return sys_call(::recv, __f.get_or(-1), buf.write_beg(), buf.writable_size(), flags)
-        .transform(BufferWriteMarker{buf});
+      size_t len = buf.writable_size();
+      return __wait_until_done(non_blocking, POLLIN, [&]() {
+        return sys_io_call(
+                 IoOp::RECV, __f.get_or(-1), len, ::recv, buf.write_beg(), len, MSG_DONTWAIT
+        )
+          .transform(BufferWriteMarker{buf});
+      });
+    }
+    /*
+     * blocking receive whatever the descriptor mode, so that the socket is `IsReadable` and can
+     * feed a `BufNextable`. An empty buffer after a successful read is the end of the stream.
+     */
+    std::expected<void, IoError> read(WritableBuffer auto &buf) const noexcept {
+      return recv(buf, false);
     }
 
     const Addr &addr() const noexcept {
@@ -87,15 +395,126 @@ namespace jowi::io {
     auto native_handle() const noexcept {
       return __f.get_or(-1);
     }
+    std::expected<void, IoError> set_options(const SocketOptions &opts) const noexcept {
+      return opts.apply(__f);
+    }
+    /*
+     * cheap health check for idle connections. The connection is reusable when peeking would
+     * block, i.e. the peer neither closed it nor sent anything unsolicited.
+     */
+    bool probe_idle() const noexcept {
+      char c;
+      auto res = sys_call(::recv, __f.get_or(-1), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+      return !res && res.error().is_would_block();
+    }
+
+    /*
+     * passes descriptors (the native handles of sockets, files, pipes ...) to the peer process
+     * along with payload, in one sendmsg. The peer gets its own descriptors, the caller keeps and
+     * still closes these. A partial send returns the bytes sent, the descriptors went with them.
+     */
+    std::expected<size_t, IoError> send_fds(
+      std::string_view payload, std::span<const int> fds, bool non_blocking = true
+    ) const noexcept
+      requires(std::same_as<Addr, LocalAddress>)
+    {
+      return __wait_until_done(non_blocking, POLLOUT, [&]() {
+        return sys_send_fds(__f, payload, fds, MSG_DONTWAIT);
+      });
+    }
+    /*
+     * recv that also appends the descriptors passed along to out, returns how many were appended.
+     * A receive never spans two messages carrying descriptors.
+     */
+    std::expected<size_t, IoError> recv_fds(
+      WritableBuffer auto &buf, std::vector<FileDescriptor> &out, bool non_blocking = true
+    ) const noexcept
+      requires(std::same_as<Addr, LocalAddress>)
+    {
+      return __wait_until_done(non_blocking, POLLIN, [&]() {
+        return sys_recv_fds(__f, buf, out, MSG_DONTWAIT);
+      });
+    }
+
+    /*
+     * RTT, retransmits and queue depths as the kernel sees them, see `TcpInfo`.
+     */
+    std::expected<TcpInfo, IoError> tcp_info() const noexcept {
+      return sys_tcp_info(__f);
+    }
+    /*
+     * kernel software timestamps (SO_TIMESTAMPING) on received data, read with recv_timestamped,
+     * and on sent data, collected from the error queue by tx_timestamps. Both share the error
+     * queue with zero copy completions, so do not combine them with enable_zero_copy.
+     */
+    std::expected<void, IoError> enable_timestamps() const noexcept {
+      return sys_enable_timestamping(__f);
+    }
+    /*
+     * recv that also returns when the kernel received the data, nullopt without timestamps.
+     */
+    std::expected<std::optional<NetTimestamp>, IoError> recv_timestamped(
+      WritableBuffer auto &buf, bool non_blocking = true
+    ) const noexcept {
+      return __wait_until_done(non_blocking, POLLIN, [&]() {
+        return sys_recv_timestamped(__f, buf, MSG_DONTWAIT);
+      });
+    }
+    /*
+     * appends the transmit timestamps available so far to out, returns how many were appended.
+     */
+    std::expected<size_t, IoError> tx_timestamps(std::vector<TxTimestamp> &out) const noexcept {
+      return sys_read_tx_timestamps(__f, out);
+    }
+
+    /*
+     * zero copy sends (SO_ZEROCOPY). Payloads of at least threshold bytes sent through
+     * send_zero_copy / asend_zero_copy are pinned instead of copied, smaller ones are sent normally
+     * since pinning costs more than copying them. Fails with ENOPROTOOPT on kernels without support.
+     */
+    std::expected<void, IoError> enable_zero_copy(size_t threshold = 64 * 1024) noexcept {
+      return sys_setsockopt(__f, SOL_SOCKET, SO_ZEROCOPY, 1).transform([&]() {
+        __zc.enabled = true;
+        __zc.threshold = threshold;
+      });
+    }
+    const ZeroCopyState &zero_copy_state() const noexcept {
+      return __zc;
+    }
+    /*
+     * sends the whole payload and blocks until the kernel no longer references it.
+     */
+    std::expected<size_t, IoError> send_zero_copy(std::string_view v) noexcept {
+      auto poller = TcpSocketZeroCopySendPoller{__f, __zc, v};
+      auto res = poller.poll();
+      while (!res) {
+        short events = poller.sent < v.length() ? POLLOUT : 0;
+        if (auto wait_res = sys_poll_wait(__f, events); !wait_res) {
+          return std::unexpected{wait_res.error()};
+        }
+        res = poller.poll();
+      }
+      return std::move(res).value();
+    }
 
     /*
      * asynchronous execution
      */
+    asio::InfiniteAwaiter<TcpSocketZeroCopySendPoller> asend_zero_copy(std::string_view v) noexcept {
+      return {__f, __zc, v};
+    }
     asio::InfiniteAwaiter<TcpSocketSendPoller> asend(std::string_view v) const noexcept {
       return {__f, v};
     }
-    template <class clock_type = std::chrono::steady_clock>
-    asio::TimedAwaiter<TcpSocketSendPoller> asend(
+    asio::InfiniteAwaiter<TcpSocketSendPoller> asend_more(std::string_view v) const noexcept {
+      return {__f, v, MSG_MORE};
+    }
+    asio::InfiniteAwaiter<TcpSocketSendVecPoller> asend_vec(
+      std::span<const std::string_view> parts
+    ) const noexcept {
+      return {__f, parts};
+    }
+    asio::InfiniteAwaiter<DeadlinePoller<TcpSocketSendPoller>> asend(
       std::string_view v, std::chrono::milliseconds timeout
     ) const noexcept {
       return {timeout, __f, v};
@@ -104,34 +523,86 @@ namespace jowi::io {
     asio::InfiniteAwaiter<TcpSocketRecvPoller<Buffer>> arecv(Buffer &buf) const noexcept {
       return {__f, buf};
     }
-    template <WritableBuffer Buffer, class clock_type = std::chrono::steady_clock>
-    asio::TimedAwaiter<TcpSocketRecvPoller<Buffer>, clock_type> arecv(
+    asio::InfiniteAwaiter<TcpSocketSendFdsPoller> asend_fds(
+      std::string_view payload, std::span<const int> fds
+    ) const noexcept
+      requires(std::same_as<Addr, LocalAddress>)
+    {
+      return {__f, payload, fds};
+    }
+    template <WritableBuffer Buffer>
+    asio::InfiniteAwaiter<TcpSocketRecvFdsPoller<Buffer>> arecv_fds(
+      Buffer &buf, std::vector<FileDescriptor> &out
+    ) const noexcept
+      requires(std::same_as<Addr, LocalAddress>)
+    {
+      return {__f, buf, out};
+    }
+    template <WritableBuffer Buffer>
+    asio::InfiniteAwaiter<DeadlinePoller<TcpSocketRecvPoller<Buffer>>> arecv(
       Buffer &buf, std::chrono::milliseconds timeout
     ) const noexcept {
       return {timeout, __f, buf};
     }
   };
 
+  /**
+   * @brief accepts a pending connection. The accepted socket is created non-blocking and
+   * close-on-exec atomically through `accept4`, saving the `fcntl` round trips.
+   */
+  template <NetAddress Addr>
+  std::expected<TcpSocket<Addr>, IoError> sys_accept(const FileDescriptor &f) noexcept {
+    auto addr = Addr::empty();
+    auto [raw_addr, len] = addr.sys_addr();
+    int flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    return sys_io_call(IoOp::ACCEPT, f.get_or(-1), 0, ::accept4, raw_addr, &len, flags)
+      .transform(FileDescriptor::manage_default)
+      .transform([&](FileDescriptor f) { return TcpSocket{addr, std::move(f)}; });
+  }
+
   template <NetAddress Addr> struct TcpAcceptPoller {
     const FileDescriptor &f;
 
     using ValueType = std::expected<TcpSocket<Addr>, IoError>;
 
     std::optional<ValueType> poll() const noexcept {
-      auto addr = Addr::empty();
-      auto [raw_addr, len] = addr.sys_addr();
-      std::optional<ValueType> res =
-        sys_call(::accept, f.get_or(-1), raw_addr, &len)
-          .transform(FileDescriptor::manage_default)
-          .transform([&](FileDescriptor f) { return TcpSocket{addr, std::move(f)}; });
-      if (!res->has_value() &&
-          (res->error().err_code() == EAGAIN || res->error().err_code() == EWOULDBLOCK)) {
-        res.reset();
-      }
+      ValueType res = sys_accept<Addr>(f);
+      if (!res && res.error().is_would_block()) return std::nullopt;
       return res;
     }
   };
 
+  /*
+   * Drains up to max_count pending connections per readiness event. Connections that were aborted
+   * by the peer while waiting in the backlog are skipped. Any other error is returned as is when
+   * nothing has been accepted yet, otherwise the batch is returned and the error will surface on
+   * the next poll if it persists.
+   */
+  template <NetAddress Addr> struct TcpAcceptBatchPoller {
+    const FileDescriptor &f;
+    size_t max_count;
+
+    using ValueType = std::expected<std::vector<TcpSocket<Addr>>, IoError>;
+
+    std::optional<ValueType> poll() const noexcept {
+      std::vector<TcpSocket<Addr>> batch;
+      while (batch.size() < max_count) {
+        auto res = sys_accept<Addr>(f);
+        if (res) {
+          batch.emplace_back(std::move(res).value());
+          continue;
+        }
+        int err_code = res.error().err_code();
+        if (err_code == ECONNABORTED || err_code == EINTR) continue;
+        if (res.error().is_would_block()) break;
+        if (batch.empty()) return std::unexpected{res.error()};
+        break;
+      }
+      if (batch.empty()) return std::nullopt;
+      return std::move(batch);
+    }
+  };
+
   export template <NetAddress Addr> struct TcpListener {
   private:
     Addr __addr;
@@ -146,26 +617,60 @@ namespace jowi::io {
     asio::InfiniteAwaiter<TcpAcceptPoller<Addr>> aaccept() const noexcept {
       return {__f};
     }
-    asio::TimedAwaiter<TcpAcceptPoller<Addr>> aaccept(
+    asio::InfiniteAwaiter<DeadlinePoller<TcpAcceptPoller<Addr>>> aaccept(
       std::chrono::milliseconds timeout
     ) const noexcept {
       return {timeout, __f};
     }
 
+    /*
+     * accepts up to max_count connections that are already pending. nullopt is returned when there
+     * is no pending connection.
+     */
+    std::optional<std::expected<std::vector<TcpSocket<Addr>>, IoError>> accept_batch(
+      size_t max_count
+    ) const noexcept {
+      return TcpAcceptBatchPoller<Addr>{__f, max_count}.poll();
+    }
+    asio::InfiniteAwaiter<TcpAcceptBatchPoller<Addr>> aaccept_batch(
+      size_t max_count
+    ) const noexcept {
+      return {__f, max_count};
+    }
+    asio::InfiniteAwaiter<DeadlinePoller<TcpAcceptBatchPoller<Addr>>> aaccept_batch(
+      size_t max_count, std::chrono::milliseconds timeout
+    ) const noexcept {
+      return {timeout, __f, max_count};
+    }
+
+    /*
+     * only surface connections once data has arrived (TCP_DEFER_ACCEPT). timeout is the amount of
+     * time the kernel waits for the first payload before completing the connection anyway.
+     */
+    std::expected<void, IoError> defer_accept(std::chrono::seconds timeout) const noexcept {
+      return SocketOptions{}.defer_accept(timeout).apply(__f);
+    }
+
     const Addr &addr() const noexcept {
       return __addr;
     }
     auto native_handle() const noexcept {
       return __f.get_or(-1);
     }
+    std::expected<void, IoError> set_options(const SocketOptions &opts) const noexcept {
+      return opts.apply(__f);
+    }
 
-    static std::expected<TcpListener, IoError> listen(const Addr &addr, int backlog) {
+    static std::expected<TcpListener, IoError> listen(
+      const Addr &addr, int backlog, const SocketOptions &opts = SocketOptions{}
+    ) {
       auto [raw_addr, len] = addr.sys_addr();
       return sys_call(socket, Addr::addr_family(), SOCK_STREAM, 0)
         .transform(FileDescriptor::manage_default)
         .and_then(sys_fcntl_nonblock)
         .and_then([&](FileDescriptor f) {
-          return sys_call_void(bind, f.get_or(-1), raw_addr, len)
+          return opts.apply(f)
+            .and_then([&]() { return sys_call_void(bind, f.get_or(-1), raw_addr, len); })
             .and_then([&]() { return sys_call_void(::listen, f.get_or(-1), backlog); })
             .transform(FileDescriptorMover{std::move(f)});
         })
@@ -175,10 +680,12 @@ namespace jowi::io {
 
   template <NetAddress Addr> struct TcpConnectPoller {
     const Addr &addr;
+    SocketOptions opts;
     std::optional<FileDescriptor> fd = std::nullopt;
     bool conn_before = false;
 
-    TcpConnectPoller(const Addr &addr) : addr{addr} {}
+    TcpConnectPoller(const Addr &addr, const SocketOptions &opts = SocketOptions{}) :
+      addr{addr}, opts{opts} {}
 
     using ValueType = std::expected<TcpSocket<Addr>, IoError>;
 
@@ -186,7 +693,10 @@ namespace jowi::io {
       if (!fd) {
         auto sock_res = sys_call(socket, Addr::addr_family(), SOCK_STREAM, 0)
                           .transform(FileDescriptor::manage_default)
-                          .and_then(sys_fcntl_nonblock);
+                          .and_then(sys_fcntl_nonblock)
+                          .and_then([&](FileDescriptor f) {
+                            return opts.apply(f).transform(FileDescriptorMover{std::move(f)});
+                          });
         if (!sock_res) {
           return std::unexpected{sock_res.error()};
         }
@@ -211,8 +721,8 @@ namespace jowi::io {
       if (!is_writable.value()) {
         return std::nullopt;
       }
-      socklen_t len = 0;
       int sock_err = 0;
+      socklen_t len = sizeof(sock_err);
       auto res = sys_call_void(
         getsockopt, fd->get_or(-1), SOL_SOCKET, SO_ERROR, static_cast<void *>(&sock_err), &len
       );
@@ -226,30 +736,40 @@ namespace jowi::io {
     }
   };
   export template <NetAddress Addr>
-  std::expected<TcpListener<Addr>, IoError> create_tcp_listener(const Addr &addr, int backlog) {
-    return TcpListener<std::decay_t<decltype(addr)>>::listen(addr, backlog);
+  std::expected<TcpListener<Addr>, IoError> create_tcp_listener(
+    const Addr &addr, int backlog, const SocketOptions &opts = SocketOptions{}
+  ) {
+    return TcpListener<std::decay_t<decltype(addr)>>::listen(addr, backlog, opts);
   }
 
   export template <NetAddress Addr>
-  std::expected<TcpSocket<Addr>, IoError> tcp_connect(const Addr &addr) {
+  std::expected<TcpSocket<Addr>, IoError> tcp_connect(
+    const Addr &addr, const SocketOptions &opts = SocketOptions{}
+  ) {
     auto [raw_addr, len] = addr.sys_addr();
     return sys_call(socket, Addr::addr_family(), SOCK_STREAM, 0)
       .transform(FileDescriptor::manage_default)
       .and_then([&](FileDescriptor f) {
-        return sys_call_void(connect, f.get_or(-1), raw_addr, len)
+        return opts.apply(f)
+          .and_then([&]() {
+            return sys_io_call(IoOp::CONNECT, f.get_or(-1), 0, connect, raw_addr, len)
+              .transform([](int) {});
+          })
           .transform(FileDescriptorMover{std::move(f)});
       })
       .transform([&](FileDescriptor f) { return TcpSocket{addr, std::move(f)}; });
   }
   export template <NetAddress Addr>
-  asio::InfiniteAwaiter<TcpConnectPoller<Addr>> atcp_connect(const Addr &addr) {
-    return {addr};
+  asio::InfiniteAwaiter<TcpConnectPoller<Addr>> atcp_connect(
+    const Addr &addr, const SocketOptions &opts = SocketOptions{}
+  ) {
+    return {addr, opts};
   }
-  export template <NetAddress Addr, class clock_type = std::chrono::steady_clock>
-  asio::TimedAwaiter<TcpConnectPoller<Addr>, clock_type> atcp_connect(
-    const Addr &addr, std::chrono::milliseconds timeout
+  export template <NetAddress Addr>
+  asio::InfiniteAwaiter<DeadlinePoller<TcpConnectPoller<Addr>>> atcp_connect(
+    const Addr &addr, std::chrono::milliseconds timeout, const SocketOptions &opts = SocketOptions{}
   ) {
-    return {timeout, addr};
+    return {timeout, addr, opts};
   }
 
   // UDP Section
@@ -261,7 +781,10 @@ namespace jowi::io {
 
     std::optional<ValueType> poll() const noexcept {
       auto [raw_addr, len] = addr.sys_addr();
-      std::optional<ValueType> res = sys_call(
+      return sys_io_poll_call(
+        IoOp::SEND,
+        f.get_or(-1),
+        payload.length(),
         sendto,
         static_cast<const void *>(payload.data()),
         payload.length(),
@@ -269,11 +792,6 @@ namespace jowi::io {
         raw_addr,
         len
       );
-      if (!(res->has_value()) &&
-          (res->error().err_code() == EAGAIN || res->error().err_code() == EWOULDBLOCK)) {
-        res.reset();
-      }
-      return res;
     }
   };
 
@@ -284,21 +802,30 @@ namespace jowi::io {
     std::optional<ValueType> poll() const noexcept {
       auto addr = Addr::empty();
       auto [raw_addr, len] = addr.sys_addr();
-      std::optional<ValueType> res =
-        sys_call(
-          recvfrom, f.get_or(-1), buf.write_beg(), buf.writable_size(), MSG_DONTWAIT, raw_addr, &len
-        )
-          .transform([&](auto write_count) {
-            buf.mark_write(write_count);
-            return addr;
-          });
-      if (!(res->has_value()) &&
-          (res->error().err_code() == EAGAIN || res->error().err_code() == EWOULDBLOCK)) {
-        res.reset();
-      }
-      return res;
+      size_t size = buf.writable_size();
+      auto res = sys_io_poll_call(
+        IoOp::RECV,
+        f.get_or(-1),
+        size,
+        recvfrom,
+        buf.write_beg(),
+        size,
+        MSG_DONTWAIT,
+        raw_addr,
+        &len
+      );
+      return res.transform([&](auto recv_res) {
+        return recv_res.transform([&](auto write_count) {
+          buf.mark_write(write_count);
+          return addr;
+        });
+      });
     }
   };
+  export template <NetAddress Addr> struct UdpTimestampedRecv {
+    Addr addr;
+    std::optional<NetTimestamp> at;
+  };
   export template <NetAddress Addr> struct UdpSocket {
   private:
     FileDescriptor __f;
@@ -312,8 +839,17 @@ namespace jowi::io {
       auto addr = Addr::empty();
       auto [raw_addr, len] = addr.sys_addr();
       auto flags = non_blocking ? MSG_DONTWAIT : 0;
-      return sys_call(
-               recvfrom, __f.get_or(-1), buf.write_beg(), buf.writable_size(), flags, raw_addr, &len
+      size_t size = buf.writable_size();
+      return sys_io_call(
+               IoOp::RECV,
+               __f.get_or(-1),
+               size,
+               recvfrom,
+               buf.write_beg(),
+               size,
+               flags,
+               raw_addr,
+               &len
       )
         .transform([&](auto write_count) {
           buf.mark_write(write_count);
@@ -326,9 +862,11 @@ namespace jowi::io {
     ) {
       auto [raw_addr, len] = addr.sys_addr();
       auto flags = non_blocking ? MSG_DONTWAIT : 0;
-      return sys_call(
-        sendto,
+      return sys_io_call(
+        IoOp::SEND,
         __f.get_or(-1),
+        data.length(),
+        sendto,
         static_cast<const void *>(data.data()),
         data.length(),
         flags,
@@ -337,6 +875,34 @@ namespace jowi::io {
       );
     }
 
+    /*
+     * kernel software timestamps, see `TcpSocket::enable_timestamps`. Transmit timestamps are
+     * numbered by datagram.
+     */
+    std::expected<void, IoError> enable_timestamps() const noexcept {
+      return sys_enable_timestamping(__f);
+    }
+    std::expected<UdpTimestampedRecv<Addr>, IoError> recv_timestamped(
+      WritableBuffer auto &buf, bool non_blocking = true
+    ) const noexcept {
+      auto addr = Addr::empty();
+      auto [raw_addr, len] = addr.sys_addr();
+      return sys_recv_timestamped(__f, buf, non_blocking ? MSG_DONTWAIT : 0, raw_addr, &len)
+        .transform([&](std::optional<NetTimestamp> at) {
+          return UdpTimestampedRecv<Addr>{addr, at};
+        });
+    }
+    std::expected<size_t, IoError> tx_timestamps(std::vector<TxTimestamp> &out) const noexcept {
+      return sys_read_tx_timestamps(__f, out);
+    }
+
+    auto native_handle() const noexcept {
+      return __f.get_or(-1);
+    }
+    std::expected<void, IoError> set_options(const SocketOptions &opts) const noexcept {
+      return opts.apply(__f);
+    }
+
     /*
      * asynchronous execution
      */
@@ -345,8 +911,7 @@ namespace jowi::io {
     ) const noexcept {
       return {__f, v, addr};
     }
-    template <class clock_type = std::chrono::steady_clock>
-    asio::TimedAwaiter<UdpSocketSendPoller<Addr>> asend(
+    asio::InfiniteAwaiter<DeadlinePoller<UdpSocketSendPoller<Addr>>> asend(
       std::string_view v, const Addr &addr, std::chrono::milliseconds timeout
     ) const noexcept {
       return {timeout, __f, v, addr};
@@ -355,8 +920,8 @@ namespace jowi::io {
     asio::InfiniteAwaiter<UdpSocketRecvPoller<Addr, Buffer>> arecv(Buffer &buf) const noexcept {
       return {__f, buf};
     }
-    template <WritableBuffer Buffer, class clock_type = std::chrono::steady_clock>
-    asio::TimedAwaiter<UdpSocketRecvPoller<Addr, Buffer>, clock_type> arecv(
+    template <WritableBuffer Buffer>
+    asio::InfiniteAwaiter<DeadlinePoller<UdpSocketRecvPoller<Addr, Buffer>>> arecv(
       Buffer &buf, std::chrono::milliseconds timeout
     ) const noexcept {
       return {timeout, __f, buf};
@@ -365,12 +930,15 @@ namespace jowi::io {
     static UdpSocket from_fd(FileDescriptor f) {
       return UdpSocket{std::move(f)};
     }
-    static std::expected<UdpSocket, IoError> bind(const Addr &addr) {
+    static std::expected<UdpSocket, IoError> bind(
+      const Addr &addr, const SocketOptions &opts = SocketOptions{}
+    ) {
       auto [raw_addr, len] = addr.sys_addr();
       return sys_call(::socket, Addr::addr_family(), SOCK_DGRAM, 0)
         .transform(FileDescriptor::manage_default)
         .and_then([&](auto f) {
-          return sys_call_void(::bind, f.get_or(-1), raw_addr, len)
+          return opts.apply(f)
+            .and_then([&]() { return sys_call_void(::bind, f.get_or(-1), raw_addr, len); })
             .transform(FileDescriptorMover{std::move(f)});
         })
         .transform(UdpSocket<Addr>::from_fd);
@@ -383,8 +951,10 @@ namespace jowi::io {
   };
 
   export template <NetAddress Addr>
-  std::expected<UdpSocket<Addr>, IoError> create_udp_bind(const Addr &addr) {
-    return UdpSocket<Addr>::bind(addr);
+  std::expected<UdpSocket<Addr>, IoError> create_udp_bind(
+    const Addr &addr, const SocketOptions &opts = SocketOptions{}
+  ) {
+    return UdpSocket<Addr>::bind(addr, opts);
   }
 
   export template <NetAddress Addr> std::expected<UdpSocket<Addr>, IoError> create_udp_socket() {
@@ -399,22 +969,22 @@ namespace jowi::io {
   template struct UdpSocket<LocalAddress>;
 
   template std::expected<TcpListener<Ipv4Address>, IoError> create_tcp_listener<Ipv4Address>(
-    const Ipv4Address &, int
+    const Ipv4Address &, int, const SocketOptions &
   );
   template std::expected<TcpListener<LocalAddress>, IoError> create_tcp_listener<LocalAddress>(
-    const LocalAddress &, int
+    const LocalAddress &, int, const SocketOptions &
   );
   template std::expected<TcpSocket<Ipv4Address>, IoError> tcp_connect<Ipv4Address>(
-    const Ipv4Address &
+    const Ipv4Address &, const SocketOptions &
   );
   template std::expected<TcpSocket<LocalAddress>, IoError> tcp_connect<LocalAddress>(
-    const LocalAddress &
+    const LocalAddress &, const SocketOptions &
   );
   template std::expected<UdpSocket<Ipv4Address>, IoError> create_udp_bind<Ipv4Address>(
-    const Ipv4Address &
+    const Ipv4Address &, const SocketOptions &
   );
   template std::expected<UdpSocket<LocalAddress>, IoError> create_udp_bind<LocalAddress>(
-    const LocalAddress &
+    const LocalAddress &, const SocketOptions &
   );
   template std::expected<UdpSocket<Ipv4Address>, IoError> create_udp_socket<Ipv4Address>();
   template std::expected<UdpSocket<LocalAddress>, IoError> create_udp_socket<LocalAddress>();
@@ -0,0 +1,166 @@
+module;
+#include <sys/poll.h>
+#include <atomic>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <utility>
+export module jowi.io:notifier;
+import jowi.asio;
+import :error;
+import :fd_type;
+import :sys_call;
+
+/**
+ * @file unix/notifier.cc
+ * @brief Hands values from any thread to the thread owning a reactor: a lock-free queue with an
+ * eventfd that is only written when the queue turns non-empty.
+ */
+
+namespace jowi::io {
+  export template <class T> struct EventNotifier;
+
+  /**
+   * @brief Completes with the next value handed to the notifier.
+   */
+  export template <class T> struct EventNotifierPoller {
+    EventNotifier<T> &notifier;
+
+    using ValueType = T;
+    std::optional<ValueType> poll() noexcept {
+      return notifier.try_pop();
+    }
+  };
+
+  /**
+   * @brief Multiple producer, single consumer handoff. Producers `push` from any thread, the
+   * thread owning the notifier pops in push order (per producer) with `try_pop`, `wait` or
+   * `apop`.
+   *
+   * Producers push onto a lock-free stack, the consumer takes the whole stack in one exchange and
+   * reverses it. Only a push finding the stack empty writes the eventfd, so a burst costs at most
+   * one write however many values it carries. A reactor waits for `native_handle()` to be
+   * readable, calls `on_notify()` and then pops until the queue is empty.
+   */
+  export template <class T> struct EventNotifier {
+  private:
+    struct Node {
+      T value;
+      Node *next;
+    };
+
+    std::atomic<Node *> __head;
+    // consumer side: values taken from the stack, in push order.
+    Node *__batch;
+    std::atomic<uint64_t> __notifications;
+    FileDescriptor __notify_fd;
+
+    EventNotifier(FileDescriptor fd) noexcept :
+      __head{nullptr}, __batch{nullptr}, __notifications{0}, __notify_fd{std::move(fd)} {}
+
+    static void __free(Node *n) noexcept {
+      while (n != nullptr) {
+        delete std::exchange(n, n->next);
+      }
+    }
+
+  public:
+    EventNotifier(const EventNotifier &) = delete;
+    EventNotifier &operator=(const EventNotifier &) = delete;
+    ~EventNotifier() {
+      __free(__batch);
+      __free(__head.load(std::memory_order_acquire));
+    }
+
+    /**
+     * @brief Creates a notifier, heap allocated so that producers can keep its address.
+     * @return Notifier or IO error.
+     */
+    static std::expected<std::unique_ptr<EventNotifier>, IoError> create() noexcept {
+      return sys_eventfd().transform([](FileDescriptor fd) {
+        return std::unique_ptr<EventNotifier>{new EventNotifier{std::move(fd)}};
+      });
+    }
+
+    /**
+     * @brief Hands a value to the consumer, from any thread.
+     * @return True when this push woke the consumer, i.e. the queue was empty.
+     */
+    bool push(T value) noexcept {
+      auto *n = new Node{std::move(value), nullptr};
+      Node *prev = __head.load(std::memory_order_relaxed);
+      // n belongs to the consumer once published, only prev is looked at afterwards.
+      do {
+        n->next = prev;
+      } while (!__head.compare_exchange_weak(
+        prev, n, std::memory_order_release, std::memory_order_relaxed
+      ));
+      if (prev != nullptr) return false;
+      __notifications.fetch_add(1, std::memory_order_relaxed);
+      (void)sys_eventfd_write(__notify_fd, 1);
+      return true;
+    }
+
+    /**
+     * @brief Next value without blocking, consumer thread only.
+     * @return The value or nullopt when the queue is empty.
+     */
+    std::optional<T> try_pop() noexcept {
+      if (__batch == nullptr) {
+        Node *n = __head.exchange(nullptr, std::memory_order_acquire);
+        // the stack holds the newest value first.
+        while (n != nullptr) {
+          Node *next = n->next;
+          n->next = __batch;
+          __batch = n;
+          n = next;
+        }
+        if (__batch == nullptr) return std::nullopt;
+      }
+      Node *n = std::exchange(__batch, __batch->next);
+      std::optional<T> value{std::move(n->value)};
+      delete n;
+      return value;
+    }
+    /**
+     * @brief Next value, blocking until one is pushed or the timeout passes.
+     * @param timeout_ms Timeout in milliseconds, -1 waits forever.
+     * @return The value, nullopt on timeout, or IO error.
+     */
+    std::expected<std::optional<T>, IoError> wait(int timeout_ms = -1) noexcept {
+      while (true) {
+        if (auto v = try_pop()) return v;
+        // a push after the eventfd is drained finds the stack empty and writes it again.
+        if (auto res = on_notify(); !res) return std::unexpected{res.error()};
+        if (__head.load(std::memory_order_acquire) != nullptr) continue;
+        auto revents = sys_poll_wait(__notify_fd, POLLIN, timeout_ms);
+        if (!revents) return std::unexpected{revents.error()};
+        if (*revents == 0) return std::nullopt;
+      }
+    }
+    asio::InfiniteAwaiter<EventNotifierPoller<T>> apop() noexcept {
+      return {*this};
+    }
+
+    /**
+     * @brief Eventfd readable whenever a push found the queue empty since the last `on_notify()`.
+     */
+    int native_handle() const noexcept {
+      return __notify_fd.get_or(-1);
+    }
+    /**
+     * @brief Consumes the wake up before the queue is popped.
+     * @return Amount of wake ups since the last call or IO error.
+     */
+    std::expected<uint64_t, IoError> on_notify() noexcept {
+      return sys_eventfd_read(__notify_fd);
+    }
+    /**
+     * @brief Eventfd writes issued so far, at most one per burst of pushes.
+     */
+    uint64_t notifications() const noexcept {
+      return __notifications.load(std::memory_order_relaxed);
+    }
+  };
+}
@@ -0,0 +1,182 @@
+module;
+#include <sys/poll.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+export module jowi.io:offload;
+import jowi.asio;
+import :error;
+import :fd_type;
+import :sys_call;
+
+/**
+ * @file unix/offload.cc
+ * @brief Worker pool running blocking file syscalls away from the thread driving the coroutines.
+ */
+
+namespace jowi::io {
+  /*
+   * shared between the worker running a job and the poller awaiting it, so that either side may
+   * go away first.
+   */
+  template <class T> struct OffloadState {
+    std::atomic<bool> done{false};
+    std::optional<T> result{std::nullopt};
+  };
+
+  /**
+   * @brief Completes once the offloaded job has run on a worker. A poll only checks a flag, it is
+   * the pool's eventfd that tells when polling is worth it.
+   */
+  export template <class T> struct OffloadPoller {
+    std::shared_ptr<OffloadState<T>> state;
+
+    using ValueType = T;
+
+    std::optional<ValueType> poll() noexcept {
+      if (!state->done.load(std::memory_order_acquire)) return std::nullopt;
+      return std::move(state->result);
+    }
+  };
+
+  /**
+   * @brief Bounded pool of worker threads for blocking syscalls. Jobs start as soon as they are
+   * submitted and every completion is signalled on an eventfd, a reactor waits for
+   * `native_handle()` to be readable, calls `on_notify()` and then polls its pending awaiters.
+   *
+   * The awaiters do not register for that wake up themselves. Resumed from a loop that polls them
+   * without waiting on `native_handle()` (or `wait()`), they spin until the job is done.
+   *
+   * Jobs may reference buffers and files owned by the caller, those have to outlive the job even
+   * when the awaiter is dropped early. The destructor runs every queued job before joining.
+   */
+  export struct OffloadPool {
+  private:
+    std::mutex __mtx;
+    std::condition_variable __cv;
+    std::deque<std::function<void()>> __jobs;
+    std::vector<std::thread> __workers;
+    FileDescriptor __notify_fd;
+    bool __stopping;
+
+    OffloadPool(FileDescriptor notify_fd) noexcept :
+      __mtx{}, __cv{}, __jobs{}, __workers{}, __notify_fd{std::move(notify_fd)},
+      __stopping{false} {}
+
+    void __work() noexcept {
+      while (true) {
+        std::function<void()> job;
+        {
+          std::unique_lock lck{__mtx};
+          __cv.wait(lck, [&]() { return __stopping || !__jobs.empty(); });
+          if (__jobs.empty()) return;
+          job = std::move(__jobs.front());
+          __jobs.pop_front();
+        }
+        job();
+        (void)sys_eventfd_write(__notify_fd, 1);
+      }
+    }
+
+  public:
+    OffloadPool(const OffloadPool &) = delete;
+    OffloadPool &operator=(const OffloadPool &) = delete;
+    ~OffloadPool() noexcept {
+      {
+        std::lock_guard lck{__mtx};
+        __stopping = true;
+      }
+      __cv.notify_all();
+      for (auto &w : __workers) {
+        w.join();
+      }
+    }
+
+    /**
+     * @brief Creates a pool with a fixed amount of workers.
+     * @param worker_count Amount of threads, at least one is started.
+     * @return Heap allocated pool, its address is shared with the workers, or IO error.
+     */
+    static std::expected<std::unique_ptr<OffloadPool>, IoError> create(
+      size_t worker_count = 4
+    ) noexcept {
+      return sys_eventfd().transform([&](FileDescriptor fd) {
+        auto pool = std::unique_ptr<OffloadPool>{new OffloadPool{std::move(fd)}};
+        size_t count = std::max<size_t>(worker_count, 1);
+        pool->__workers.reserve(count);
+        for (size_t i = 0; i < count; i += 1) {
+          pool->__workers.emplace_back([p = pool.get()]() { p->__work(); });
+        }
+        return pool;
+      });
+    }
+
+    /**
+     * @brief Runs f on a worker, for callers polling the result themselves.
+     * @param f Callable returning the value the poller completes with.
+     * @return Poller completing with the result of f.
+     */
+    template <class F> requires(std::invocable<F>)
+    OffloadPoller<std::invoke_result_t<F>> schedule(F &&f) noexcept {
+      using T = std::invoke_result_t<F>;
+      auto state = std::make_shared<OffloadState<T>>();
+      {
+        std::lock_guard lck{__mtx};
+        __jobs.emplace_back([state, f = std::forward<F>(f)]() mutable {
+          state->result.emplace(f());
+          state->done.store(true, std::memory_order_release);
+        });
+      }
+      __cv.notify_one();
+      return {std::move(state)};
+    }
+    /**
+     * @brief Runs f on a worker. The awaiter has to be resumed from a reactor waiting on
+     * `native_handle()`, see the pool.
+     * @param f Callable returning the value the awaiter completes with.
+     * @return Awaiter completing with the result of f.
+     */
+    template <class F> requires(std::invocable<F>)
+    asio::InfiniteAwaiter<OffloadPoller<std::invoke_result_t<F>>> submit(F &&f) noexcept {
+      return {schedule(std::forward<F>(f))};
+    }
+
+    /**
+     * @brief Eventfd readable whenever a job completed since the last `on_notify()`.
+     */
+    int native_handle() const noexcept {
+      return __notify_fd.get_or(-1);
+    }
+    /**
+     * @brief Consumes the completion notifications.
+     * @return Amount of jobs completed since the last call or IO error.
+     */
+    std::expected<uint64_t, IoError> on_notify() noexcept {
+      return sys_eventfd_read(__notify_fd);
+    }
+    /**
+     * @brief Blocks until a job completes or the timeout passes, then consumes the notifications.
+     * @param timeout_ms Timeout in milliseconds, -1 waits forever.
+     * @return Amount of jobs completed or IO error.
+     */
+    std::expected<uint64_t, IoError> wait(int timeout_ms = -1) noexcept {
+      return sys_poll_wait(__notify_fd, POLLIN, timeout_ms).and_then([&](short) {
+        return on_notify();
+      });
+    }
+    size_t worker_count() const noexcept {
+      return __workers.size();
+    }
+  };
+}
@@ -12,6 +12,7 @@ import jowi.asio;
 import :fd_type;
 import :error;
 import :sys_call;
+import :timer_wheel;
 
 /**
  * @file unix/pipe.cc
@@ -46,7 +47,7 @@ namespace jowi::io {
     }
 
     template <WritableBuffer buf_type>
-    asio::TimedAwaiter<SysReadPoller<buf_type>> aread(
+    asio::InfiniteAwaiter<DeadlinePoller<SysReadPoller<buf_type>>> aread(
       buf_type &buf, std::chrono::milliseconds dur
     ) noexcept {
       return {dur, __f, buf};
@@ -81,7 +82,7 @@ namespace jowi::io {
     asio::InfiniteAwaiter<SysWritePoller> awrite(std::string_view v) noexcept {
       return {__f, v};
     }
-    asio::TimedAwaiter<SysWritePoller> awrite(
+    asio::InfiniteAwaiter<DeadlinePoller<SysWritePoller>> awrite(
       std::string_view v, std::chrono::milliseconds dur
     ) noexcept {
       return {dur, __f, v};
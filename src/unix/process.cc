@@ -0,0 +1,404 @@
+module;
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <expected>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+export module jowi.io:process;
+import jowi.asio;
+import :error;
+import :fd_type;
+import :pipe;
+import :sys_call;
+
+/**
+ * @file unix/process.cc
+ * @brief Subprocesses spawned with posix_spawn, standard streams wired to pipes.
+ */
+
+extern char **environ;
+
+namespace jowi::io {
+  namespace fs = std::filesystem;
+
+  /**
+   * @brief How a standard stream of the child is set up.
+   */
+  export enum struct StdioMode { INHERIT, PIPE, NUL };
+
+  /**
+   * @brief How a child terminated.
+   */
+  export struct ExitStatus {
+    // exit code, -1 when the child was killed by a signal.
+    int code;
+    // terminating signal, 0 when the child exited.
+    int signal;
+
+    bool success() const noexcept {
+      return signal == 0 && code == 0;
+    }
+  };
+
+  ExitStatus exit_status_from(const siginfo_t &info) noexcept {
+    if (info.si_code == CLD_EXITED) return ExitStatus{info.si_status, 0};
+    return ExitStatus{-1, info.si_status};
+  }
+
+  export struct Child;
+
+  /**
+   * @brief Completes once the child has exited and has been reaped.
+   */
+  export struct ChildExitPoller {
+    Child &child;
+
+    using ValueType = std::expected<ExitStatus, IoError>;
+
+    std::optional<ValueType> poll() noexcept;
+  };
+
+  /**
+   * @brief Spawned process. The child is not reaped on destruction, call `wait`, `try_wait` or
+   * await `await_exit` so it does not linger as a zombie.
+   */
+  export struct Child {
+  private:
+    pid_t __pid;
+    std::optional<FileDescriptor> __pidfd;
+    std::optional<ExitStatus> __status;
+    std::optional<WriterPipe> __in;
+    std::optional<ReaderPipe> __out;
+    std::optional<ReaderPipe> __err;
+
+    Child(pid_t pid, std::optional<FileDescriptor> pidfd) noexcept :
+      __pid{pid}, __pidfd{std::move(pidfd)}, __status{std::nullopt}, __in{std::nullopt},
+      __out{std::nullopt}, __err{std::nullopt} {}
+    friend struct Command;
+
+    std::expected<std::optional<ExitStatus>, IoError> __reap(bool block) noexcept {
+      if (__status) return __status;
+      return sys_wait_child(__pid, block).transform([&](std::optional<siginfo_t> info) {
+        if (info) __status.emplace(exit_status_from(*info));
+        return __status;
+      });
+    }
+
+  public:
+    pid_t pid() const noexcept {
+      return __pid;
+    }
+    /**
+     * @brief Write end of the child's stdin, set when spawned with `StdioMode::PIPE`.
+     */
+    std::optional<WriterPipe> &in() noexcept {
+      return __in;
+    }
+    /**
+     * @brief Read end of the child's stdout, set when spawned with `StdioMode::PIPE`.
+     */
+    std::optional<ReaderPipe> &out() noexcept {
+      return __out;
+    }
+    /**
+     * @brief Read end of the child's stderr, set when spawned with `StdioMode::PIPE`.
+     */
+    std::optional<ReaderPipe> &err() noexcept {
+      return __err;
+    }
+
+    /**
+     * @brief Closes the child's stdin, so it sees end of file, and blocks until it exits.
+     * @return Exit status or IO error.
+     */
+    std::expected<ExitStatus, IoError> wait() noexcept {
+      __in.reset();
+      return __reap(true).transform([](std::optional<ExitStatus> status) { return *status; });
+    }
+    /**
+     * @brief Reaps the child if it has exited.
+     * @return Exit status, nullopt while the child runs, or IO error.
+     */
+    std::expected<std::optional<ExitStatus>, IoError> try_wait() noexcept {
+      return __reap(false);
+    }
+    /**
+     * @brief Awaits the exit of the child. A reactor waits for `native_handle()` to become
+     * readable before polling.
+     * @return Awaiter completing with the exit status.
+     */
+    asio::InfiniteAwaiter<ChildExitPoller> await_exit() noexcept {
+      return {*this};
+    }
+    /**
+     * @brief Sends a signal through the pidfd, so a recycled pid can never be hit.
+     * @param signal Signal number.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> kill(int signal = SIGKILL) noexcept {
+      if (__status) return {};
+      if (__pidfd) {
+        return sys_pidfd_signal(*__pidfd, signal);
+      }
+      return sys_call_void(::kill, __pid, signal);
+    }
+    /**
+     * @brief pidfd of the child, readable once it exits. -1 on kernels without pidfd.
+     */
+    int native_handle() const noexcept {
+      return __pidfd ? __pidfd->get_or(-1) : -1;
+    }
+  };
+
+  std::optional<ChildExitPoller::ValueType> ChildExitPoller::poll() noexcept {
+    auto res = child.try_wait();
+    if (!res) return std::unexpected{res.error()};
+    if (!*res) return std::nullopt;
+    return **res;
+  }
+
+  /*
+   * posix_spawn attribute and file action objects released on scope exit.
+   */
+  struct SpawnConfig {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+
+    SpawnConfig() noexcept {
+      posix_spawn_file_actions_init(&actions);
+      posix_spawnattr_init(&attr);
+    }
+    SpawnConfig(const SpawnConfig &) = delete;
+    SpawnConfig &operator=(const SpawnConfig &) = delete;
+    ~SpawnConfig() noexcept {
+      posix_spawn_file_actions_destroy(&actions);
+      posix_spawnattr_destroy(&attr);
+    }
+  };
+
+  std::expected<void, IoError> spawn_check(int res) noexcept {
+    // posix_spawn functions return the error number instead of setting errno.
+    if (res != 0) return std::unexpected{IoError::str_error(res)};
+    return {};
+  }
+
+  std::expected<void, IoError> set_non_blocking(int fd) noexcept {
+    return sys_call(::fcntl, fd, F_GETFL).and_then([&](int flags) {
+      return sys_call_void(::fcntl, fd, F_SETFL, flags | O_NONBLOCK);
+    });
+  }
+
+  /**
+   * @brief Fluent interface for spawning a subprocess. `spawn` uses `posix_spawn`, which glibc
+   * implements with `clone(CLONE_VM | CLONE_VFORK)`: the parent's page tables are never copied, so
+   * the cost does not grow with the parent's heap as it does with `fork`.
+   *
+   * The child starts with an empty signal mask and a default `SIGPIPE` disposition. Pipes are
+   * created close-on-exec and only the ends duplicated onto 0, 1 and 2 reach the child.
+   */
+  export struct Command {
+  private:
+    std::vector<std::string> __args;
+    // overrides applied on top of the environment, nullopt removes the variable.
+    std::vector<std::pair<std::string, std::optional<std::string>>> __env;
+    bool __clear_env;
+    std::optional<fs::path> __cwd;
+    StdioMode __in;
+    StdioMode __out;
+    StdioMode __err;
+    bool __non_blocking;
+
+    std::vector<std::string> __environment() const {
+      std::vector<std::string> vars;
+      if (!__clear_env) {
+        for (char **e = environ; e != nullptr && *e != nullptr; e += 1) {
+          vars.emplace_back(*e);
+        }
+      }
+      for (const auto &[key, value] : __env) {
+        std::erase_if(vars, [&](const std::string &v) {
+          return v.size() > key.size() && v.starts_with(key) && v[key.size()] == '=';
+        });
+        if (value) vars.emplace_back(key + "=" + *value);
+      }
+      return vars;
+    }
+
+    static std::expected<void, IoError> __wire(
+      SpawnConfig &conf, StdioMode mode, int target, int pipe_child_fd
+    ) noexcept {
+      switch (mode) {
+        case StdioMode::INHERIT:
+          return {};
+        case StdioMode::PIPE:
+          // dup2 onto the target clears close-on-exec for the child's copy only.
+          return spawn_check(
+            posix_spawn_file_actions_adddup2(&conf.actions, pipe_child_fd, target)
+          );
+        case StdioMode::NUL:
+          return spawn_check(posix_spawn_file_actions_addopen(
+            &conf.actions, target, "/dev/null", target == STDIN_FILENO ? O_RDONLY : O_WRONLY, 0
+          ));
+      }
+      return {};
+    }
+
+  public:
+    /**
+     * @brief Initializes a command running program, searched in PATH when it has no slash, with
+     * inherited standard streams and environment.
+     * @param program Program name or path, also passed as argv[0].
+     */
+    explicit Command(std::string program) :
+      __args{std::move(program)}, __env{}, __clear_env{false}, __cwd{std::nullopt},
+      __in{StdioMode::INHERIT}, __out{StdioMode::INHERIT}, __err{StdioMode::INHERIT},
+      __non_blocking{true} {}
+
+    Command &arg(std::string a) {
+      __args.emplace_back(std::move(a));
+      return *this;
+    }
+    Command &env(std::string key, std::string value) {
+      __env.emplace_back(std::move(key), std::move(value));
+      return *this;
+    }
+    Command &env_remove(std::string key) {
+      __env.emplace_back(std::move(key), std::nullopt);
+      return *this;
+    }
+    /**
+     * @brief Starts the child from an empty environment, only `env` variables are set.
+     */
+    Command &clear_env() noexcept {
+      __clear_env = true;
+      return *this;
+    }
+    Command &cwd(fs::path p) noexcept {
+      __cwd = std::move(p);
+      return *this;
+    }
+    Command &in(StdioMode mode) noexcept {
+      __in = mode;
+      return *this;
+    }
+    Command &out(StdioMode mode) noexcept {
+      __out = mode;
+      return *this;
+    }
+    Command &err(StdioMode mode) noexcept {
+      __err = mode;
+      return *this;
+    }
+    /**
+     * @brief Whether the parent's pipe ends are non-blocking, true by default for `aread` and
+     * `awrite`. The child's ends are always blocking.
+     */
+    Command &non_blocking(bool enabled = true) noexcept {
+      __non_blocking = enabled;
+      return *this;
+    }
+
+    /**
+     * @brief Starts the child.
+     * @return Child or IO error, including the `execve` error when the program cannot be run.
+     */
+    std::expected<Child, IoError> spawn() const {
+      SpawnConfig conf;
+      std::optional<std::pair<ReaderPipe, WriterPipe>> in_pipe;
+      std::optional<std::pair<ReaderPipe, WriterPipe>> out_pipe;
+      std::optional<std::pair<ReaderPipe, WriterPipe>> err_pipe;
+      auto make_pipe = [](StdioMode mode, auto &pipe) -> std::expected<void, IoError> {
+        if (mode != StdioMode::PIPE) return {};
+        return open_pipe(false).transform([&](auto p) { pipe.emplace(std::move(p)); });
+      };
+      auto prepared =
+        make_pipe(__in, in_pipe)
+          .and_then([&]() { return make_pipe(__out, out_pipe); })
+          .and_then([&]() { return make_pipe(__err, err_pipe); })
+          .and_then([&]() {
+            int fd = in_pipe ? in_pipe->first.native_handle() : -1;
+            return __wire(conf, __in, STDIN_FILENO, fd);
+          })
+          .and_then([&]() {
+            int fd = out_pipe ? out_pipe->second.native_handle() : -1;
+            return __wire(conf, __out, STDOUT_FILENO, fd);
+          })
+          .and_then([&]() {
+            int fd = err_pipe ? err_pipe->second.native_handle() : -1;
+            return __wire(conf, __err, STDERR_FILENO, fd);
+          })
+          .and_then([&]() -> std::expected<void, IoError> {
+            if (!__cwd) return {};
+            return spawn_check(
+              posix_spawn_file_actions_addchdir_np(&conf.actions, __cwd->c_str())
+            );
+          })
+          .and_then([&]() {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigset_t defaults;
+            sigemptyset(&defaults);
+            sigaddset(&defaults, SIGPIPE);
+            return spawn_check(posix_spawnattr_setsigmask(&conf.attr, &mask))
+              .and_then([&]() {
+                return spawn_check(posix_spawnattr_setsigdefault(&conf.attr, &defaults));
+              })
+              .and_then([&]() {
+                short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+                return spawn_check(posix_spawnattr_setflags(&conf.attr, flags));
+              });
+          });
+      if (!prepared) return std::unexpected{prepared.error()};
+
+      std::vector<char *> argv;
+      argv.reserve(__args.size() + 1);
+      for (const auto &a : __args) {
+        argv.emplace_back(const_cast<char *>(a.c_str()));
+      }
+      argv.emplace_back(nullptr);
+      std::vector<std::string> vars;
+      std::vector<char *> envp;
+      char **env_ptr = environ;
+      if (__clear_env || !__env.empty()) {
+        vars = __environment();
+        envp.reserve(vars.size() + 1);
+        for (auto &v : vars) {
+          envp.emplace_back(v.data());
+        }
+        envp.emplace_back(nullptr);
+        env_ptr = envp.data();
+      }
+
+      pid_t pid;
+      auto spawned = spawn_check(
+        posix_spawnp(&pid, argv[0], &conf.actions, &conf.attr, argv.data(), env_ptr)
+      );
+      if (!spawned) return std::unexpected{spawned.error()};
+      // without pidfd (before linux 5.3) waiting falls back to polling waitid.
+      auto pidfd = sys_pidfd_open(pid);
+      Child child{pid, pidfd ? std::optional{std::move(pidfd).value()} : std::nullopt};
+      // the child's ends close with the pipe pairs at the end of this scope.
+      if (in_pipe) child.__in.emplace(std::move(in_pipe->second));
+      if (out_pipe) child.__out.emplace(std::move(out_pipe->first));
+      if (err_pipe) child.__err.emplace(std::move(err_pipe->first));
+      if (__non_blocking) {
+        int fds[] = {
+          child.__in ? child.__in->native_handle() : -1,
+          child.__out ? child.__out->native_handle() : -1,
+          child.__err ? child.__err->native_handle() : -1
+        };
+        for (int fd : fds) {
+          if (fd != -1) (void)set_non_blocking(fd);
+        }
+      }
+      return child;
+    }
+  };
+}
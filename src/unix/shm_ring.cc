@@ -0,0 +1,467 @@
+module;
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <expected>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+export module jowi.io:shm_ring;
+import jowi.asio;
+import :error;
+import :fd_type;
+import :sys_call;
+
+/**
+ * @file unix/shm_ring.cc
+ * @brief Message ring in a memfd mapping shared between processes, one consumer and one (SPSC) or
+ * several (MPSC) producers. Producers write messages in place and consumers read them as views,
+ * so a message costs no syscall and no copy besides the producer's own write. The consumer sleeps
+ * on an eventfd and producers of a full ring on a futex, the peer only issues a wake up syscall
+ * when a sleeper announced itself.
+ *
+ * Records are an 8 byte header (length, commit and padding bits) followed by the payload, padded
+ * to 8 bytes. A record never wraps, the space left at the end of the ring is filled with a
+ * padding record instead. SPSC publishes records by advancing the tail. MPSC producers claim space
+ * with a compare and swap on the tail and publish through the header commit bit, the consumer
+ * zeroes what it releases so that stale payload bytes never read as a committed header.
+ */
+
+namespace jowi::io {
+  export enum struct ShmRingKind : uint32_t { SPSC, MPSC };
+
+  struct ShmRingHeader {
+    uint64_t magic;
+    uint64_t capacity;
+    ShmRingKind kind;
+    // bytes released by the consumer.
+    alignas(64) std::atomic<uint64_t> head;
+    // SPSC: bytes published, MPSC: bytes claimed by producers.
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> consumer_sleeping;
+    // producers waiting for space, they sleep on space_seq.
+    alignas(64) std::atomic<uint32_t> producers_sleeping;
+    std::atomic<uint32_t> space_seq;
+  };
+
+  inline constexpr uint64_t shm_ring_magic = 0x6a6f77695f73686dull;
+  // the header page precedes the data.
+  inline constexpr size_t shm_ring_data_offset = 4096;
+  inline constexpr uint64_t shm_record_committed = uint64_t{1} << 32;
+  inline constexpr uint64_t shm_record_padding = uint64_t{1} << 33;
+  inline constexpr uint64_t shm_record_len_mask = shm_record_committed - 1;
+
+  constexpr size_t shm_record_size(size_t len) noexcept {
+    return sizeof(uint64_t) + ((len + 7) & ~size_t{7});
+  }
+
+  struct ShmUnmapper {
+    size_t len;
+    void operator()(char *p) const noexcept {
+      ::munmap(p, len);
+    }
+  };
+
+  /**
+   * @brief Space claimed for one message, write up to `data.size()` bytes then `commit` it.
+   */
+  export struct ShmReservation {
+    std::span<char> data;
+    uint64_t pos;
+  };
+
+  export struct ShmRing;
+
+  export struct ShmPeekPoller {
+    ShmRing &ring;
+
+    using ValueType = std::string_view;
+    std::optional<ValueType> poll() noexcept;
+  };
+
+  /*
+   * producers are polled again by the runtime, there is no descriptor to wait on for space.
+   */
+  export struct ShmReservePoller {
+    ShmRing &ring;
+    size_t len;
+
+    using ValueType = std::expected<ShmReservation, IoError>;
+    std::optional<ValueType> poll() noexcept;
+  };
+
+  /**
+   * @brief One mapping of a ring. The creating process hands `mem_handle()` and `native_handle()`
+   * to its peer (inherited over fork or sent over a local socket), which maps the same ring with
+   * `attach`. Either mapping may produce or consume, the ring kind decides how many producers
+   * there may be.
+   */
+  export struct ShmRing {
+  private:
+    std::unique_ptr<char, ShmUnmapper> __map;
+    FileDescriptor __mem_fd;
+    // eventfd, readable once a producer woke the consumer.
+    FileDescriptor __data_fd;
+    // consumer side: size of the record returned by the last peek, 0 when none.
+    size_t __peeked;
+
+    ShmRing(
+      std::unique_ptr<char, ShmUnmapper> map, FileDescriptor mem_fd, FileDescriptor data_fd
+    ) noexcept :
+      __map{std::move(map)}, __mem_fd{std::move(mem_fd)}, __data_fd{std::move(data_fd)},
+      __peeked{0} {}
+
+    ShmRingHeader &__header() const noexcept {
+      return *std::launder(reinterpret_cast<ShmRingHeader *>(__map.get()));
+    }
+    char *__data() const noexcept {
+      return __map.get() + shm_ring_data_offset;
+    }
+    std::atomic_ref<uint64_t> __record(uint64_t pos) const noexcept {
+      auto cap = __header().capacity;
+      return std::atomic_ref<uint64_t>{*reinterpret_cast<uint64_t *>(__data() + pos % cap)};
+    }
+
+    static std::expected<std::unique_ptr<char, ShmUnmapper>, IoError> __map_fd(
+      const FileDescriptor &fd, size_t len
+    ) noexcept {
+      void *p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get_or(-1), 0);
+      if (p == MAP_FAILED) return std::unexpected{IoError::str_error(errno)};
+      return std::unique_ptr<char, ShmUnmapper>{static_cast<char *>(p), ShmUnmapper{len}};
+    }
+
+    /*
+     * the consumer sleeps on the eventfd unless data arrived once it announced itself, the Dekker
+     * pattern matched by a producer commit. False when the timeout ran out.
+     */
+    std::expected<bool, IoError> __sleep_consumer(int timeout_ms) noexcept {
+      auto &h = __header();
+      h.consumer_sleeping.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (__has_data()) {
+        h.consumer_sleeping.store(0, std::memory_order_relaxed);
+        return true;
+      }
+      auto revents = sys_poll_wait(__data_fd, POLLIN, timeout_ms);
+      h.consumer_sleeping.store(0, std::memory_order_relaxed);
+      if (!revents) return std::unexpected{revents.error()};
+      if (*revents == 0) return false;
+      return sys_eventfd_read(__data_fd).transform([](uint64_t) { return true; });
+    }
+    /*
+     * the condition under which try_reserve returns nullopt for a record of size bytes. A record
+     * that does not fit before the end of the ring first needs the padding up to it, once that is
+     * in place the record starts over with the whole ring ahead.
+     */
+    bool __is_full(uint64_t size) const noexcept {
+      auto &h = __header();
+      uint64_t t = h.tail.load(std::memory_order_relaxed);
+      uint64_t free = h.capacity - (t - h.head.load());
+      uint64_t left = h.capacity - t % h.capacity;
+      return free < (size > left ? left : size);
+    }
+    /*
+     * several producers may sleep at once, so they wait on a futex (shared between processes)
+     * which wakes them all. The eventfd would hand the wake up to only one of them.
+     */
+    std::expected<bool, IoError> __sleep_producer(size_t size, int timeout_ms) noexcept {
+      auto &h = __header();
+      uint32_t seq = h.space_seq.load(std::memory_order_acquire);
+      h.producers_sleeping.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::expected<bool, IoError> res = true;
+      if (__is_full(size)) {
+        struct timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1'000'000L};
+        long ret = ::syscall(
+          SYS_futex, &h.space_seq, FUTEX_WAIT, seq, timeout_ms < 0 ? nullptr : &ts, nullptr, 0
+        );
+        if (ret == -1 && errno == ETIMEDOUT) res = false;
+        else if (ret == -1 && errno != EAGAIN && errno != EINTR) {
+          res = std::unexpected{IoError::str_error(errno)};
+        }
+      }
+      h.producers_sleeping.fetch_sub(1, std::memory_order_relaxed);
+      return res;
+    }
+    void __wake_consumer() noexcept {
+      auto &h = __header();
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (h.consumer_sleeping.load(std::memory_order_relaxed) != 0 &&
+          h.consumer_sleeping.exchange(0) != 0) {
+        (void)sys_eventfd_write(__data_fd, 1);
+      }
+    }
+    void __wake_producers() noexcept {
+      auto &h = __header();
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (h.producers_sleeping.load(std::memory_order_relaxed) != 0) {
+        h.space_seq.fetch_add(1, std::memory_order_release);
+        ::syscall(SYS_futex, &h.space_seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+      }
+    }
+
+    /*
+     * claims [pos, pos + size) for a record. MPSC claims compete through the tail, an SPSC
+     * producer owns it.
+     */
+    bool __claim(uint64_t pos, uint64_t size) noexcept {
+      auto &h = __header();
+      if (h.kind == ShmRingKind::SPSC) return true;
+      return h.tail.compare_exchange_weak(pos, pos + size, std::memory_order_relaxed);
+    }
+    void __publish(uint64_t pos, uint64_t size, uint64_t header) noexcept {
+      auto &h = __header();
+      if (h.kind == ShmRingKind::SPSC) {
+        __record(pos).store(header, std::memory_order_relaxed);
+        h.tail.store(pos + size, std::memory_order_release);
+      } else {
+        __record(pos).store(header, std::memory_order_release);
+      }
+    }
+    void __release(uint64_t pos, uint64_t size) noexcept {
+      auto &h = __header();
+      if (h.kind == ShmRingKind::MPSC) std::memset(__data() + pos % h.capacity, 0, size);
+      h.head.store(pos + size, std::memory_order_release);
+    }
+
+  public:
+    /**
+     * @brief Creates a ring.
+     * @param capacity Data bytes, rounded up to a power of two of at least 4096. A message takes
+     * its length rounded up to 8 plus an 8 byte header.
+     * @param kind Single or multiple producers.
+     * @return The creating side mapping or IO error.
+     */
+    static std::expected<ShmRing, IoError> create(
+      size_t capacity, ShmRingKind kind = ShmRingKind::SPSC
+    ) noexcept {
+      size_t cap = std::bit_ceil(std::max<size_t>(capacity, 4096));
+      size_t len = shm_ring_data_offset + cap;
+      return sys_call(::memfd_create, "jowi_shm_ring", MFD_CLOEXEC)
+        .transform(FileDescriptor::manage_default)
+        .and_then([&](FileDescriptor mem_fd) {
+          return sys_call_void(::ftruncate, mem_fd.get_or(-1), static_cast<off_t>(len))
+            .and_then([&]() { return __map_fd(mem_fd, len); })
+            .and_then([&](std::unique_ptr<char, ShmUnmapper> map) {
+              auto *h = new (map.get()) ShmRingHeader{};
+              h->magic = shm_ring_magic;
+              h->capacity = cap;
+              h->kind = kind;
+              return sys_eventfd().transform([&](FileDescriptor data_fd) {
+                return ShmRing{std::move(map), std::move(mem_fd), std::move(data_fd)};
+              });
+            });
+        });
+    }
+    /**
+     * @brief Maps a ring created by another process from its memfd and its eventfd.
+     * @return The mapping, or `EINVAL` when mem_fd does not hold a ring.
+     */
+    static std::expected<ShmRing, IoError> attach(
+      FileDescriptor mem_fd, FileDescriptor data_fd
+    ) noexcept {
+      struct stat st{};
+      return sys_call_void(::fstat, mem_fd.get_or(-1), &st)
+        .and_then([&]() -> std::expected<std::unique_ptr<char, ShmUnmapper>, IoError> {
+          if (static_cast<size_t>(st.st_size) <= shm_ring_data_offset) {
+            return std::unexpected{IoError::str_error(EINVAL)};
+          }
+          return __map_fd(mem_fd, static_cast<size_t>(st.st_size));
+        })
+        .and_then([&](std::unique_ptr<char, ShmUnmapper> map) -> std::expected<ShmRing, IoError> {
+          auto *h = std::launder(reinterpret_cast<ShmRingHeader *>(map.get()));
+          if (h->magic != shm_ring_magic ||
+              h->capacity + shm_ring_data_offset != static_cast<size_t>(st.st_size)) {
+            return std::unexpected{IoError::str_error(EINVAL)};
+          }
+          return ShmRing{std::move(map), std::move(mem_fd), std::move(data_fd)};
+        });
+    }
+
+    size_t capacity() const noexcept {
+      return __header().capacity;
+    }
+    ShmRingKind kind() const noexcept {
+      return __header().kind;
+    }
+    int mem_handle() const noexcept {
+      return __mem_fd.get_or(-1);
+    }
+    /**
+     * @brief Eventfd the consumer sleeps on, readable once a producer woke it. A reactor waiting on
+     * it calls `on_notify()` before polling `apeek` again.
+     */
+    int native_handle() const noexcept {
+      return __data_fd.get_or(-1);
+    }
+
+    /*
+     * Producer
+     */
+    /**
+     * @brief Claims space for a message of len bytes without blocking.
+     * @return The reservation, nullopt when the ring is full, `EMSGSIZE` when len can never fit.
+     */
+    std::optional<std::expected<ShmReservation, IoError>> try_reserve(size_t len) noexcept {
+      auto &h = __header();
+      uint64_t cap = h.capacity;
+      uint64_t size = shm_record_size(len);
+      if (size > cap || len > shm_record_len_mask) {
+        return std::unexpected{IoError::str_error(EMSGSIZE)};
+      }
+      while (true) {
+        uint64_t t = h.tail.load(std::memory_order_relaxed);
+        uint64_t free = cap - (t - h.head.load(std::memory_order_acquire));
+        uint64_t left = cap - t % cap;
+        if (size > left) {
+          // pad up to the end of the ring, the record then starts over at the beginning.
+          if (free < left) return std::nullopt;
+          if (!__claim(t, left)) continue;
+          __publish(t, left, (left - sizeof(uint64_t)) | shm_record_padding | shm_record_committed);
+          continue;
+        }
+        if (free < size) return std::nullopt;
+        if (!__claim(t, size)) continue;
+        return ShmReservation{
+          std::span<char>{__data() + t % cap + sizeof(uint64_t), len}, t
+        };
+      }
+    }
+    /**
+     * @brief Claims space, sleeping while the ring is full.
+     * @param timeout_ms Timeout of each sleep in milliseconds, -1 waits forever. Fails with
+     * `ETIMEDOUT`.
+     */
+    std::expected<ShmReservation, IoError> reserve(size_t len, int timeout_ms = -1) noexcept {
+      while (true) {
+        if (auto res = try_reserve(len)) return std::move(res).value();
+        auto slept = __sleep_producer(shm_record_size(len), timeout_ms);
+        if (!slept) return std::unexpected{slept.error()};
+        if (!*slept) return std::unexpected{IoError::str_error(ETIMEDOUT)};
+      }
+    }
+    /**
+     * @brief Publishes a reserved message and wakes the consumer if it sleeps.
+     */
+    void commit(const ShmReservation &r) noexcept {
+      __publish(r.pos, shm_record_size(r.data.size()), r.data.size() | shm_record_committed);
+      __wake_consumer();
+    }
+    /**
+     * @brief Copies v into the ring as one message, sleeping while the ring is full.
+     */
+    std::expected<void, IoError> send(std::string_view v, int timeout_ms = -1) noexcept {
+      return reserve(v.size(), timeout_ms).transform([&](ShmReservation r) {
+        std::memcpy(r.data.data(), v.data(), v.size());
+        commit(r);
+      });
+    }
+    asio::InfiniteAwaiter<ShmReservePoller> areserve(size_t len) noexcept {
+      return {*this, len};
+    }
+
+    /*
+     * Consumer
+     */
+    /**
+     * @brief Next message without blocking. The view stays valid until `release()`, peeking again
+     * before that returns the same message.
+     * @return The message or nullopt when the ring is empty.
+     */
+    std::optional<std::string_view> try_peek() noexcept {
+      auto &h = __header();
+      while (true) {
+        uint64_t pos = h.head.load(std::memory_order_relaxed);
+        uint64_t header;
+        if (h.kind == ShmRingKind::SPSC) {
+          if (h.tail.load(std::memory_order_acquire) == pos) return std::nullopt;
+          header = __record(pos).load(std::memory_order_relaxed);
+        } else {
+          header = __record(pos).load(std::memory_order_acquire);
+          if ((header & shm_record_committed) == 0) return std::nullopt;
+        }
+        size_t len = header & shm_record_len_mask;
+        if (header & shm_record_padding) {
+          __release(pos, shm_record_size(len));
+          continue;
+        }
+        __peeked = shm_record_size(len);
+        return std::string_view{__data() + pos % h.capacity + sizeof(uint64_t), len};
+      }
+    }
+    /**
+     * @brief Next message, sleeping while the ring is empty.
+     * @param timeout_ms Timeout of each sleep in milliseconds, -1 waits forever. Fails with
+     * `ETIMEDOUT`.
+     */
+    std::expected<std::string_view, IoError> peek(int timeout_ms = -1) noexcept {
+      while (true) {
+        if (auto v = try_peek()) return *v;
+        auto slept = __sleep_consumer(timeout_ms);
+        if (!slept) return std::unexpected{slept.error()};
+        if (!*slept) return std::unexpected{IoError::str_error(ETIMEDOUT)};
+      }
+    }
+    /**
+     * @brief Drops the message returned by the last peek and wakes sleeping producers.
+     */
+    void release() noexcept {
+      if (__peeked == 0) return;
+      __release(__header().head.load(std::memory_order_relaxed), __peeked);
+      __peeked = 0;
+      __wake_producers();
+    }
+    asio::InfiniteAwaiter<ShmPeekPoller> apeek() noexcept {
+      return {*this};
+    }
+
+    /*
+     * for the peek poller: announces a sleeping consumer, so that the next commit writes the
+     * eventfd a reactor waits on. False when data arrived meanwhile.
+     */
+    bool arm_consumer() noexcept {
+      auto &h = __header();
+      h.consumer_sleeping.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return !__has_data();
+    }
+    /**
+     * @brief Consumes the wake up of the eventfd, for reactors about to poll `apeek`.
+     */
+    std::expected<void, IoError> on_notify() noexcept {
+      return sys_eventfd_read(__data_fd).transform([](uint64_t) {});
+    }
+
+  private:
+    bool __has_data() const noexcept {
+      auto &h = __header();
+      uint64_t pos = h.head.load(std::memory_order_relaxed);
+      if (h.kind == ShmRingKind::SPSC) return h.tail.load(std::memory_order_acquire) != pos;
+      return (__record(pos).load(std::memory_order_acquire) & shm_record_committed) != 0;
+    }
+  };
+
+  std::optional<ShmPeekPoller::ValueType> ShmPeekPoller::poll() noexcept {
+    if (auto v = ring.try_peek()) return v;
+    if (!ring.arm_consumer()) return ring.try_peek();
+    return std::nullopt;
+  }
+
+  std::optional<ShmReservePoller::ValueType> ShmReservePoller::poll() noexcept {
+    return ring.try_reserve(len);
+  }
+}
@@ -1,17 +1,30 @@
 module;
+#include <linux/fs.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <algorithm>
 #include <cerrno>
+#include <cstdint>
 #include <expected>
 #include <fcntl.h>
 #include <optional>
 #include <string_view>
+#include <utility>
 #include <unistd.h>
 export module jowi.io:sys_call;
 import :error;
 import :fd_type;
 import :file;
 import :buffer;
+import :metrics;
+import :trace;
 
 namespace jowi::io {
   /**
@@ -28,8 +41,28 @@ namespace jowi::io {
     F &&f, Args &&...args
   ) noexcept {
     auto res = std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
-    int err_no = errno;
     if (res == -1) {
+      return std::unexpected{IoError::str_error(errno)};
+    }
+    return res;
+  }
+  /**
+   * @brief sys_call for pollers on non-blocking descriptors. A would-block failure is reported as
+   * nullopt before any error object is built, any other failure as `IoError`.
+   * @tparam F Callable type accepting the provided `Args`.
+   * @tparam Args Argument types forwarded to the callable.
+   * @param f Callable representing the syscall.
+   * @param args Arguments forwarded to the callable.
+   * @return nullopt when the call would block, otherwise the syscall result or `IoError`.
+   */
+  template <class F, class... Args> requires(std::invocable<F, Args...>)
+  std::optional<std::expected<std::invoke_result_t<F, Args...>, IoError>> sys_poll_call(
+    F &&f, Args &&...args
+  ) noexcept {
+    auto res = std::invoke(std::forward<F>(f), std::forward<Args>(args)...);
+    if (res == -1) {
+      int err_no = errno;
+      if (err_no == EAGAIN || err_no == EWOULDBLOCK) return std::nullopt;
       return std::unexpected{IoError::str_error(err_no)};
     }
     return res;
@@ -46,6 +79,63 @@ namespace jowi::io {
   std::expected<void, IoError> sys_call_void(F &&f, Args &&...args) noexcept {
     return sys_call(std::forward<F>(f), std::forward<Args>(args)...).transform([](auto &&) {});
   }
+  /*
+   * invokes f on fd, timed and recorded into the metrics and the trace ring. Returns the result
+   * and the errno of a -1 result.
+   */
+  template <class F, class... Args> requires(std::invocable<F, int, Args...>)
+  std::pair<std::invoke_result_t<F, int, Args...>, int> sys_io_record(
+    IoOp op, int fd, size_t requested, F &&f, Args &&...args
+  ) noexcept {
+    auto beg = metrics_now_ns();
+    auto res = std::invoke(std::forward<F>(f), fd, std::forward<Args>(args)...);
+    int err_no = res == -1 ? errno : 0;
+    auto ns = metrics_now_ns() - beg;
+    if constexpr (metrics_enabled) {
+      metrics_record(op, fd, static_cast<int64_t>(res), err_no, requested, ns);
+    }
+    trace_record(op, fd, static_cast<int64_t>(res), err_no, requested, beg, ns);
+    return {res, err_no};
+  }
+  /**
+   * @brief sys_call on a descriptor, f is invoked with fd followed by args. When metrics are
+   * compiled in or tracing is enabled the call is timed and recorded for fd, otherwise this is
+   * `sys_call`.
+   * @param op Operation kind the call is recorded under.
+   * @param fd Native descriptor, the first argument of f.
+   * @param requested Bytes asked for, a write or send returning less is counted as partial.
+   * @return Expected with the syscall result or `IoError` when the call fails.
+   */
+  template <class F, class... Args> requires(std::invocable<F, int, Args...>)
+  std::expected<std::invoke_result_t<F, int, Args...>, IoError> sys_io_call(
+    IoOp op, int fd, size_t requested, F &&f, Args &&...args
+  ) noexcept {
+    if (!metrics_enabled && !trace_enabled()) {
+      return sys_call(std::forward<F>(f), fd, std::forward<Args>(args)...);
+    }
+    auto [res, err_no] =
+      sys_io_record(op, fd, requested, std::forward<F>(f), std::forward<Args>(args)...);
+    if (res == -1) return std::unexpected{IoError::str_error(err_no)};
+    return res;
+  }
+  /**
+   * @brief `sys_poll_call` recorded like `sys_io_call`, would-block returns count as such.
+   */
+  template <class F, class... Args> requires(std::invocable<F, int, Args...>)
+  std::optional<std::expected<std::invoke_result_t<F, int, Args...>, IoError>> sys_io_poll_call(
+    IoOp op, int fd, size_t requested, F &&f, Args &&...args
+  ) noexcept {
+    if (!metrics_enabled && !trace_enabled()) {
+      return sys_poll_call(std::forward<F>(f), fd, std::forward<Args>(args)...);
+    }
+    auto [res, err_no] =
+      sys_io_record(op, fd, requested, std::forward<F>(f), std::forward<Args>(args)...);
+    if (res == -1) {
+      if (err_no == EAGAIN || err_no == EWOULDBLOCK) return std::nullopt;
+      return std::unexpected{IoError::str_error(err_no)};
+    }
+    return res;
+  }
   /**
    * @brief reads bytes into a writable buffer
    * @param fd native file descriptor
@@ -54,7 +144,8 @@ namespace jowi::io {
   export std::expected<void, IoError> sys_read(
     const FileDescriptor &fd, WritableBuffer auto &buf
   ) noexcept {
-    return sys_call(read, fd.get_or(-1), buf.write_beg(), buf.writable_size())
+    size_t len = buf.writable_size();
+    return sys_io_call(IoOp::READ, fd.get_or(-1), len, read, buf.write_beg(), len)
       .transform(BufferWriteMarker{buf});
   }
 
@@ -67,11 +158,9 @@ namespace jowi::io {
     using ValueType = std::expected<void, IoError>;
     SysReadPoller(const FileDescriptor &fd, buf_type &buf) : __fd{fd}, __buf{buf} {}
     std::optional<ValueType> poll() noexcept {
-      auto res = sys_read(__fd, __buf);
-      if (!res && (res.error().err_code() == EWOULDBLOCK || res.error().err_code() == EAGAIN)) {
-        return std::nullopt;
-      }
-      return res;
+      size_t len = __buf.writable_size();
+      return sys_io_poll_call(IoOp::READ, __fd.get_or(-1), len, read, __buf.write_beg(), len)
+        .transform([&](auto res) { return res.transform(BufferWriteMarker{__buf}); });
     }
   };
 
@@ -84,7 +173,7 @@ namespace jowi::io {
   std::expected<uint64_t, IoError> sys_write(
     const FileDescriptor &fd, std::string_view v
   ) noexcept {
-    return sys_call(write, fd.get_or(-1), v.data(), v.length());
+    return sys_io_call(IoOp::WRITE, fd.get_or(-1), v.length(), write, v.data(), v.length());
   };
 
   export struct SysWritePoller {
@@ -97,11 +186,9 @@ namespace jowi::io {
     SysWritePoller(const FileDescriptor &fd, std::string_view v) : __fd{fd}, __v{v} {}
 
     std::optional<ValueType> poll() noexcept {
-      auto res = sys_write(__fd, __v);
-      if (!res && (res.error().err_code() == EWOULDBLOCK || res.error().err_code() == EAGAIN)) {
-        return std::nullopt;
-      }
-      return res;
+      return sys_io_poll_call(
+        IoOp::WRITE, __fd.get_or(-1), __v.length(), write, __v.data(), __v.length()
+      );
     }
   };
 
@@ -150,8 +237,159 @@ namespace jowi::io {
    * @return Success or IO error.
    */
   std::expected<void, IoError> sys_sync(const FileDescriptor &fd) noexcept {
-    return sys_call_void(fsync, fd.get_or(-1));
+    return sys_io_call(IoOp::SYNC, fd.get_or(-1), 0, fsync).transform([](int) {});
   };
+  /**
+   * @brief Flushes file data and only the metadata needed to read it back.
+   * @param fd Native file descriptor.
+   * @return Success or IO error.
+   */
+  std::expected<void, IoError> sys_sync_data(const FileDescriptor &fd) noexcept {
+    return sys_io_call(IoOp::SYNC, fd.get_or(-1), 0, fdatasync).transform([](int) {});
+  };
+
+  /**
+   * @brief Allocates or deallocates file blocks (`fallocate`).
+   * @param fd Native file descriptor.
+   * @param mode Zero or `FALLOC_FL_*` flags.
+   * @param offset Start of the range.
+   * @param len Length of the range.
+   * @return Success or IO error.
+   */
+  std::expected<void, IoError> sys_fallocate(
+    const FileDescriptor &fd, int mode, off_t offset, off_t len
+  ) noexcept {
+    return sys_call_void(fallocate, fd.get_or(-1), mode, offset, len);
+  }
+
+  /**
+   * @brief Starts and / or waits for writeback of a file range (`sync_file_range`). This does
+   * not flush metadata or the device cache, it is a pacing tool and not a durability guarantee.
+   * @param fd Native file descriptor.
+   * @param offset Start of the range.
+   * @param len Length of the range, 0 extends to the end of file.
+   * @param flags `SYNC_FILE_RANGE_*` flags.
+   * @return Success or IO error.
+   */
+  std::expected<void, IoError> sys_sync_range(
+    const FileDescriptor &fd, off_t offset, off_t len, unsigned int flags
+  ) noexcept {
+    return sys_call_void(sync_file_range, fd.get_or(-1), offset, len, flags);
+  }
+
+  /**
+   * @brief Declares the access pattern of a file range (`posix_fadvise`).
+   * @param fd Native file descriptor.
+   * @param advice Expected access pattern.
+   * @param offset Start of the range.
+   * @param len Length of the range, 0 extends to the end of file.
+   * @return Success or IO error.
+   */
+  std::expected<void, IoError> sys_fadvise(
+    const FileDescriptor &fd, FileAdvice advice, off_t offset, off_t len
+  ) noexcept {
+    int advice_bit = POSIX_FADV_NORMAL;
+    switch (advice) {
+      case FileAdvice::NORMAL:
+        advice_bit = POSIX_FADV_NORMAL;
+        break;
+      case FileAdvice::SEQUENTIAL:
+        advice_bit = POSIX_FADV_SEQUENTIAL;
+        break;
+      case FileAdvice::RANDOM:
+        advice_bit = POSIX_FADV_RANDOM;
+        break;
+      case FileAdvice::WILL_NEED:
+        advice_bit = POSIX_FADV_WILLNEED;
+        break;
+      case FileAdvice::DONT_NEED:
+        advice_bit = POSIX_FADV_DONTNEED;
+        break;
+      case FileAdvice::NO_REUSE:
+        advice_bit = POSIX_FADV_NOREUSE;
+        break;
+    }
+    // posix_fadvise returns the error number instead of setting errno.
+    int err_no = posix_fadvise(fd.get_or(-1), offset, len, advice_bit);
+    if (err_no != 0) return std::unexpected{IoError::str_error(err_no)};
+    return {};
+  }
+
+  /**
+   * @brief Populates the page cache with a file range (`readahead`).
+   * @param fd Native file descriptor.
+   * @param offset Start of the range.
+   * @param len Length of the range.
+   * @return Success or IO error.
+   */
+  std::expected<void, IoError> sys_readahead(
+    const FileDescriptor &fd, off_t offset, size_t len
+  ) noexcept {
+    return sys_call_void(readahead, fd.get_or(-1), offset, len);
+  }
+
+  /**
+   * Copy
+   */
+  /*
+   * shares the blocks of a source range with the destination (reflink). Fails with EOPNOTSUPP,
+   * EXDEV or EINVAL when the filesystem, the pair of files or the alignment does not allow it.
+   */
+  std::expected<void, IoError> sys_clone_range(
+    const FileDescriptor &src, off_t src_offset, size_t len, const FileDescriptor &dst,
+    off_t dst_offset
+  ) noexcept {
+    file_clone_range range{
+      static_cast<__s64>(src.get_or(-1)),
+      static_cast<__u64>(src_offset),
+      static_cast<__u64>(len),
+      static_cast<__u64>(dst_offset)
+    };
+    return sys_call_void(ioctl, dst.get_or(-1), FICLONERANGE, &range);
+  }
+  /*
+   * in kernel copy, both offsets are advanced by the amount copied. 0 at the end of the source.
+   */
+  std::expected<size_t, IoError> sys_copy_file_range(
+    const FileDescriptor &src, off_t &src_offset, const FileDescriptor &dst, off_t &dst_offset,
+    size_t len
+  ) noexcept {
+    int src_fd = src.get_or(-1);
+    int dst_fd = dst.get_or(-1);
+    return sys_call(copy_file_range, src_fd, &src_offset, dst_fd, &dst_offset, len, 0u)
+      .transform([](ssize_t n) { return static_cast<size_t>(n); });
+  }
+  /*
+   * in kernel copy to the current position of dst, src_offset is advanced by the amount copied.
+   */
+  std::expected<size_t, IoError> sys_sendfile(
+    const FileDescriptor &dst, const FileDescriptor &src, off_t &src_offset, size_t len
+  ) noexcept {
+    return sys_call(sendfile, dst.get_or(-1), src.get_or(-1), &src_offset, len)
+      .transform([](ssize_t n) { return static_cast<size_t>(n); });
+  }
+
+  /**
+   * Directory
+   */
+  /*
+   * reads as many `dirent64` records as fit buf, 0 at the end of the directory.
+   */
+  std::expected<size_t, IoError> sys_getdents(
+    const FileDescriptor &fd, char *buf, size_t len
+  ) noexcept {
+    return sys_call(getdents64, fd.get_or(-1), buf, len).transform([](ssize_t n) {
+      return static_cast<size_t>(n);
+    });
+  }
+
+  std::expected<mode_t, IoError> sys_stat_at(
+    const FileDescriptor &dir, const char *name, bool follow_link = false
+  ) noexcept {
+    struct stat st{};
+    return sys_call(fstatat, dir.get_or(-1), name, &st, follow_link ? 0 : AT_SYMLINK_NOFOLLOW)
+      .transform([&](int) { return st.st_mode; });
+  }
 
   /**
    * fcntl
@@ -161,12 +399,20 @@ namespace jowi::io {
   }
 
   /**
-   * fcntl set flags
+   * fcntl set flags. Status flags (e.g. O_NONBLOCK) are applied through F_SETFL while O_CLOEXEC is
+   * translated to FD_CLOEXEC and applied through F_SETFD.
    */
   std::expected<int, IoError> sys_fcntl_set_f_or(const FileDescriptor &fd, int flags) noexcept {
-    return sys_fcntl(fd, F_GETFD, 0).and_then([&](int cur_flags) {
-      return sys_fcntl(fd, F_SETFD, cur_flags | flags);
-    });
+    return sys_fcntl(fd, F_GETFL, 0)
+      .and_then([&](int cur_flags) {
+        return sys_fcntl(fd, F_SETFL, cur_flags | (flags & ~O_CLOEXEC));
+      })
+      .and_then([&](int res) -> std::expected<int, IoError> {
+        if ((flags & O_CLOEXEC) == 0) return res;
+        return sys_fcntl(fd, F_GETFD, 0).and_then([&](int cur_flags) {
+          return sys_fcntl(fd, F_SETFD, cur_flags | FD_CLOEXEC);
+        });
+      });
   }
 
   std::expected<FileDescriptor, IoError> sys_fcntl_nonblock(FileDescriptor fd) noexcept {
@@ -179,6 +425,15 @@ namespace jowi::io {
     return sys_fcntl_set_f_or(fd, O_CLOEXEC | O_NONBLOCK).transform([&](auto) {});
   }
 
+  /**
+   * setsockopt for integer valued options
+   */
+  std::expected<void, IoError> sys_setsockopt(
+    const FileDescriptor &fd, int level, int opt_name, int value
+  ) noexcept {
+    return sys_call_void(setsockopt, fd.get_or(-1), level, opt_name, &value, sizeof(value));
+  }
+
   /**
    * poll
    */
@@ -190,26 +445,107 @@ namespace jowi::io {
     struct pollfd conf{fd.get_or(-1), POLLOUT, 0};
     return sys_call(poll, &conf, 1, 0).transform([](int n_events) { return n_events == 1; });
   }
+  /**
+   * blocks until one of events (POLLERR and POLLHUP are always reported) is raised or timeout_ms
+   * passes. A negative timeout waits forever.
+   */
+  std::expected<short, IoError> sys_poll_wait(
+    const FileDescriptor &fd, short events, int timeout_ms = -1
+  ) noexcept {
+    struct pollfd conf{fd.get_or(-1), events, 0};
+    return sys_call(poll, &conf, 1, timeout_ms).transform([&](int) { return conf.revents; });
+  }
 
   /**
    * Pipe
    */
+  /*
+   * both ends are close-on-exec from the start (pipe2), so a process spawned concurrently by
+   * another thread never inherits them.
+   */
   std::expected<std::pair<FileDescriptor, FileDescriptor>, IoError> sys_pipe(bool non_blocking) {
     std::array<int, 2> pipe_fd;
-    return sys_call(pipe, pipe_fd.data()).and_then([&](auto &&) {
-      FileDescriptor r_fd = FileDescriptor::manage_default(pipe_fd[0]);
-      FileDescriptor w_fd = FileDescriptor::manage_default(pipe_fd[1]);
-      if (non_blocking) {
-        return sys_fcntl_set_f_or(r_fd, O_NONBLOCK | O_CLOEXEC).and_then([&](auto) {
-          return sys_fcntl_set_f_or(w_fd, O_NONBLOCK | O_CLOEXEC).transform([&](auto) {
-            return std::pair{std::move(r_fd), std::move(w_fd)};
-          });
-        });
-      } else {
-        return std::expected<std::pair<FileDescriptor, FileDescriptor>, IoError>{
-          std::pair{std::move(r_fd), std::move(w_fd)}
-        };
-      }
+    int flags = O_CLOEXEC | (non_blocking ? O_NONBLOCK : 0);
+    return sys_call(pipe2, pipe_fd.data(), flags).transform([&](auto &&) {
+      return std::pair{
+        FileDescriptor::manage_default(pipe_fd[0]), FileDescriptor::manage_default(pipe_fd[1])
+      };
+    });
+  }
+
+  /**
+   * Process
+   */
+  /*
+   * descriptor that becomes readable once the child exits, ENOSYS before linux 5.3.
+   */
+  std::expected<FileDescriptor, IoError> sys_pidfd_open(pid_t pid) noexcept {
+    return sys_call(syscall, SYS_pidfd_open, pid, 0).transform([](long fd) {
+      return FileDescriptor::manage_default(static_cast<int>(fd));
+    });
+  }
+
+  std::expected<void, IoError> sys_pidfd_signal(const FileDescriptor &pidfd, int signal) noexcept {
+    return sys_call_void(syscall, SYS_pidfd_send_signal, pidfd.get_or(-1), signal, nullptr, 0);
+  }
+
+  /*
+   * reaps the child, nullopt when it is still running and block is false.
+   */
+  std::expected<std::optional<siginfo_t>, IoError> sys_wait_child(
+    pid_t pid, bool block
+  ) noexcept {
+    siginfo_t info{};
+    int flags = WEXITED | (block ? 0 : WNOHANG);
+    while (true) {
+      auto res = sys_call(waitid, P_PID, static_cast<id_t>(pid), &info, flags);
+      if (!res && res.error().err_code() == EINTR) continue;
+      return res.transform([&](int) -> std::optional<siginfo_t> {
+        // WNOHANG leaves si_pid at 0 while the child runs.
+        if (info.si_pid == 0) return std::nullopt;
+        return info;
+      });
+    }
+  }
+
+  /**
+   * Eventfd
+   */
+  std::expected<FileDescriptor, IoError> sys_eventfd(bool non_blocking = true) noexcept {
+    int flags = EFD_CLOEXEC | (non_blocking ? EFD_NONBLOCK : 0);
+    return sys_call(eventfd, 0u, flags).transform(FileDescriptor::manage_default);
+  }
+  std::expected<void, IoError> sys_eventfd_write(const FileDescriptor &fd, uint64_t v) noexcept {
+    return sys_call_void(::write, fd.get_or(-1), &v, sizeof(v));
+  }
+  /*
+   * reads and resets the eventfd counter, 0 when nothing has been signalled (non-blocking).
+   */
+  std::expected<uint64_t, IoError> sys_eventfd_read(const FileDescriptor &fd) noexcept {
+    uint64_t v = 0;
+    auto res = sys_call(::read, fd.get_or(-1), &v, sizeof(v));
+    if (!res && !res.error().is_would_block()) return std::unexpected{res.error()};
+    return v;
+  }
+
+  /**
+   * Direct IO
+   */
+  /*
+   * alignment O_DIRECT transfers need for buffer addresses, offsets and lengths. Uses statx
+   * STATX_DIOALIGN where the kernel reports it, the preferred block size otherwise.
+   */
+  std::expected<size_t, IoError> sys_dio_alignment(const FileDescriptor &fd) noexcept {
+#ifdef STATX_DIOALIGN
+    struct statx stx{};
+    auto res = sys_call(::statx, fd.get_or(-1), "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx);
+    if (res && (stx.stx_mask & STATX_DIOALIGN) != 0 && stx.stx_dio_offset_align != 0) {
+      return std::max<size_t>(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+    }
+#endif
+    struct stat st{};
+    return sys_call(::fstat, fd.get_or(-1), &st).transform([&](int) {
+      return static_cast<size_t>(st.st_blksize);
     });
   }
 }
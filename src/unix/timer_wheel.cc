@@ -0,0 +1,357 @@
+module;
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+export module jowi.io:timer_wheel;
+import :error;
+import :fd_type;
+import :sys_call;
+
+/**
+ * @file unix/timer_wheel.cc
+ * @brief Hierarchical timing wheel backing the timeout overloads of the asynchronous operations.
+ */
+
+namespace jowi::io {
+  /**
+   * @brief Handle to a timer armed on a `TimerWheel`. The generation guards against a stale handle
+   * observing a slot that has been reused by another timer.
+   */
+  export struct TimerId {
+    uint32_t index;
+    uint32_t generation;
+
+    static constexpr TimerId invalid() noexcept {
+      return TimerId{std::numeric_limits<uint32_t>::max(), 0};
+    }
+  };
+
+  /**
+   * @brief Hierarchical timing wheel with four levels of 64 slots. Arming, cancelling and firing a
+   * timer are O(1); advancing costs one step per elapsed tick plus the timers that expire or
+   * cascade down a level. Timers are stored in a slab indexed by `TimerId` so no allocation
+   * happens once the slab has grown to the peak amount of armed timers.
+   *
+   * The wheel is either driven by the pollers waiting on it, through `poll_advance()`, or by its
+   * own `timerfd` (see `enable_timer_fd()`) that a reactor can wait on. Driven by pollers, the
+   * clock is read once per reactor round rather than once per poll. It is not thread safe, every
+   * thread uses its own wheel through `thread_local_wheel()`.
+   */
+  export struct TimerWheel {
+    using clock_type = std::chrono::steady_clock;
+
+  private:
+    static constexpr uint32_t __npos = std::numeric_limits<uint32_t>::max();
+    static constexpr uint64_t __slot_bits = 6;
+    static constexpr uint64_t __slot_count = uint64_t{1} << __slot_bits;
+    static constexpr uint64_t __slot_mask = __slot_count - 1;
+    static constexpr uint64_t __level_count = 4;
+    static constexpr uint64_t __max_span = uint64_t{1} << (__slot_bits * __level_count);
+
+    enum struct NodeState : uint8_t { free, armed, fired };
+    struct Node {
+      uint64_t expiry;
+      uint32_t prev;
+      uint32_t next;
+      uint32_t generation;
+      uint32_t slot;
+      NodeState state;
+    };
+
+    std::vector<Node> __nodes;
+    uint32_t __free_head;
+    std::array<uint32_t, __slot_count * __level_count> __slots;
+    std::chrono::milliseconds __resolution;
+    clock_type::time_point __origin;
+    // next tick that has not been processed yet.
+    uint64_t __now;
+    size_t __armed;
+    // bumped whenever a poller advances the wheel from the clock, see `poll_advance`.
+    uint64_t __poll_epoch;
+    std::optional<FileDescriptor> __timer_fd;
+
+    uint64_t __clock_tick() const noexcept {
+      return static_cast<uint64_t>((clock_type::now() - __origin) / __resolution);
+    }
+
+    uint32_t __slot_for(uint64_t expiry) const noexcept {
+      uint64_t e = std::min(std::max(expiry, __now), __now + __max_span - 1);
+      uint64_t delta = e - __now;
+      uint64_t level = 0;
+      while (level + 1 < __level_count && delta >= (uint64_t{1} << (__slot_bits * (level + 1)))) {
+        level += 1;
+      }
+      uint64_t slot_idx = (e >> (__slot_bits * level)) & __slot_mask;
+      return static_cast<uint32_t>(level * __slot_count + slot_idx);
+    }
+
+    void __link(uint32_t idx) noexcept {
+      Node &n = __nodes[idx];
+      n.slot = __slot_for(n.expiry);
+      n.prev = __npos;
+      n.next = __slots[n.slot];
+      if (n.next != __npos) __nodes[n.next].prev = idx;
+      __slots[n.slot] = idx;
+    }
+
+    void __unlink(uint32_t idx) noexcept {
+      Node &n = __nodes[idx];
+      if (n.prev != __npos) __nodes[n.prev].next = n.next;
+      else
+        __slots[n.slot] = n.next;
+      if (n.next != __npos) __nodes[n.next].prev = n.prev;
+    }
+
+    void __free(uint32_t idx) noexcept {
+      Node &n = __nodes[idx];
+      n.state = NodeState::free;
+      n.generation += 1;
+      n.next = __free_head;
+      __free_head = idx;
+    }
+
+    void __cascade(uint64_t level, uint64_t slot_idx) noexcept {
+      uint32_t idx = std::exchange(__slots[level * __slot_count + slot_idx], __npos);
+      while (idx != __npos) {
+        uint32_t next = __nodes[idx].next;
+        __link(idx);
+        idx = next;
+      }
+    }
+
+    void __tick() noexcept {
+      uint64_t idx = __now & __slot_mask;
+      if (idx == 0) {
+        for (uint64_t level = 1; level < __level_count; level += 1) {
+          uint64_t level_idx = (__now >> (__slot_bits * level)) & __slot_mask;
+          __cascade(level, level_idx);
+          if (level_idx != 0) break;
+        }
+      }
+      uint32_t node_idx = std::exchange(__slots[idx], __npos);
+      while (node_idx != __npos) {
+        Node &n = __nodes[node_idx];
+        n.state = NodeState::fired;
+        __armed -= 1;
+        node_idx = n.next;
+      }
+      __now += 1;
+    }
+
+    std::expected<void, IoError> __set_timer_fd(bool running) noexcept {
+      if (!__timer_fd) return {};
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(__resolution).count();
+      timespec interval{};
+      if (running) {
+        interval.tv_sec = static_cast<time_t>(ns / 1'000'000'000);
+        interval.tv_nsec = static_cast<long>(ns % 1'000'000'000);
+      }
+      itimerspec spec{interval, interval};
+      return sys_call_void(timerfd_settime, __timer_fd->get_or(-1), 0, &spec, nullptr);
+    }
+
+  public:
+    TimerWheel(std::chrono::milliseconds resolution = std::chrono::milliseconds{1}) noexcept :
+      __nodes{}, __free_head{__npos}, __slots{}, __resolution{resolution},
+      __origin{clock_type::now()}, __now{0}, __armed{0}, __poll_epoch{0},
+      __timer_fd{std::nullopt} {
+      __slots.fill(__npos);
+    }
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    /**
+     * @brief Arms a timer that fires after the supplied duration, rounded up to the resolution.
+     * @param after Duration until the timer fires.
+     * @return Handle used to query, cancel or release the timer.
+     */
+    TimerId arm(std::chrono::milliseconds after) {
+      uint32_t idx = __free_head;
+      if (idx == __npos) {
+        idx = static_cast<uint32_t>(__nodes.size());
+        __nodes.emplace_back(Node{0, __npos, __npos, 0, 0, NodeState::free});
+      } else {
+        __free_head = __nodes[idx].next;
+      }
+      auto rounded_up = after + __resolution - std::chrono::milliseconds{1};
+      uint64_t ticks = static_cast<uint64_t>(rounded_up / __resolution);
+      uint64_t tick = __clock_tick();
+      // an empty wheel skips the idle period instead of ticking through it on the next advance.
+      if (__armed == 0) __now = std::max(__now, tick);
+      Node &n = __nodes[idx];
+      n.expiry = std::max(__now, tick + std::max<uint64_t>(ticks, 1));
+      n.state = NodeState::armed;
+      __link(idx);
+      if (__armed++ == 0) (void)__set_timer_fd(true);
+      return TimerId{idx, n.generation};
+    }
+
+    /**
+     * @brief Checks whether the timer has fired.
+     * @param id Handle returned by `arm`.
+     * @return True when the timer has fired and has not been released yet.
+     */
+    bool is_fired(TimerId id) const noexcept {
+      return id.index < __nodes.size() && __nodes[id.index].generation == id.generation &&
+        __nodes[id.index].state == NodeState::fired;
+    }
+
+    /**
+     * @brief Cancels the timer if it is still armed and makes its slot reusable. Stale or invalid
+     * handles are ignored.
+     * @param id Handle returned by `arm`.
+     */
+    void release(TimerId id) noexcept {
+      if (id.index >= __nodes.size() || __nodes[id.index].generation != id.generation) return;
+      Node &n = __nodes[id.index];
+      if (n.state == NodeState::armed) {
+        __unlink(id.index);
+        if (--__armed == 0) (void)__set_timer_fd(false);
+      }
+      if (n.state != NodeState::free) __free(id.index);
+    }
+
+    /**
+     * @brief Fires every timer whose deadline has passed according to the clock.
+     * @return Amount of ticks processed.
+     */
+    uint64_t advance() noexcept {
+      uint64_t target = __clock_tick();
+      uint64_t start = __now;
+      if (__armed == 0) {
+        __now = std::max(__now, target + 1);
+        return __now - start;
+      }
+      while (__now <= target) {
+        if (__armed == 0) {
+          __now = target + 1;
+          break;
+        }
+        __tick();
+      }
+      if (__armed == 0) (void)__set_timer_fd(false);
+      return __now - start;
+    }
+
+    /**
+     * @brief Advances the wheel on behalf of a pending poller, unless the wheel is driven by its
+     * timerfd. A reactor polls every pending poller once per round, so a poller coming back with
+     * the epoch it saw last starts a new round: only that poll reads the clock, the other pollers
+     * of the round reuse the ticks it processed.
+     * @param seen Epoch the poller saw on its previous poll, `poll_epoch()` when it was created.
+     */
+    void poll_advance(uint64_t &seen) noexcept {
+      if (__timer_fd) return;
+      if (seen == __poll_epoch) {
+        advance();
+        __poll_epoch += 1;
+      }
+      seen = __poll_epoch;
+    }
+    uint64_t poll_epoch() const noexcept {
+      return __poll_epoch;
+    }
+
+    /**
+     * @brief Lets the wheel be driven by a timerfd ticking at the wheel resolution while timers are
+     * armed. A reactor waits for `native_handle()` to be readable and calls `on_timer_fd()`, pollers
+     * then only check their own flag instead of reading the clock.
+     * @return Success or IO error.
+     */
+    std::expected<void, IoError> enable_timer_fd() noexcept {
+      if (__timer_fd) return {};
+      return sys_call(timerfd_create, CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)
+        .transform(FileDescriptor::manage_default)
+        .and_then([&](FileDescriptor f) {
+          __timer_fd.emplace(std::move(f));
+          return __set_timer_fd(__armed != 0);
+        });
+    }
+
+    /**
+     * @brief Consumes the timerfd expirations and advances the wheel.
+     * @return Amount of ticks processed or IO error.
+     */
+    std::expected<uint64_t, IoError> on_timer_fd() noexcept {
+      if (!__timer_fd) return advance();
+      uint64_t expirations = 0;
+      auto res = sys_call(::read, __timer_fd->get_or(-1), &expirations, sizeof(expirations));
+      if (!res && !res.error().is_would_block()) return std::unexpected{res.error()};
+      return advance();
+    }
+
+    /**
+     * @brief Returns the timerfd descriptor, or -1 when the wheel is driven by polling.
+     */
+    int native_handle() const noexcept {
+      return __timer_fd ? __timer_fd->get_or(-1) : -1;
+    }
+
+    size_t armed() const noexcept {
+      return __armed;
+    }
+
+    std::chrono::milliseconds resolution() const noexcept {
+      return __resolution;
+    }
+
+    /**
+     * @brief Wheel used by the timeout overloads on the calling thread.
+     */
+    static TimerWheel &thread_local_wheel() noexcept {
+      thread_local TimerWheel wheel{};
+      return wheel;
+    }
+  };
+
+  /**
+   * @brief Poller adaptor failing with `ETIMEDOUT` once its timer on the thread local wheel fires.
+   * The wrapped poller is always tried first, so a result that is ready when the deadline passes
+   * is still delivered.
+   *
+   * By default the pending pollers advance the wheel themselves, reading the clock once per
+   * reactor round (see `TimerWheel::poll_advance`). A reactor that calls `enable_timer_fd()` on the
+   * thread local wheel and drives it through `on_timer_fd()` takes the clock out of the pollers
+   * entirely.
+   */
+  export template <class Poller> struct DeadlinePoller {
+  private:
+    TimerWheel &__wheel;
+    TimerId __id;
+    uint64_t __seen;
+    Poller __p;
+
+  public:
+    using ValueType = typename Poller::ValueType;
+
+    template <class... Args>
+    DeadlinePoller(std::chrono::milliseconds timeout, Args &&...args) :
+      __wheel{TimerWheel::thread_local_wheel()}, __id{__wheel.arm(timeout)},
+      __seen{__wheel.poll_epoch()}, __p{std::forward<Args>(args)...} {}
+    DeadlinePoller(DeadlinePoller &&o) noexcept :
+      __wheel{o.__wheel}, __id{std::exchange(o.__id, TimerId::invalid())}, __seen{o.__seen},
+      __p{std::move(o.__p)} {}
+    DeadlinePoller(const DeadlinePoller &) = delete;
+    ~DeadlinePoller() noexcept {
+      __wheel.release(__id);
+    }
+
+    std::optional<ValueType> poll() noexcept {
+      std::optional<ValueType> res = __p.poll();
+      if (res) return res;
+      __wheel.poll_advance(__seen);
+      if (__wheel.is_fired(__id)) {
+        return ValueType{std::unexpected{IoError::str_error(ETIMEDOUT)}};
+      }
+      return std::nullopt;
+    }
+  };
+}
@@ -0,0 +1,85 @@
+#include <jowi/test_lib.hpp>
+#include "alloc_budget.hpp"
+#include <optional>
+#include <string>
+#include <utility>
+import jowi.test_lib;
+import jowi.io;
+import jowi.generic;
+
+namespace test_lib = jowi::test_lib;
+namespace io = jowi::io;
+using jowi::io::test::AllocScope;
+
+JOWI_SETUP(argc, argv) {
+  test_lib::get_test_context().set_thread_count(1).set_time_unit(
+    test_lib::TestTimeUnit::MILLI_SECONDS
+  );
+}
+
+JOWI_ADD_TEST(test_pipe_rw_no_alloc) {
+  auto [r, w] = test_lib::assert_expected_value(io::open_pipe());
+  auto buf = io::DynBuffer{100};
+  // assertions may allocate, results are checked once the scope is done.
+  bool ok = true;
+  auto scope = AllocScope{};
+  for (int i = 0; i < 1000; i += 1) {
+    ok = ok && w.write("hello").has_value() && r.read(buf).has_value();
+    buf.mark_read(buf.readable_size());
+    // would block, the error carries no formatted message.
+    auto blocked = r.read(buf);
+    ok = ok && !blocked && blocked.error().is_would_block();
+  }
+  size_t allocations = scope.count();
+  test_lib::assert_true(ok);
+  test_lib::assert_equal(allocations, size_t{0});
+}
+
+JOWI_ADD_TEST(test_tcp_recv_no_alloc) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_addr));
+  auto accept_res = server.accept();
+  while (!accept_res) {
+    accept_res = server.accept();
+  }
+  auto sock = test_lib::assert_expected_value(std::move(accept_res).value());
+  auto buf = io::DynBuffer{64};
+  bool ok = true;
+  auto scope = AllocScope{};
+  for (int i = 0; i < 1000; i += 1) {
+    ok = ok && client.send("ping", false).has_value() && sock.recv(buf, false).has_value();
+    ok = ok && buf.readable_size() == 4;
+    buf.mark_read(buf.readable_size());
+  }
+  size_t allocations = scope.count();
+  test_lib::assert_true(ok);
+  test_lib::assert_equal(allocations, size_t{0});
+}
+
+JOWI_ADD_TEST(test_lines_one_alloc_per_line) {
+  auto [r, w] = test_lib::assert_expected_value(io::open_pipe());
+  // longer than the small string buffer, so every returned line allocates.
+  auto line = std::string(40, 'l') + "\n";
+  std::string data;
+  for (int i = 0; i < 1000; i += 1) {
+    data += line;
+  }
+  test_lib::assert_equal(test_lib::assert_expected_value(w.write(data)), data.size());
+  auto lines = io::BufNextable{io::DynBuffer{4096}, r} | io::LineNextable{};
+  // warm up, the leftover string reaches its final capacity within the first chunks.
+  for (int i = 0; i < 200; i += 1) {
+    test_lib::assert_expected(lines.next().value());
+  }
+  size_t read = 0;
+  auto scope = AllocScope{};
+  for (int i = 0; i < 800; i += 1) {
+    auto l = lines.next();
+    read += l && l->has_value() && (*l)->size() == 40;
+  }
+  size_t allocations = scope.count();
+  test_lib::assert_equal(read, size_t{800});
+  test_lib::assert_true(allocations <= read);
+}
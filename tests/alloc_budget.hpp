@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/**
+ * @file tests/alloc_budget.hpp
+ * @brief Heap allocation counting for allocation budget tests. Replaces the global operator new
+ * and delete, so include it from exactly one translation unit of a test program. Every other form
+ * of operator new (arrays, nothrow) forwards to the two replaced here. Counts are per thread, work
+ * done by other threads does not spend the budget of a test.
+ */
+namespace jowi::io::test {
+  inline thread_local size_t heap_allocations = 0;
+
+  /**
+   * @brief Counts the allocations made by the current thread since construction.
+   */
+  struct AllocScope {
+    size_t start = heap_allocations;
+
+    size_t count() const noexcept {
+      return heap_allocations - start;
+    }
+  };
+}
+
+void *operator new(size_t n) {
+  jowi::io::test::heap_allocations += 1;
+  if (void *p = std::malloc(n == 0 ? 1 : n)) return p;
+  throw std::bad_alloc{};
+}
+void *operator new(size_t n, std::align_val_t al) {
+  jowi::io::test::heap_allocations += 1;
+  size_t align = static_cast<size_t>(al);
+  if (void *p = std::aligned_alloc(align, (n + align - 1) / align * align)) return p;
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
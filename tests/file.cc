@@ -1,7 +1,20 @@
 #include <jowi/test_lib.hpp>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <expected>
 #include <filesystem>
 #include <format>
+#include <future>
 #include <string>
+#include <thread>
+#include <vector>
 import jowi.test_lib;
 import jowi.io;
 
@@ -16,6 +29,8 @@ JOWI_SETUP(argc, argv) {
 }
 
 static auto tmp_write_path = fs::path{"/tmp/lolfile"};
+static auto tmp_copy_path = fs::path{"/tmp/lolfile_copy"};
+static auto tmp_dir_path = fs::path{"/tmp/loldir"};
 
 JOWI_ADD_TEST(test_read_buf) {
   auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
@@ -36,10 +51,428 @@ JOWI_ADD_TEST(test_write_file) {
   test_lib::assert_equal(buf.read(), msg);
 }
 
+JOWI_ADD_TEST(test_copy_to) {
+  auto msg = test_lib::random_string(10000);
+  auto src = test_lib::assert_expected_value(
+    io::OpenOptions{}.read_write().truncate().create().open(tmp_write_path)
+  );
+  test_lib::assert_expected_value(src.write(msg));
+  auto dst = test_lib::assert_expected_value(
+    io::OpenOptions{}.write().truncate().create().open(tmp_copy_path)
+  );
+  size_t reported = 0;
+  // the length runs past the end of the source, copying stops there.
+  auto progress = test_lib::assert_expected_value(
+    src.copy_to(dst, 0, 2 * msg.size(), [&](const io::CopyProgress &p) { reported = p.copied; })
+  );
+  test_lib::assert_equal(progress.copied, msg.size());
+  test_lib::assert_equal(reported, msg.size());
+  auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(tmp_copy_path));
+  auto buf = io::DynBuffer{20000};
+  test_lib::assert_expected_value(f.read(buf));
+  test_lib::assert_equal(buf.read(), msg);
+}
+
+/*
+ * waits until count jobs completed on the pool.
+ */
+static void wait_jobs(io::OffloadPool &pool, uint64_t count) {
+  uint64_t done = 0;
+  while (done < count) {
+    done += test_lib::assert_expected_value(pool.wait(5000));
+  }
+}
+
+JOWI_ADD_TEST(test_offload_pool) {
+  auto pool = test_lib::assert_expected_value(io::OffloadPool::create(2));
+  test_lib::assert_equal(pool->worker_count(), size_t{2});
+  std::promise<void> gate;
+  auto gate_future = gate.get_future().share();
+  // the job blocks a worker, the submitting thread is free meanwhile.
+  auto blocked = pool->schedule([gate_future]() {
+    gate_future.wait();
+    return 7;
+  });
+  auto other = pool->schedule([]() { return 11; });
+  wait_jobs(*pool, 1);
+  test_lib::assert_equal(other.poll().value(), 11);
+  test_lib::assert_false(blocked.poll().has_value());
+  gate.set_value();
+  wait_jobs(*pool, 1);
+  test_lib::assert_equal(blocked.poll().value(), 7);
+
+  // dropping the pool runs every queued job before joining the workers.
+  std::atomic<int> ran{0};
+  {
+    auto single = test_lib::assert_expected_value(io::OffloadPool::create(1));
+    for (int i = 0; i < 20; i += 1) {
+      single->schedule([&ran]() { return ran.fetch_add(1) + 1; });
+    }
+  }
+  test_lib::assert_equal(ran.load(), 20);
+}
+
+JOWI_ADD_TEST(test_offload_file_ops) {
+  auto pool = test_lib::assert_expected_value(io::OffloadPool::create(1));
+  fs::remove(tmp_write_path);
+  // offloaded jobs start on submission, their effects are visible once the pool signals them.
+  {
+    auto opening = io::OpenOptions{}.write().create().aopen(*pool, tmp_write_path);
+    wait_jobs(*pool, 1);
+  }
+  test_lib::assert_true(fs::exists(tmp_write_path));
+  // created with mode 0644.
+  auto perms = fs::status(tmp_write_path).permissions();
+  test_lib::assert_true((perms & fs::perms::owner_write) != fs::perms::none);
+  test_lib::assert_true((perms & fs::perms::others_write) == fs::perms::none);
+
+  auto f = test_lib::assert_expected_value(io::OpenOptions{}.read_write().open(tmp_write_path));
+  auto msg = test_lib::random_string(100);
+  {
+    auto writing = f.awrite(*pool, msg);
+    auto syncing = f.async(*pool);
+    wait_jobs(*pool, 2);
+  }
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{100});
+  test_lib::assert_expected(f.seek_beg(0));
+  auto buf = io::DynBuffer{2048};
+  {
+    auto reading = f.aread(*pool, buf);
+    wait_jobs(*pool, 1);
+  }
+  test_lib::assert_equal(buf.read(), msg);
+
+  // copies run on the worker, progress is reported from there.
+  auto dst = test_lib::assert_expected_value(
+    io::OpenOptions{}.write().truncate().create().open(tmp_copy_path)
+  );
+  std::atomic<size_t> reported{0};
+  {
+    auto copying = f.acopy_to(*pool, dst, 0, msg.size(), [&](const io::CopyProgress &p) {
+      reported = p.copied;
+    });
+    wait_jobs(*pool, 1);
+  }
+  test_lib::assert_equal(reported.load(), msg.size());
+  test_lib::assert_equal(fs::file_size(tmp_copy_path), uintmax_t{100});
+}
+
+JOWI_ADD_TEST(test_aligned_buffer) {
+  auto buf = test_lib::assert_expected_value(io::AlignedBuffer::create(5000, 512));
+  test_lib::assert_equal(buf.capacity(), size_t{5120});
+  test_lib::assert_equal(buf.alignment(), size_t{512});
+  test_lib::assert_equal(reinterpret_cast<uintptr_t>(buf.write_beg()) % 512, uintptr_t{0});
+  test_lib::assert_equal(buf.mark_write(100), size_t{100});
+  test_lib::assert_equal(buf.mark_read(100), size_t{100});
+  // drained, writes start from the aligned beginning again.
+  test_lib::assert_equal(buf.writable_size(), size_t{5120});
+  for (size_t alignment : {size_t{0}, size_t{3}, size_t{1000}}) {
+    auto bad = io::AlignedBuffer::create(4096, alignment);
+    test_lib::assert_false(bad.has_value());
+    test_lib::assert_equal(bad.error().err_code(), EINVAL);
+  }
+}
+
+/*
+ * errno of a failed result, 0 when it succeeded.
+ */
+static int err_of(const auto &res) {
+  return res.has_value() ? 0 : res.error().err_code();
+}
+
+JOWI_ADD_TEST(test_direct_io) {
+  auto opened = io::OpenOptions{}.read_write().create().truncate().direct().open(tmp_write_path);
+  // some filesystems (e.g. older tmpfs) refuse O_DIRECT altogether.
+  if (!opened && opened.error().err_code() == EINVAL) return;
+  auto f = test_lib::assert_expected_value(std::move(opened));
+  size_t align = f.direct_alignment();
+  test_lib::assert_true(align != 0);
+  auto buf = test_lib::assert_expected_value(io::AlignedBuffer::create(2 * align, align));
+  std::fill_n(static_cast<char *>(buf.write_beg()), 2 * align, 'd');
+  buf.mark_write(2 * align);
+  test_lib::assert_equal(test_lib::assert_expected_value(f.write(buf.read())), 2 * align);
+  test_lib::assert_equal(test_lib::assert_expected_value(f.write_at(buf.read(), 0)), 2 * align);
+
+  // a misaligned length or file position fails before reaching the kernel, on every path.
+  test_lib::assert_equal(err_of(f.write(buf.read().substr(0, align / 2))), EINVAL);
+  test_lib::assert_expected(f.seek_beg(static_cast<off_t>(align / 2)));
+  test_lib::assert_equal(err_of(f.write(buf.read())), EINVAL);
+  io::LocalFileWritePoller writer{f, buf.read()};
+  test_lib::assert_equal(err_of(writer.poll().value()), EINVAL);
+  auto pool = test_lib::assert_expected_value(io::OffloadPool::create(1));
+  auto offloaded = pool->schedule([&]() { return f.write(buf.read()); });
+  test_lib::assert_expected(pool->wait(5000));
+  test_lib::assert_equal(err_of(offloaded.poll().value()), EINVAL);
+
+  auto in = test_lib::assert_expected_value(io::AlignedBuffer::create(4 * align, align));
+  test_lib::assert_equal(err_of(f.read(in)), EINVAL);
+  io::LocalFileReadPoller<io::AlignedBuffer> reader{f, in};
+  test_lib::assert_equal(err_of(reader.poll().value()), EINVAL);
+  test_lib::assert_expected(f.seek_beg(0));
+  test_lib::assert_expected(f.read(in));
+  test_lib::assert_equal(in.readable_size(), 2 * align);
+  test_lib::assert_equal(in.read(), buf.read());
+  in.reset();
+  test_lib::assert_expected(f.read_at(in, static_cast<off_t>(align)));
+  test_lib::assert_equal(in.readable_size(), align);
+  in.reset();
+  test_lib::assert_equal(err_of(f.read_at(in, 1)), EINVAL);
+}
+
+static uintmax_t allocated_bytes(const fs::path &p) {
+  struct stat st{};
+  test_lib::assert_equal(::stat(p.c_str(), &st), 0);
+  return static_cast<uintmax_t>(st.st_blocks) * 512;
+}
+
+JOWI_ADD_TEST(test_file_layout_controls) {
+  constexpr off_t mib = 1 << 20;
+  auto opts = io::OpenOptions{}.read_write().create().preallocate(mib);
+  {
+    auto f = test_lib::assert_expected_value(io::OpenOptions{opts}.truncate().open(tmp_write_path));
+  }
+  // blocks are reserved without growing the file, also when it is reopened.
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{0});
+  test_lib::assert_true(allocated_bytes(tmp_write_path) >= uintmax_t{mib});
+  auto f = test_lib::assert_expected_value(opts.open(tmp_write_path));
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{0});
+
+  auto data = std::string(64 * 1024, 'a');
+  test_lib::assert_expected(f.write(data));
+  test_lib::assert_expected(f.allocate(0, 2 * mib, false));
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{2 * mib});
+  test_lib::assert_expected(f.allocate(2 * mib, mib, true));
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{2 * mib});
+
+  auto before = allocated_bytes(tmp_write_path);
+  test_lib::assert_expected(f.punch_hole(4096, 8192));
+  test_lib::assert_true(allocated_bytes(tmp_write_path) < before);
+  test_lib::assert_equal(fs::file_size(tmp_write_path), uintmax_t{2 * mib});
+  auto buf = io::DynBuffer{3 * 4096};
+  test_lib::assert_expected(f.read_at(buf, 0));
+  auto content = buf.read();
+  test_lib::assert_equal(content.substr(0, 4096), data.substr(0, 4096));
+  test_lib::assert_equal(content.substr(4096, 8192), std::string(8192, '\0'));
+
+  // hints and writeback control succeed on a regular file.
+  test_lib::assert_expected(f.sync_range(0, 0));
+  test_lib::assert_expected(f.sync_range(0, 64 * 1024, true));
+  test_lib::assert_expected(f.advise(io::FileAdvice::SEQUENTIAL));
+  test_lib::assert_expected(f.advise(io::FileAdvice::DONT_NEED, 0, 64 * 1024));
+  test_lib::assert_expected(f.readahead(0, 64 * 1024));
+  fs::remove(tmp_write_path);
+}
+
+static auto tmp_log_path = fs::path{"/tmp/lolfile_log"};
+
+static std::string replay_all(const fs::path &p) {
+  std::string content;
+  test_lib::assert_expected(
+    io::AppendLog::replay(p, [&](std::string_view group) { content.append(group); })
+  );
+  return content;
+}
+
+JOWI_ADD_TEST(test_append_log_reopen_after_crash) {
+  fs::remove(tmp_log_path);
+  // the child dies with records durable and its preallocation never released.
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    auto log = io::AppendLog::open(tmp_log_path, io::AppendLogOptions{}.preallocate(1 << 20));
+    if (!log) ::_exit(1);
+    (*log)->submit("first\n");
+    bool durable = (*log)->submit("second\n").get().has_value();
+    ::_exit(durable ? 0 : 1);
+  }
+  int status = 0;
+  test_lib::assert_equal(::waitpid(pid, &status, 0), pid);
+  test_lib::assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  // the zero filled preallocation is still there, the groups tell where the log ends.
+  test_lib::assert_equal(fs::file_size(tmp_log_path), uintmax_t{1 << 20});
+  test_lib::assert_equal(replay_all(tmp_log_path), "first\nsecond\n");
+
+  // a group torn by the crash is dropped and overwritten.
+  auto end = test_lib::assert_expected_value(io::AppendLog::replay(tmp_log_path, [](auto) {}));
+  {
+    auto f = test_lib::assert_expected_value(io::OpenOptions{}.write().open(tmp_log_path));
+    uint32_t torn[4] = {0x474f4c4a, 0, 5, 0};
+    test_lib::assert_expected(f.seek_beg(static_cast<off_t>(end)));
+    test_lib::assert_expected(
+      f.write(std::string_view{reinterpret_cast<const char *>(torn), sizeof(torn)})
+    );
+    test_lib::assert_expected(f.write("torn!"));
+  }
+  test_lib::assert_equal(replay_all(tmp_log_path), "first\nsecond\n");
+
+  {
+    auto log = test_lib::assert_expected_value(
+      io::AppendLog::open(tmp_log_path, io::AppendLogOptions{}.preallocate(1 << 20))
+    );
+    auto lsn = test_lib::assert_expected_value(log->submit("third\n").get());
+    test_lib::assert_equal(lsn, uint64_t{1});
+  }
+  test_lib::assert_equal(replay_all(tmp_log_path), "first\nsecond\nthird\n");
+  fs::remove(tmp_log_path);
+
+  // a file that is not a log is not appended to.
+  {
+    auto f = test_lib::assert_expected_value(io::OpenOptions{}.write().create().open(tmp_log_path));
+    test_lib::assert_expected(f.write("plain"));
+  }
+  auto other = io::AppendLog::open(tmp_log_path);
+  test_lib::assert_false(other.has_value());
+  test_lib::assert_equal(other.error().err_code(), EINVAL);
+  fs::remove(tmp_log_path);
+}
+
+JOWI_ADD_TEST(test_append_log_group_commit) {
+  fs::remove(tmp_log_path);
+  constexpr size_t producers = 4;
+  constexpr size_t per_producer = 200;
+  std::vector<std::vector<uint64_t>> lsns(producers);
+  {
+    auto log = test_lib::assert_expected_value(io::AppendLog::open(tmp_log_path));
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p += 1) {
+      threads.emplace_back([&log, &lsns, p]() {
+        std::vector<std::future<std::expected<uint64_t, io::IoError>>> futures;
+        for (size_t i = 0; i < per_producer; i += 1) {
+          futures.emplace_back(log->submit(std::format("{}:{:04}\n", p, i)));
+        }
+        for (auto &fut : futures) {
+          lsns[p].emplace_back(fut.get().value_or(0));
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    test_lib::assert_equal(log->durable_lsn(), uint64_t{producers * per_producer});
+    // groups are committed together, never more than one sync per record.
+    auto groups = test_lib::assert_expected_value(log->on_notify());
+    test_lib::assert_true(groups >= 1 && groups <= producers * per_producer);
+    test_lib::assert_false(log->error().has_value());
+  }
+  // every LSN is handed out once and each producer's records are laid out in its order.
+  std::vector<bool> seen(producers * per_producer + 1, false);
+  for (auto &ids : lsns) {
+    test_lib::assert_true(std::is_sorted(ids.begin(), ids.end()));
+    for (auto lsn : ids) {
+      test_lib::assert_true(lsn != 0 && !seen[lsn]);
+      seen[lsn] = true;
+    }
+  }
+  auto content = replay_all(tmp_log_path);
+  test_lib::assert_equal(content.size(), producers * per_producer * 7);
+  std::vector<size_t> next(producers, 0);
+  for (size_t off = 0; off < content.size(); off += 7) {
+    size_t p = static_cast<size_t>(content[off] - '0');
+    test_lib::assert_equal(content.substr(off, 7), std::format("{}:{:04}\n", p, next[p]));
+    next[p] += 1;
+  }
+  fs::remove(tmp_log_path);
+}
+
+JOWI_ADD_TEST(test_walk_directory) {
+  fs::remove_all(tmp_dir_path);
+  fs::create_directories(tmp_dir_path / "a" / "b");
+  fs::create_directories(tmp_dir_path / "c");
+  for (auto dir : {fs::path{}, fs::path{"a"}, fs::path{"a/b"}, fs::path{"c"}}) {
+    for (size_t i = 0; i != 10; i += 1) {
+      test_lib::assert_expected_value(
+        io::OpenOptions{}.write().create().open(tmp_dir_path / dir / std::format("f{}", i))
+      );
+    }
+  }
+  auto dir = test_lib::assert_expected_value(io::Directory::open(tmp_dir_path));
+  auto entries = io::DirNextable{dir, 512};
+  size_t top_files = 0;
+  size_t top_dirs = 0;
+  while (auto e = entries.next()) {
+    auto entry = test_lib::assert_expected_value(std::move(*e));
+    auto type = test_lib::assert_expected_value(dir.entry_type(entry));
+    top_files += type == io::EntryType::FILE ? 1 : 0;
+    top_dirs += type == io::EntryType::DIRECTORY ? 1 : 0;
+  }
+  test_lib::assert_equal(top_files, 10);
+  test_lib::assert_equal(top_dirs, 2);
+  std::atomic<size_t> files = 0;
+  auto stats = test_lib::assert_expected_value(
+    io::walk_parallel(tmp_dir_path, 4, [&](const io::Directory &, const io::DirEntry &e) {
+      if (e.type == io::EntryType::FILE) files += 1;
+    })
+  );
+  test_lib::assert_equal(files.load(), 40);
+  test_lib::assert_equal(stats.directories, 4);
+  test_lib::assert_equal(stats.entries, 43);
+  test_lib::assert_equal(stats.errors, 0);
+}
+
+JOWI_ADD_TEST(test_walk_wide_directory) {
+  fs::remove_all(tmp_dir_path);
+  constexpr size_t fan_out = 300;
+  for (size_t i = 0; i != fan_out; i += 1) {
+    fs::create_directories(tmp_dir_path / std::format("d{}", i) / "leaf");
+  }
+  // far fewer descriptors than subdirectories.
+  rlimit prev{};
+  test_lib::assert_equal(::getrlimit(RLIMIT_NOFILE, &prev), 0);
+  rlimit low{64, prev.rlim_max};
+  test_lib::assert_equal(::setrlimit(RLIMIT_NOFILE, &low), 0);
+  auto stats =
+    io::walk_parallel(tmp_dir_path, 4, [](const io::Directory &, const io::DirEntry &) {});
+  ::setrlimit(RLIMIT_NOFILE, &prev);
+  auto totals = test_lib::assert_expected_value(std::move(stats));
+  test_lib::assert_equal(totals.errors, size_t{0});
+  test_lib::assert_equal(totals.directories, 2 * fan_out + 1);
+  test_lib::assert_equal(totals.entries, 2 * fan_out);
+  fs::remove_all(tmp_dir_path);
+}
+
+JOWI_ADD_TEST(test_mem_lines_fill_boundaries) {
+  std::vector<std::string> expected{"ab", "", "cd", "last"};
+  std::vector<std::vector<size_t>> patterns{{}, {1}, {2, 3}, {5, 1, 7}};
+  for (const auto &pattern : patterns) {
+    for (size_t buf_size : {1, 4, 64}) {
+      auto src = io::MemSource{"ab\n\ncd\nlast"};
+      src.fills(pattern);
+      auto lines = io::BufNextable{io::DynBuffer{buf_size}, src} | io::LineNextable{};
+      std::vector<std::string> got;
+      while (auto line = lines.next()) {
+        got.emplace_back(test_lib::assert_expected_value(std::move(*line)));
+      }
+      test_lib::assert_true(got == expected);
+    }
+  }
+}
+
+JOWI_ADD_TEST(test_mem_would_block_and_partial_writes) {
+  auto src = io::MemSource{"hello"};
+  src.fills({2}).would_block_every(2);
+  auto buf = io::DynBuffer{16};
+  test_lib::assert_true(src.poll_read(buf).has_value());
+  test_lib::assert_false(src.poll_read(buf).has_value());
+  test_lib::assert_expected(src.read(buf));
+  auto blocked = src.read(buf);
+  test_lib::assert_true(!blocked && blocked.error().is_would_block());
+  test_lib::assert_expected(src.read(buf));
+  test_lib::assert_equal(buf.read(), "hello");
+  auto sink = io::MemSink{};
+  sink.keep().accepts({3});
+  test_lib::assert_equal(test_lib::assert_expected_value(sink.write("hello")), size_t{3});
+  test_lib::assert_equal(test_lib::assert_expected_value(sink.write("lo")), size_t{2});
+  test_lib::assert_equal(sink.data(), "hello");
+  test_lib::assert_equal(sink.bytes(), size_t{5});
+}
+
 JOWI_TEARDOWN() {
   if (fs::exists(tmp_write_path)) {
     fs::remove(tmp_write_path);
   }
+  if (fs::exists(tmp_copy_path)) {
+    fs::remove(tmp_copy_path);
+  }
+  fs::remove_all(tmp_dir_path);
 }
 
 // JOWI_ADD_TEST(test_read_buf) {
@@ -50,29 +483,29 @@ JOWI_TEARDOWN() {
 //   );
 // }
 
-// JOWI_ADD_TEST(test_read_line_by_line) {
-//   auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
-//   uint32_t i = 0;
-//   for (auto b : io::LineIterator{io::DynBuffer{2048}, f}) {
-//     test_lib::assert_equal(
-//       test_lib::assert_expected_value(std::move(b)), std::format("HELLO WORLD {}", i)
-//     );
-//     i += 1;
-//   }
-//   test_lib::assert_equal(i, 3);
-// }
+JOWI_ADD_TEST(test_read_line_by_line) {
+  auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
+  uint32_t i = 0;
+  for (auto b : io::LineIterator{io::DynBuffer{2048}, f}) {
+    test_lib::assert_equal(
+      test_lib::assert_expected_value(std::move(b)), std::format("HELLO WORLD {}", i)
+    );
+    i += 1;
+  }
+  test_lib::assert_equal(i, 3);
+}
 
-// JOWI_ADD_TEST(test_read_lbl_small_buf) {
-//   auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
-//   uint32_t i = 0;
-//   for (auto b : io::LineIterator{io::DynBuffer{5}, f}) {
-//     test_lib::assert_equal(
-//       test_lib::assert_expected_value(std::move(b)), std::format("HELLO WORLD {}", i)
-//     );
-//     i += 1;
-//   }
-//   test_lib::assert_equal(i, 3);
-// }
+JOWI_ADD_TEST(test_read_lbl_small_buf) {
+  auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
+  uint32_t i = 0;
+  for (auto b : io::LineIterator{io::DynBuffer{5}, f}) {
+    test_lib::assert_equal(
+      test_lib::assert_expected_value(std::move(b)), std::format("HELLO WORLD {}", i)
+    );
+    i += 1;
+  }
+  test_lib::assert_equal(i, 3);
+}
 
 // JOWI_ADD_TEST(test_read) {
 //   auto f = test_lib::assert_expected_value(io::OpenOptions{}.read().open(READ_FILE));
@@ -6,7 +6,14 @@ namespace test_lib = jowi::test_lib;
 namespace io = jowi::io;
 
 #include <jowi/test_lib.hpp>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 JOWI_SETUP(argc, argv) {
   test_lib::get_test_context().set_thread_count(1).set_time_unit(
@@ -37,4 +44,218 @@ JOWI_ADD_TEST(test_pipe_check_data_exist) {
   auto msg = test_lib::random_string(100);
   test_lib::assert_expected(w.write(msg));
   test_lib::assert_true(test_lib::assert_expected_value(r.is_readable()));
-}
\ No newline at end of file
+}
+JOWI_ADD_TEST(test_pipe_async_lines) {
+  auto [r, w] = test_lib::assert_expected_value(io::open_pipe());
+  auto lines = io::AsyncLineNextable{io::DynBuffer{16}, r};
+  test_lib::assert_false(lines.poll_next().has_value());
+  test_lib::assert_expected(w.write("first line\nsecond"));
+  auto first = lines.poll_next();
+  test_lib::assert_true(first.has_value() && first->has_value());
+  test_lib::assert_equal(test_lib::assert_expected_value(**first), "first line");
+  test_lib::assert_false(lines.poll_next().has_value());
+  // closing the writer ends the stream, the unterminated line is flushed.
+  {
+    auto writer = std::move(w);
+  }
+  auto second = lines.poll_next();
+  test_lib::assert_true(second.has_value() && second->has_value());
+  test_lib::assert_equal(test_lib::assert_expected_value(**second), "second");
+  auto end = lines.poll_next();
+  test_lib::assert_true(end.has_value() && !end->has_value());
+}
+
+JOWI_ADD_TEST(test_pipe_metrics) {
+  auto [r, w] = test_lib::assert_expected_value(io::open_pipe());
+  // descriptor numbers are reused between tests, compare against a first snapshot.
+  auto reads = [&](const io::MetricsSnapshot &s) {
+    auto fd = s.find(r.native_handle());
+    return fd ? fd->op(io::IoOp::READ) : io::OpMetrics{};
+  };
+  auto before = reads(io::metrics_snapshot());
+  auto buf = io::DynBuffer{100};
+  test_lib::assert_false(r.read(buf).has_value());
+  test_lib::assert_expected(w.write("hello"));
+  test_lib::assert_expected(r.read(buf));
+  auto after = reads(io::metrics_snapshot());
+  uint64_t expected_calls = io::metrics_enabled ? 2 : 0;
+  uint64_t expected_bytes = io::metrics_enabled ? 5 : 0;
+  test_lib::assert_equal(after.calls - before.calls, expected_calls);
+  test_lib::assert_equal(after.would_block - before.would_block, expected_calls / 2);
+  test_lib::assert_equal(after.bytes - before.bytes, expected_bytes);
+  test_lib::assert_equal(after.latency.count() - before.latency.count(), expected_calls);
+}
+
+JOWI_ADD_TEST(test_pipe_trace) {
+  auto [r, w] = test_lib::assert_expected_value(io::open_pipe());
+  auto buf = io::DynBuffer{100};
+  io::trace_clear();
+  io::trace_enable();
+  test_lib::assert_false(r.read(buf).has_value());
+  test_lib::assert_expected(w.write("hello"));
+  test_lib::assert_expected(r.read(buf));
+  io::trace_enable(false);
+  test_lib::assert_expected(w.write("untraced"));
+  std::vector<io::TraceEvent> events;
+  for (auto &t : io::trace_collect()) {
+    events.insert(events.end(), t.events.begin(), t.events.end());
+  }
+  test_lib::assert_equal(events.size(), size_t{3});
+  test_lib::assert_true(events[0].op == io::IoOp::READ && events[0].result == -EAGAIN);
+  test_lib::assert_true(events[1].op == io::IoOp::WRITE && events[1].result == 5);
+  test_lib::assert_true(events[2].op == io::IoOp::READ && events[2].fd == r.native_handle());
+  test_lib::assert_equal(events[2].result, int64_t{5});
+  auto first = R"({"displayTimeUnit":"ns","traceEvents":[{"name":"read")";
+  test_lib::assert_true(io::trace_chrome_json(io::trace_collect()).starts_with(first));
+  io::trace_clear();
+  test_lib::assert_true(io::trace_collect().front().events.empty());
+}
+
+JOWI_ADD_TEST(test_shm_ring_wrap) {
+  auto ring = test_lib::assert_expected_value(io::ShmRing::create(4096));
+  test_lib::assert_equal(ring.capacity(), size_t{4096});
+  test_lib::assert_false(ring.try_peek().has_value());
+  test_lib::assert_false(ring.try_reserve(4096).value().has_value());
+  // 1000 byte messages do not divide the ring, every lap ends with a padding record.
+  for (int i = 0; i < 20; i += 1) {
+    auto msg = std::string(1000, static_cast<char>('a' + i));
+    test_lib::assert_expected(ring.send(msg));
+    test_lib::assert_expected(ring.send(msg));
+    test_lib::assert_equal(test_lib::assert_expected_value(ring.peek()), std::string_view{msg});
+    // peeking again before release returns the same message.
+    test_lib::assert_equal(ring.try_peek().value(), std::string_view{msg});
+    ring.release();
+    test_lib::assert_equal(ring.try_peek().value(), std::string_view{msg});
+    ring.release();
+  }
+  auto timed_out = ring.peek(1);
+  test_lib::assert_false(timed_out.has_value());
+  test_lib::assert_equal(timed_out.error().err_code(), ETIMEDOUT);
+}
+
+JOWI_ADD_TEST(test_shm_ring_wrap_blocked) {
+  auto ring = test_lib::assert_expected_value(io::ShmRing::create(4096));
+  for (char c : {'a', 'b', 'c'}) {
+    test_lib::assert_expected(ring.send(std::string(1000, c)));
+  }
+  auto peer = test_lib::assert_expected_value(io::ShmRing::attach(
+    io::FileDescriptor::manage_default(::dup(ring.mem_handle())),
+    io::FileDescriptor::manage_default(::dup(ring.native_handle()))
+  ));
+  // the record does not fit before the end of the ring, the producer pads it and then sleeps
+  // until two messages were released.
+  auto msg = std::string(1500, 'z');
+  auto producer = std::thread([&msg](io::ShmRing peer) {
+    test_lib::assert_expected(peer.send(msg, 5000));
+  }, std::move(peer));
+  for (char c : {'a', 'b', 'c'}) {
+    test_lib::assert_equal(
+      test_lib::assert_expected_value(ring.peek(5000)), std::string_view{std::string(1000, c)}
+    );
+    ring.release();
+  }
+  test_lib::assert_equal(test_lib::assert_expected_value(ring.peek(5000)), std::string_view{msg});
+  ring.release();
+  producer.join();
+  test_lib::assert_false(ring.try_peek().has_value());
+}
+
+JOWI_ADD_TEST(test_shm_ring_mpsc) {
+  auto ring = test_lib::assert_expected_value(io::ShmRing::create(4096, io::ShmRingKind::MPSC));
+  constexpr int producers = 3;
+  constexpr int per_producer = 2000;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p += 1) {
+    // each producer maps the ring on its own, as another process would.
+    auto peer = test_lib::assert_expected_value(io::ShmRing::attach(
+      io::FileDescriptor::manage_default(::dup(ring.mem_handle())),
+      io::FileDescriptor::manage_default(::dup(ring.native_handle()))
+    ));
+    threads.emplace_back([p](io::ShmRing peer) {
+      for (int i = 0; i < per_producer; i += 1) {
+        auto slot = peer.reserve(sizeof(int) * 2 + i % 100).value();
+        std::memcpy(slot.data.data(), &p, sizeof(int));
+        std::memcpy(slot.data.data() + sizeof(int), &i, sizeof(int));
+        peer.commit(slot);
+      }
+    }, std::move(peer));
+  }
+  std::vector<int> next(producers, 0);
+  bool in_order = true;
+  for (int n = 0; n < producers * per_producer; n += 1) {
+    auto v = test_lib::assert_expected_value(ring.peek(5000));
+    int p = 0;
+    int i = 0;
+    std::memcpy(&p, v.data(), sizeof(int));
+    std::memcpy(&i, v.data() + sizeof(int), sizeof(int));
+    in_order = in_order && next[p] == i && v.size() == sizeof(int) * 2 + i % 100;
+    next[p] += 1;
+    ring.release();
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  test_lib::assert_true(in_order);
+  test_lib::assert_false(ring.try_peek().has_value());
+}
+
+JOWI_ADD_TEST(test_event_notifier) {
+  auto notifier = test_lib::assert_expected_value(io::EventNotifier<int>::create());
+  // a burst wakes the consumer once.
+  for (int i = 0; i < 100; i += 1) {
+    notifier->push(i);
+  }
+  test_lib::assert_equal(notifier->notifications(), uint64_t{1});
+  test_lib::assert_equal(test_lib::assert_expected_value(notifier->on_notify()), uint64_t{1});
+  for (int i = 0; i < 100; i += 1) {
+    test_lib::assert_equal(notifier->try_pop().value(), i);
+  }
+  test_lib::assert_false(notifier->try_pop().has_value());
+  test_lib::assert_false(test_lib::assert_expected_value(notifier->wait(1)).has_value());
+
+  constexpr int producers = 3;
+  constexpr int per_producer = 10000;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p += 1) {
+    threads.emplace_back([&notifier, p]() {
+      for (int i = 0; i < per_producer; i += 1) {
+        notifier->push(p * per_producer + i);
+      }
+    });
+  }
+  std::vector<int> next(producers, 0);
+  bool in_order = true;
+  for (int n = 0; n < producers * per_producer; n += 1) {
+    int v = test_lib::assert_expected_value(notifier->wait(5000)).value();
+    in_order = in_order && v % per_producer == next[v / per_producer];
+    next[v / per_producer] += 1;
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  test_lib::assert_true(in_order);
+  test_lib::assert_true(notifier->notifications() <= uint64_t{1 + producers * per_producer});
+}
+
+JOWI_ADD_TEST(test_spawn_pipes) {
+  auto child = test_lib::assert_expected_value(io::Command{"sh"}
+                                                 .arg("-c")
+                                                 .arg("read x; printf \"$x-$JOWI_VAR\"; exit 3")
+                                                 .env("JOWI_VAR", "var")
+                                                 .in(io::StdioMode::PIPE)
+                                                 .out(io::StdioMode::PIPE)
+                                                 .non_blocking(false)
+                                                 .spawn());
+  auto msg = test_lib::random_string(10);
+  test_lib::assert_expected(child.in()->write(msg + "\n"));
+  auto status = test_lib::assert_expected_value(child.wait());
+  test_lib::assert_equal(status.code, 3);
+  test_lib::assert_equal(status.signal, 0);
+  auto buf = io::DynBuffer{100};
+  test_lib::assert_expected(child.out()->read(buf));
+  test_lib::assert_equal(buf.read(), msg + "-var");
+}
+
+JOWI_ADD_TEST(test_spawn_missing_program) {
+  test_lib::assert_false(io::Command{"/nonexistent/jowi_io_program"}.spawn().has_value());
+}
@@ -1,11 +1,19 @@
 #include <jowi/test_lib.hpp>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <coroutine>
+#include <expected>
+#include <fcntl.h>
 #include <filesystem>
 #include <format>
 #include <future>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 import jowi.test_lib;
 import jowi.io;
 import jowi.generic;
@@ -82,6 +90,61 @@ JOWI_ADD_TEST(test_local_tcp) {
   test_lib::assert_equal(buf.read(), msg);
 }
 
+JOWI_ADD_TEST(test_ipv4_tcp_accept_batch) {
+  int port = test_lib::random_integer(20'000, 30'0000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  std::vector<io::TcpSocket<io::Ipv4Address>> clients;
+  for (int i = 0; i < 3; i += 1) {
+    clients.emplace_back(test_lib::assert_expected_value(io::tcp_connect(server_addr)));
+  }
+  std::vector<io::TcpSocket<io::Ipv4Address>> accepted;
+  while (accepted.size() < clients.size()) {
+    auto batch = server.accept_batch(8);
+    if (!batch) continue;
+    for (auto &sock : test_lib::assert_expected_value(std::move(batch).value())) {
+      accepted.emplace_back(std::move(sock));
+    }
+  }
+  test_lib::assert_equal(accepted.size(), clients.size());
+  for (const auto &sock : accepted) {
+    test_lib::assert_true((fcntl(sock.native_handle(), F_GETFL) & O_NONBLOCK) != 0);
+    test_lib::assert_true((fcntl(sock.native_handle(), F_GETFD) & FD_CLOEXEC) != 0);
+  }
+  test_lib::assert_false(server.accept_batch(8).has_value());
+}
+
+JOWI_ADD_TEST(test_local_tcp_frames) {
+  auto server_conf = io::LocalAddress::with_address(issue_socket().c_str());
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto opts = io::FrameOptions{}.prefix(io::FramePrefix::VARINT);
+  std::vector<std::string> msgs{test_lib::random_string(10), "", test_lib::random_string(300)};
+  auto fut = std::async(
+    std::launch::async,
+    [&](auto server) {
+      auto accept_res = server.accept();
+      while (!accept_res) {
+        accept_res = server.accept();
+      }
+      auto sock = test_lib::assert_expected_value(std::move(accept_res).value());
+      auto encoder = io::FrameEncoder{opts};
+      std::vector<std::string_view> bodies{msgs.begin(), msgs.end()};
+      test_lib::assert_expected_value(encoder.send(sock, bodies));
+    },
+    std::move(server)
+  );
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_conf));
+  // smaller than the last frame, which is then assembled across reads.
+  auto frames = io::BufNextable{io::DynBuffer{64}, client} | io::FrameNextable{opts};
+  size_t i = 0;
+  while (auto frame = frames.next()) {
+    test_lib::assert_equal(test_lib::assert_expected_value(std::move(*frame)), msgs[i]);
+    i += 1;
+  }
+  test_lib::assert_equal(i, msgs.size());
+}
+
 JOWI_ADD_TEST(test_ipv4_udp) {
   int port = test_lib::random_integer(20'000, 30'0000);
   auto server_conf = io::Ipv4Address::listen_all(port);
@@ -96,6 +159,427 @@ JOWI_ADD_TEST(test_ipv4_udp) {
   test_lib::assert_equal(buf.read(), msg);
 }
 
+static int sock_opt(int fd, int level, int name) {
+  int v = -1;
+  socklen_t len = sizeof(v);
+  getsockopt(fd, level, name, &v, &len);
+  return v;
+}
+
+JOWI_ADD_TEST(test_local_tcp_large_frames) {
+  auto server_conf = io::LocalAddress::with_address(issue_socket().c_str());
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  // every frame is larger than the send buffer of the accepted, non-blocking, socket.
+  std::vector<std::string> msgs{
+    test_lib::random_string(1 << 20), test_lib::random_string(10), test_lib::random_string(3 << 20)
+  };
+  auto fut = std::async(
+    std::launch::async,
+    [&](auto server) {
+      auto accept_res = server.accept();
+      while (!accept_res) {
+        accept_res = server.accept();
+      }
+      auto sock = test_lib::assert_expected_value(std::move(accept_res).value());
+      test_lib::assert_true(
+        sock_opt(sock.native_handle(), SOL_SOCKET, SO_SNDBUF) < static_cast<int>(msgs[0].size())
+      );
+      auto encoder = io::FrameEncoder{};
+      std::vector<std::string_view> bodies{msgs.begin(), msgs.end()};
+      test_lib::assert_expected_value(encoder.send(sock, bodies));
+    },
+    std::move(server)
+  );
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_conf));
+  auto frames = io::BufNextable{io::DynBuffer{64 * 1024}, client} | io::FrameNextable{};
+  size_t i = 0;
+  while (auto frame = frames.next()) {
+    test_lib::assert_equal(test_lib::assert_expected_value(std::move(*frame)), msgs[i]);
+    i += 1;
+  }
+  test_lib::assert_equal(i, msgs.size());
+  fut.get();
+}
+
+JOWI_ADD_TEST(test_socket_options) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto listen_opts = io::SocketOptions{}.reuse_addr().reuse_port();
+  auto server =
+    test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50, listen_opts));
+  test_lib::assert_expected(server.defer_accept(std::chrono::seconds{5}));
+  int lfd = server.native_handle();
+  test_lib::assert_equal(sock_opt(lfd, SOL_SOCKET, SO_REUSEADDR), 1);
+  test_lib::assert_equal(sock_opt(lfd, SOL_SOCKET, SO_REUSEPORT), 1);
+  test_lib::assert_true(sock_opt(lfd, IPPROTO_TCP, TCP_DEFER_ACCEPT) > 0);
+
+  auto opts = io::SocketOptions{}
+                .no_delay()
+                .send_buffer(64 * 1024)
+                .recv_buffer(64 * 1024)
+                .not_sent_lowat(16 * 1024)
+                .keep_alive(std::chrono::seconds{30}, std::chrono::seconds{5}, 3);
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_addr, opts));
+  int fd = client.native_handle();
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_NODELAY), 1);
+  // the kernel doubles buffer sizes for its bookkeeping.
+  test_lib::assert_equal(sock_opt(fd, SOL_SOCKET, SO_SNDBUF), 128 * 1024);
+  test_lib::assert_equal(sock_opt(fd, SOL_SOCKET, SO_RCVBUF), 128 * 1024);
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT), 16 * 1024);
+  test_lib::assert_equal(sock_opt(fd, SOL_SOCKET, SO_KEEPALIVE), 1);
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE), 30);
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_KEEPINTVL), 5);
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_KEEPCNT), 3);
+  test_lib::assert_expected(client.set_options(io::SocketOptions{}.no_delay(false).cork()));
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_NODELAY), 0);
+  test_lib::assert_equal(sock_opt(fd, IPPROTO_TCP, TCP_CORK), 1);
+  test_lib::assert_expected(client.set_options(io::SocketOptions{}.cork(false)));
+
+  // with deferred accepts the connection only surfaces once data arrived.
+  test_lib::assert_expected_value(client.send_more("head", false));
+  test_lib::assert_expected_value(client.send("body", false));
+  struct pollfd conf{lfd, POLLIN, 0};
+  test_lib::assert_equal(poll(&conf, 1, 5000), 1);
+  auto sock = test_lib::assert_expected_value(server.accept().value());
+  auto buf = io::DynBuffer{64};
+  while (buf.readable_size() < 8) {
+    test_lib::assert_expected(sock.read(buf));
+  }
+  test_lib::assert_equal(buf.read(), "headbody");
+}
+
+JOWI_ADD_TEST(test_ipv4_tcp_zero_copy) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_addr));
+  auto plain = test_lib::assert_expected_value(io::tcp_connect(server_addr));
+  std::vector<io::TcpSocket<io::Ipv4Address>> accepted;
+  while (accepted.size() < 2) {
+    if (auto res = server.accept()) accepted.emplace_back(test_lib::assert_expected_value(*res));
+  }
+  auto big = std::string(4 << 20, 'z');
+  // drains both connections so that the senders never stay blocked on a full window.
+  auto reader = std::async(std::launch::async, [&]() {
+    size_t total = 0;
+    auto buf = io::DynBuffer{64 * 1024};
+    while (total < 2 * big.size() + 100) {
+      for (auto &sock : accepted) {
+        if (sock.recv(buf).has_value()) total += buf.readable_size();
+        buf.mark_read(buf.readable_size());
+      }
+    }
+    return total;
+  });
+  test_lib::assert_expected(client.enable_zero_copy(64 * 1024));
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(client.send_zero_copy(big)), big.size()
+  );
+  auto &zc = client.zero_copy_state();
+  test_lib::assert_true(zc.next_id > 0);
+  test_lib::assert_true(zc.is_released(zc.next_id - 1));
+  // loopback never transmits from user pages, every completion reports a copy.
+  test_lib::assert_true(zc.copied > 0);
+  uint32_t ids = zc.next_id;
+  auto small = std::string(100, 's');
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(client.send_zero_copy(small)), small.size()
+  );
+  test_lib::assert_equal(zc.next_id, ids);
+  // without zero copy the payload is still sent whole, across partial sends.
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(plain.send_zero_copy(big)), big.size()
+  );
+  test_lib::assert_equal(plain.zero_copy_state().next_id, uint32_t{0});
+  test_lib::assert_equal(reader.get(), 2 * big.size() + 100);
+}
+
+JOWI_ADD_TEST(test_local_socket_tcp_option_fails) {
+  auto server_conf = io::LocalAddress::with_address(issue_socket().c_str());
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto res = server.set_options(io::SocketOptions{}.no_delay());
+  test_lib::assert_false(res.has_value());
+  test_lib::assert_equal(res.error().err_code(), EOPNOTSUPP);
+}
+
+JOWI_ADD_TEST(test_ipv4_tcp_info_timestamps) {
+  int port = test_lib::random_integer(20'000, 30'0000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_addr));
+  auto accept_res = server.accept();
+  while (!accept_res) {
+    accept_res = server.accept();
+  }
+  auto sock = test_lib::assert_expected_value(std::move(accept_res).value());
+  test_lib::assert_expected(client.enable_timestamps());
+  test_lib::assert_expected(sock.enable_timestamps());
+  test_lib::assert_expected_value(client.send("hello", false));
+  auto buf = io::DynBuffer{64};
+  auto at = test_lib::assert_expected_value(sock.recv_timestamped(buf, false));
+  test_lib::assert_equal(buf.read(), "hello");
+  test_lib::assert_true(at.has_value());
+  auto info = test_lib::assert_expected_value(client.tcp_info());
+  test_lib::assert_true(info.state == TCP_ESTABLISHED);
+  test_lib::assert_true(info.snd_mss > 0);
+  // the peer has read everything, so the acknowledgement timestamp follows shortly.
+  std::vector<io::TxTimestamp> stamps;
+  while (std::ranges::none_of(stamps, [](auto &t) { return t.stage == io::TxStage::ACKED; })) {
+    test_lib::assert_expected(client.tx_timestamps(stamps));
+  }
+  // ids are offsets of the last byte of each send.
+  test_lib::assert_true(std::ranges::all_of(stamps, [](auto &t) { return t.id == 4; }));
+  test_lib::assert_true(stamps.front().at <= stamps.back().at);
+}
+
+JOWI_ADD_TEST(test_ipv4_udp_timestamps) {
+  int port = test_lib::random_integer(20'000, 30'0000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_udp_bind(server_conf));
+  auto client = test_lib::assert_expected_value(io::create_udp_socket<io::Ipv4Address>());
+  test_lib::assert_expected(server.enable_timestamps());
+  test_lib::assert_expected(client.enable_timestamps());
+  test_lib::assert_expected_value(client.send("a", server_addr, false));
+  test_lib::assert_expected_value(client.send("bb", server_addr, false));
+  auto buf = io::DynBuffer{64};
+  auto first = test_lib::assert_expected_value(server.recv_timestamped(buf, false));
+  test_lib::assert_equal(buf.read(), "a");
+  test_lib::assert_true(first.at.has_value());
+  std::vector<io::TxTimestamp> stamps;
+  test_lib::assert_expected(client.tx_timestamps(stamps));
+  test_lib::assert_true(std::ranges::any_of(stamps, [](auto &t) {
+    return t.id == 1 && t.stage == io::TxStage::SENT;
+  }));
+}
+
+JOWI_ADD_TEST(test_local_pass_fds) {
+  auto server_conf = io::LocalAddress::with_address(issue_socket().c_str());
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_conf));
+  auto accept_res = server.accept();
+  while (!accept_res) {
+    accept_res = server.accept();
+  }
+  auto worker = test_lib::assert_expected_value(std::move(accept_res).value());
+  auto path = fs::path{"/tmp/jowi_io_pass_fds"};
+  auto file = test_lib::assert_expected_value(
+    io::OpenOptions{}.read_write().truncate().create().open(path)
+  );
+  test_lib::assert_expected(file.write("shared"));
+  // a connection accepted by the front, handed over to the worker.
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto tcp_server = test_lib::assert_expected_value(
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 50)
+  );
+  auto tcp_client = test_lib::assert_expected_value(
+    io::tcp_connect(test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port)))
+  );
+  auto tcp_accept = tcp_server.accept();
+  while (!tcp_accept) {
+    tcp_accept = tcp_server.accept();
+  }
+  auto conn = test_lib::assert_expected_value(std::move(tcp_accept).value());
+
+  std::array<int, 2> fds{file.native_handle(), conn.native_handle()};
+  test_lib::assert_false(client.send_fds("", fds).has_value());
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(client.send_fds("fds", fds, false)), size_t{3}
+  );
+  auto buf = io::DynBuffer{64};
+  std::vector<io::FileDescriptor> received;
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(worker.recv_fds(buf, received, false)), size_t{2}
+  );
+  test_lib::assert_equal(buf.read(), "fds");
+  test_lib::assert_true((fcntl(received[0].get_or(-1), F_GETFD) & FD_CLOEXEC) != 0);
+
+  // the file description, offset included, is shared with the sender.
+  auto passed_file = io::LocalFile::adopt(std::move(received[0]));
+  test_lib::assert_expected(passed_file.seek_beg(0));
+  auto file_buf = io::DynBuffer{64};
+  test_lib::assert_expected(passed_file.read(file_buf));
+  test_lib::assert_equal(file_buf.read(), "shared");
+  auto passed_conn =
+    test_lib::assert_expected_value(io::TcpSocket<io::Ipv4Address>::adopt(std::move(received[1])));
+  test_lib::assert_expected_value(passed_conn.send("from worker", false));
+  auto conn_buf = io::DynBuffer{64};
+  test_lib::assert_expected(tcp_client.recv(conn_buf, false));
+  test_lib::assert_equal(conn_buf.read(), "from worker");
+  fs::remove(path);
+}
+
+static io::TcpSocket<io::Ipv4Address> accept_one(io::TcpListener<io::Ipv4Address> &server) {
+  auto res = server.accept();
+  while (!res) {
+    res = server.accept();
+  }
+  return test_lib::assert_expected_value(std::move(res).value());
+}
+
+JOWI_ADD_TEST(test_ipv4_tcp_blocking_on_accepted) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server_conf = io::Ipv4Address::listen_all(port);
+  auto server_addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  auto server = test_lib::assert_expected_value(io::create_tcp_listener(server_conf, 50));
+  // larger than both socket buffers, the sender has to wait for the reader.
+  auto msg = std::string(8 << 20, 'b');
+  auto fut = std::async(std::launch::async, [&]() {
+    // accepted sockets are O_NONBLOCK, the blocking calls wait anyway.
+    auto sock = accept_one(server);
+    std::string_view rest{msg};
+    while (!rest.empty()) {
+      rest.remove_prefix(test_lib::assert_expected_value(sock.send(rest, false)));
+    }
+    auto buf = io::DynBuffer{16};
+    test_lib::assert_expected(sock.recv(buf, false));
+    test_lib::assert_equal(buf.read(), std::string_view{"done"});
+  });
+  auto client = test_lib::assert_expected_value(io::tcp_connect(server_addr));
+  std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  auto buf = io::DynBuffer{64 * 1024};
+  size_t received = 0;
+  while (received < msg.size()) {
+    test_lib::assert_expected(client.recv(buf, false));
+    test_lib::assert_true(buf.is_readable());
+    received += buf.readable_size();
+    buf.mark_read(buf.readable_size());
+  }
+  test_lib::assert_equal(received, msg.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  test_lib::assert_expected_value(client.send("done", false));
+  fut.get();
+}
+
+JOWI_ADD_TEST(test_pool_acquire_release) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server = test_lib::assert_expected_value(
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 50)
+  );
+  auto addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  io::TcpConnectionPool<io::Ipv4Address> pool{addr, io::PoolOptions{}.max_idle(1).max_total(3)};
+  auto first = test_lib::assert_expected_value(pool.acquire());
+  auto conn = accept_one(server);
+  test_lib::assert_equal(
+    test_lib::assert_expected_value(first->send("ping")), size_t{4}
+  );
+  auto buf = io::DynBuffer{64};
+  test_lib::assert_expected(conn.recv(buf, false));
+  test_lib::assert_equal(buf.read(), "ping");
+  int fd = first->native_handle();
+  first.release();
+  test_lib::assert_equal(pool.idle_count(), size_t{1});
+  test_lib::assert_equal(pool.total_count(), size_t{1});
+
+  // the idle connection is reused rather than connecting again.
+  auto again = test_lib::assert_expected_value(pool.acquire());
+  test_lib::assert_equal(again->native_handle(), fd);
+  test_lib::assert_equal(pool.idle_count(), size_t{0});
+
+  // max_total caps the open connections, max_idle the ones kept on release.
+  auto second = test_lib::assert_expected_value(pool.acquire());
+  auto third = test_lib::assert_expected_value(pool.acquire());
+  auto exhausted = pool.acquire();
+  test_lib::assert_false(exhausted.has_value());
+  test_lib::assert_equal(exhausted.error().err_code(), EAGAIN);
+  again.release();
+  second.release();
+  third.release();
+  test_lib::assert_equal(pool.idle_count(), size_t{1});
+  test_lib::assert_equal(pool.total_count(), size_t{1});
+  auto last = test_lib::assert_expected_value(pool.acquire());
+  last.discard();
+  test_lib::assert_equal(pool.total_count(), size_t{0});
+}
+
+JOWI_ADD_TEST(test_pool_evicts_dead_connections) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server = test_lib::assert_expected_value(
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 50)
+  );
+  auto addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  io::TcpConnectionPool<io::Ipv4Address> pool{addr};
+  {
+    auto lease = test_lib::assert_expected_value(pool.acquire());
+    auto conn = accept_one(server);
+    test_lib::assert_expected(lease->send("ping"));
+    // the upstream closes the connection while it sits idle in the pool.
+    lease.release();
+  }
+  test_lib::assert_equal(pool.idle_count(), size_t{1});
+  std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  auto fresh = test_lib::assert_expected_value(pool.acquire());
+  test_lib::assert_equal(pool.total_count(), size_t{1});
+  auto conn = accept_one(server);
+  test_lib::assert_expected(fresh->send("pong"));
+  auto buf = io::DynBuffer{64};
+  test_lib::assert_expected(conn.recv(buf, false));
+  test_lib::assert_equal(buf.read(), "pong");
+  fresh.release();
+
+  // prune closes connections idle for longer than the timeout.
+  io::TcpConnectionPool<io::Ipv4Address> short_lived{
+    addr, io::PoolOptions{}.idle_timeout(std::chrono::milliseconds{5})
+  };
+  test_lib::assert_expected_value(short_lived.acquire()).release();
+  auto idle_conn = accept_one(server);
+  test_lib::assert_equal(short_lived.idle_count(), size_t{1});
+  std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  short_lived.prune();
+  test_lib::assert_equal(short_lived.idle_count(), size_t{0});
+  test_lib::assert_equal(short_lived.total_count(), size_t{0});
+}
+
+JOWI_ADD_TEST(test_pool_refused_connection) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  io::TcpConnectionPool<io::Ipv4Address> pool{addr};
+  // the handshake completes before a connection is handed out, a refusal fails the acquire.
+  auto lease = pool.acquire();
+  test_lib::assert_false(lease.has_value());
+  test_lib::assert_equal(lease.error().err_code(), ECONNREFUSED);
+  test_lib::assert_equal(pool.total_count(), size_t{0});
+  io::PoolAcquirePoller<io::Ipv4Address> connecting{pool};
+  auto res = connecting.poll();
+  while (!res) {
+    res = connecting.poll();
+  }
+  test_lib::assert_false(res->has_value());
+  test_lib::assert_equal(res->error().err_code(), ECONNREFUSED);
+  test_lib::assert_equal(pool.total_count(), size_t{0});
+}
+
+JOWI_ADD_TEST(test_pool_acquire_waiter) {
+  int port = test_lib::random_integer(20'000, 30'000);
+  auto server = test_lib::assert_expected_value(
+    io::create_tcp_listener(io::Ipv4Address::listen_all(port), 50)
+  );
+  auto addr = test_lib::assert_expected_value(io::Ipv4Address::create("127.0.0.1", port));
+  io::TcpConnectionPool<io::Ipv4Address> pool{addr, io::PoolOptions{}.max_total(1)};
+  // the poller behind aacquire().
+  io::PoolAcquirePoller<io::Ipv4Address> connecting{pool};
+  auto res = connecting.poll();
+  while (!res) {
+    res = connecting.poll();
+  }
+  auto lease = test_lib::assert_expected_value(std::move(res).value());
+  auto conn = accept_one(server);
+  int fd = lease->native_handle();
+  io::PoolAcquirePoller<io::Ipv4Address> waiter{pool};
+  test_lib::assert_false(waiter.poll().has_value());
+  test_lib::assert_equal(pool.total_count(), size_t{1});
+  // a release hands the connection to the waiter.
+  lease.release();
+  auto handed = waiter.poll();
+  test_lib::assert_true(handed.has_value());
+  auto next = test_lib::assert_expected_value(std::move(handed).value());
+  test_lib::assert_equal(next->native_handle(), fd);
+  test_lib::assert_equal(pool.total_count(), size_t{1});
+}
+
 template <io::NetAddress Addr>
 asio::BasicTask<void> tcp_server_task(
   io::TcpListener<Addr> &server, std::string_view msg, const Addr &addr
@@ -0,0 +1,194 @@
+import jowi.test_lib;
+import jowi.io;
+import jowi.generic;
+
+namespace test_lib = jowi::test_lib;
+namespace io = jowi::io;
+
+#include <jowi/test_lib.hpp>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+using steady = std::chrono::steady_clock;
+
+JOWI_SETUP(argc, argv) {
+  test_lib::get_test_context().set_thread_count(1).set_time_unit(
+    test_lib::TestTimeUnit::MILLI_SECONDS
+  );
+}
+
+/*
+ * advances the wheel every millisecond until every timer fired, returns when each one was first
+ * seen fired, in milliseconds since the timers were armed.
+ */
+static std::vector<int64_t> fire_times(
+  io::TimerWheel &wheel, const std::vector<io::TimerId> &ids, steady::time_point beg
+) {
+  std::vector<int64_t> fired(ids.size(), -1);
+  size_t left = ids.size();
+  while (left != 0) {
+    std::this_thread::sleep_for(1ms);
+    wheel.advance();
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(steady::now() - beg);
+    for (size_t i = 0; i < ids.size(); i += 1) {
+      if (fired[i] == -1 && wheel.is_fired(ids[i])) {
+        fired[i] = now.count();
+        left -= 1;
+      }
+    }
+  }
+  return fired;
+}
+
+JOWI_ADD_TEST(test_timer_wheel_arm_fire) {
+  io::TimerWheel wheel{};
+  auto id = wheel.arm(20ms);
+  wheel.advance();
+  test_lib::assert_false(wheel.is_fired(id));
+  test_lib::assert_equal(wheel.armed(), size_t{1});
+  std::this_thread::sleep_for(25ms);
+  wheel.advance();
+  test_lib::assert_true(wheel.is_fired(id));
+  test_lib::assert_equal(wheel.armed(), size_t{0});
+  wheel.release(id);
+  test_lib::assert_false(wheel.is_fired(id));
+}
+
+JOWI_ADD_TEST(test_timer_wheel_cancel_stale_handle) {
+  io::TimerWheel wheel{};
+  auto first = wheel.arm(5ms);
+  wheel.release(first);
+  test_lib::assert_equal(wheel.armed(), size_t{0});
+  // the slot is reused, the old handle no longer reaches it.
+  auto second = wheel.arm(5ms);
+  test_lib::assert_equal(second.index, first.index);
+  wheel.release(first);
+  wheel.release(io::TimerId::invalid());
+  test_lib::assert_equal(wheel.armed(), size_t{1});
+  std::this_thread::sleep_for(10ms);
+  wheel.advance();
+  test_lib::assert_true(wheel.is_fired(second));
+  test_lib::assert_false(wheel.is_fired(first));
+  wheel.release(second);
+  wheel.release(second);
+  test_lib::assert_false(wheel.is_fired(second));
+
+  // a cancelled timer never fires.
+  auto cancelled = wheel.arm(1ms);
+  wheel.release(cancelled);
+  std::this_thread::sleep_for(5ms);
+  wheel.advance();
+  test_lib::assert_false(wheel.is_fired(cancelled));
+}
+
+JOWI_ADD_TEST(test_timer_wheel_cascade) {
+  io::TimerWheel wheel{};
+  // both sides of the level 1 (64 ticks) and level 2 (4096 ticks) boundaries.
+  std::vector<int64_t> after{1, 63, 64, 65, 127, 128, 129, 4095, 4096, 4097};
+  std::vector<io::TimerId> ids;
+  auto beg = steady::now();
+  for (auto ms : after) {
+    ids.emplace_back(wheel.arm(std::chrono::milliseconds{ms}));
+  }
+  // level 3 and beyond the span of the wheel, neither fires during the test.
+  auto far = wheel.arm(300'000ms);
+  auto beyond = wheel.arm(std::chrono::hours{24});
+  auto fired = fire_times(wheel, ids, beg);
+  for (size_t i = 0; i < after.size(); i += 1) {
+    // a timer armed part way through a tick may fire up to one tick early.
+    test_lib::assert_true(fired[i] >= after[i] - 1);
+    test_lib::assert_true(fired[i] <= after[i] + 50);
+  }
+  test_lib::assert_false(wheel.is_fired(far));
+  test_lib::assert_false(wheel.is_fired(beyond));
+  test_lib::assert_equal(wheel.armed(), size_t{2});
+  wheel.release(far);
+  wheel.release(beyond);
+  test_lib::assert_equal(wheel.armed(), size_t{0});
+}
+
+JOWI_ADD_TEST(test_timer_wheel_idle_period) {
+  io::TimerWheel wheel{};
+  wheel.advance();
+  std::this_thread::sleep_for(50ms);
+  // arming after the idle period does not leave the idle ticks to the next advance.
+  auto id = wheel.arm(1ms);
+  std::this_thread::sleep_for(5ms);
+  test_lib::assert_true(wheel.advance() < uint64_t{40});
+  test_lib::assert_true(wheel.is_fired(id));
+  wheel.release(id);
+}
+
+JOWI_ADD_TEST(test_timer_wheel_poll_round) {
+  io::TimerWheel wheel{};
+  auto id = wheel.arm(5ms);
+  std::vector<uint64_t> seen(3, wheel.poll_epoch());
+  uint64_t start = wheel.poll_epoch();
+  // the first poller of a round advances the wheel, the others reuse it.
+  for (auto &s : seen) {
+    wheel.poll_advance(s);
+  }
+  test_lib::assert_equal(wheel.poll_epoch(), start + 1);
+  test_lib::assert_false(wheel.is_fired(id));
+  std::this_thread::sleep_for(10ms);
+  // the next round starts when a poller comes back.
+  wheel.poll_advance(seen[1]);
+  test_lib::assert_equal(wheel.poll_epoch(), start + 2);
+  test_lib::assert_true(wheel.is_fired(id));
+  wheel.poll_advance(seen[0]);
+  wheel.poll_advance(seen[2]);
+  test_lib::assert_equal(wheel.poll_epoch(), start + 2);
+  wheel.release(id);
+}
+
+JOWI_ADD_TEST(test_timer_wheel_timer_fd) {
+  io::TimerWheel wheel{};
+  test_lib::assert_equal(wheel.native_handle(), -1);
+  test_lib::assert_expected(wheel.enable_timer_fd());
+  test_lib::assert_true(wheel.native_handle() >= 0);
+  auto id = wheel.arm(10ms);
+  std::this_thread::sleep_for(15ms);
+  // pollers leave a timerfd driven wheel alone.
+  uint64_t seen = wheel.poll_epoch();
+  wheel.poll_advance(seen);
+  test_lib::assert_false(wheel.is_fired(id));
+  pollfd pfd{wheel.native_handle(), POLLIN, 0};
+  while (!wheel.is_fired(id)) {
+    test_lib::assert_equal(::poll(&pfd, 1, 1000), 1);
+    test_lib::assert_expected(wheel.on_timer_fd());
+  }
+  wheel.release(id);
+  // the timerfd stops ticking once no timer is armed.
+  (void)wheel.on_timer_fd();
+  test_lib::assert_equal(::poll(&pfd, 1, 20), 0);
+}
+
+JOWI_ADD_TEST(test_deadline_read_timeout) {
+  int fds[2];
+  test_lib::assert_equal(::pipe2(fds, O_NONBLOCK | O_CLOEXEC), 0);
+  auto r = io::FileDescriptor::manage_default(fds[0]);
+  auto w = io::FileDescriptor::manage_default(fds[1]);
+  auto buf = io::DynBuffer{64};
+  // the poller behind `ReaderPipe::aread(buf, timeout)`.
+  io::DeadlinePoller<io::SysReadPoller<io::DynBuffer>> timed{10ms, r, buf};
+  test_lib::assert_false(timed.poll().has_value());
+  std::this_thread::sleep_for(15ms);
+  auto res = timed.poll();
+  test_lib::assert_true(res.has_value() && !res->has_value());
+  test_lib::assert_equal(res->error().err_code(), ETIMEDOUT);
+
+  // data ready when the deadline passes is still delivered.
+  io::DeadlinePoller<io::SysReadPoller<io::DynBuffer>> ready{1ms, r, buf};
+  test_lib::assert_equal(::write(fds[1], "late", 4), ssize_t{4});
+  std::this_thread::sleep_for(5ms);
+  auto data = ready.poll();
+  test_lib::assert_true(data.has_value() && data->has_value());
+  test_lib::assert_equal(buf.read(), "late");
+}